@@ -12,98 +12,50 @@
 
 #include "MIDI.h"
 
-// would put in MIDI struct but would require passing
-// separately anyway for volatile keyword
-// (which I can't apply to whole struct due to vectors)
-volatile double ticksPerSecond;
+std::mutex mtx;
 
-// same for this. used to keep track of available indices in portAudio optimized
-// note array
-std::queue<uint16_t> availablePlayIndices;
+MIDI::MIDI() : maxFileSize(MAX_MIDI_FILE_SIZE_IN_BYTES), isClosing(false), keepOutputsOpen(false), playFromUsec(0), loopToUsec(0), console(&std::cout), parseThreads(0), controllers(nullptr), stream(nullptr),
+	hasCompiledSong(false), compiling(false), compileUsec(0), playingCompiled(false), batchingPackets(false), playingLive(false), nullSink(false), nullSinkPackets(0) {}
 
-std::mutex mtx, track0mtx;
-std::condition_variable cv;
-volatile bool ready;
+MIDI::~MIDI() {
+	finishMidiLog();
+}
 
-// load entire binary contents of MIDI file into RAM (they're small)
+// map the MIDI file for zero-copy parsing
 bool MIDI::loadBinaryFile() {
 
-	std::ifstream in(fileName.c_str(), std::ios::binary);
-	if (!in) {
-		std::cout << "Failed to open file. Is the file name correct?" << std::endl;
+	if (!rawMIDI.open(fileName, maxFileSize, *console))
 		return false;
-	}
 
-	in.seekg(0, std::ios::end);
-	fileSize = static_cast<size_t>(in.tellg());
-	if (fileSize > MAX_MIDI_FILE_SIZE_IN_BYTES) {
-		std::cout << "File is too large! Are you sure that's a MIDI?" << std::endl;
+	fileSize = rawMIDI.size();
+
+	// events store payload offsets in 32 bits
+	if (static_cast<uint64_t>(fileSize) > UINT32_MAX) {
+		*console << "File is too large! Are you sure that's a MIDI?" << std::endl;
+		rawMIDI.close();
 		return false;
 	}
 
-	// slightly evil trick
-	// write data directly into string buffer
-	// not pretty, but guaranteed safe since
-	// C++11 mandates contiguous string storage
-	rawMIDI.clear();
-	rawMIDI.resize(fileSize);
-	in.seekg(0, std::ios::beg);
-	in.read(&rawMIDI[0], fileSize);
-	in.close();
-
 	return true;
 }
 
-// MIDIs contain some quantities stored as
-// 'variable-length quantities', where 7 bits
-// per byte are used for storage and the 8th bit
-// is used as a flag - 1 means there are more
-// bytes, 0 means this is the last byte
-// (see the MIDI standard)
-size_t MIDI::readVariableLengthQuantity() {
-	size_t value;
-	uint8_t c;
-	// store byte in value
-	// if no flag, done immediately
-	if ((value = rawMIDI[pos++]) & 0x80) {
-		// if flag, strip flag...
-		value &= 0x7f;
-		do {
-			// ...and while there are more bytes,
-			// bitshift left 7, strip flag, repeat to add more bytes
-			value = (value << 7) + ((c = rawMIDI[pos++]) & 0x7f);
-		} while (c & 0x80);
-	}
-	return value;
-}
-
-// read and endian-swap 4 bytes of raw data
-size_t MIDI::readFourBinaryBytes() {
-	size_t startPos = pos;
-	pos += 4;
-	return swapi4(*reinterpret_cast<const uint32_t*>(rawMIDI.substr(startPos, 4).c_str()));
-}
-
-// read and endian-swap 2 bytes of raw data
-uint16_t MIDI::readTwoBinaryBytes() {
-	size_t startPos = pos;
-	pos += 2;
-	return swapi2(*reinterpret_cast<const uint16_t*>(rawMIDI.substr(startPos, 2).c_str()));
-}
+// read 3 big-endian bytes of an event payload (i.e. a tempo)
+size_t ThreeBinaryBytesDirectToInt(const ByteView& bytes) {
+	if (bytes.size() < 3)
+		return MIDI_STANDARD_DEFAULT_USEC_PER_QTR_NOTE;
 
-// read and endian-swap 3 bytes of a string
-size_t ThreeBinaryBytesDirectToInt(std::string bytes) {
-	// pad out with 0 bits to make it 4 bytes, then use int32 ptr for swap
-	return swapi4(*reinterpret_cast<const uint32_t*>((std::string("\0", 1) + bytes).c_str()));
+	return (static_cast<size_t>(bytes[0]) << 16) | (static_cast<size_t>(bytes[1]) << 8) | static_cast<size_t>(bytes[2]);
 }
 
-// only 1 byte so no need for endian-swap
-uint8_t MIDI::readOneBinaryByte() {
-	return *reinterpret_cast<const uint8_t*>(rawMIDI.substr(pos++, 2).c_str());
+// the SysEx or Meta payload an event views in rawMIDI
+ByteView MIDI::eventBytes(const MTrkEvent& evt) const {
+	ByteView v = { rawMIDI.data() + evt.dataOffset, evt.dataLength };
+	return v;
 }
 
-bool MIDI::parseBaseMTrkEvent(TrackChunk& chunk) {
-	size_t deltaTime = readVariableLengthQuantity();
+bool MIDI::parseBaseMTrkEvent(TrackChunk& chunk, ByteReader& in) {
+	MTrkEvent evt;
+	evt.deltaTime = in.readVariableLengthQuantity();
 	// determine type of event
 	// possibilities are MIDI event, sysex event, or meta event
 
@@ -112,102 +64,260 @@ bool MIDI::parseBaseMTrkEvent(TrackChunk& chunk) {
 	// if it's FF, it's a meta
 	// all others are midi
 
-	BaseMTrkEvent* evt;
-
-	uint8_t firstByte = readOneBinaryByte();
+	uint8_t firstByte = in.readU8();
 	switch (firstByte) {
 	case 0xF0:
 	case 0xF7:
-		chunk.mtrkEvents.push_back(evt = new SysExEvent());
+		evt.type = SYSEX_EVENT;
+		evt.status = firstByte;
+		evt.byte1 = evt.byte2 = 0;
+		evt.dataLength = in.readVariableLengthQuantity();
+		evt.dataOffset = static_cast<uint32_t>(in.view(evt.dataLength).data - rawMIDI.data());
 		break;
 
 	case 0xFF:
-		chunk.mtrkEvents.push_back(evt = new MetaEvent());
+		evt.type = META_EVENT;
+		evt.status = in.readU8();
+		evt.byte1 = evt.byte2 = 0;
+		evt.dataLength = in.readVariableLengthQuantity();
+		evt.dataOffset = static_cast<uint32_t>(in.view(evt.dataLength).data - rawMIDI.data());
 		break;
 
 	default:
-		chunk.mtrkEvents.push_back(evt = new MidiEvent());
+		evt.type = MIDI_EVENT;
+		evt.dataOffset = evt.dataLength = 0;
+		if (!loadMidiEvent(evt, chunk, in, firstByte))
+			return false;
 	}
 
-	evt->deltaTime = deltaTime;
-	evt->loadEvent(*this, chunk, firstByte);
+	// ran off the end of the chunk mid-event
+	if (in.failed())
+		return false;
+
+	chunk.mtrkEvents.push_back(evt);
 	return true;
 }
 
-bool MIDI::parseHeader() {
+bool MIDI::parseHeader(ByteReader& in) {
 	if (fileSize <= TAG_LENGTH)
 		return false;
 
 	// check for correct MIDI header tag
-	if (rawMIDI.substr(0, TAG_LENGTH) != "MThd")
+	if (in.readU32() != MTHD_TAG)
 		return false;
 
 	// get length of header chunk (should be 6)
-	pos = TAG_LENGTH;
+	header.length = in.readU32();
 
-	header.length = readFourBinaryBytes();
+	header.format = in.readU16();
+	header.ntrks = in.readU16();
+	header.division = in.readU16();
 
-	header.format = readTwoBinaryBytes();
-	header.ntrks = readTwoBinaryBytes();
-	header.division = readTwoBinaryBytes();
+	// if bit 15 is 0, remaining bits give delta-time ticks per quarter note
+	header.TicksPerQtrNoteMode = header.division < 0x8000;
 
 	// there could be more to the header, which we should IGNORE,
 	// so reset position past MThd tag (4), past length field (4),
 	// and past ACTUAL header length as determined by length field
-	pos = TAG_LENGTH + LENGTH_FIELD_LENGTH + header.length;
+	in.seek(TAG_LENGTH + LENGTH_FIELD_LENGTH + header.length);
 
-	return true;
+	return !in.failed();
 }
 
-bool MIDI::parseChunk() {
+// find every chunk without parsing it: the tag and length
+// are all it takes to know where the next one starts
+bool MIDI::scanChunks(ByteReader& in, std::vector<ByteReader>& tracks) {
+	while (!in.atEnd()) {
+		// check for correct MIDI track chunk tag
+		if (in.readU32() != MTRK_TAG)
+			return false;
 
-	// check for correct MIDI track chunk tag
-	if (rawMIDI.substr(pos, TAG_LENGTH) != "MTrk")
-		return false;
+		// events may not read past the end of their own chunk
+		const uint32_t length = in.readU32();
+		ByteReader track = in.subReader(length);
+		if (in.failed())
+			return false;
+
+		tracks.push_back(track);
+	}
+	return true;
+}
 
-	// instantiate new chunk
-	TrackChunk chunk = TrackChunk();
+bool MIDI::parseChunk(ByteReader track, TrackChunk& chunk) {
 
 	// get length of chunk
-	pos += TAG_LENGTH;
-	chunk.length = readFourBinaryBytes();
+	chunk.length = track.remaining();
 
-	size_t chunkEnd = pos + chunk.length;
+	// events are at least 3 bytes each, almost always more,
+	// so this avoids nearly all regrowth of the event array
+	chunk.mtrkEvents.reserve(chunk.length / 4);
 
-	while (pos < chunkEnd) {
-		if (!parseBaseMTrkEvent(chunk)) {
-			std::cout << "Failed to parse MIDI MTrkEvent." << std::endl;
+	while (!track.atEnd()) {
+		if (!parseBaseMTrkEvent(chunk, track)) {
+			*console << "Failed to parse MIDI MTrkEvent." << std::endl;
 			return false;
 		}
 	}
-	chunks.push_back(chunk);
 	return true;
 }
 
+// chunks share nothing (running status resets in each), so
+// workers each take the next unparsed one, biggest first so a
+// long track doesn't start last, straight into its own slot
+void MIDI::parseChunks(const std::vector<ByteReader>& tracks, std::vector<uint8_t>& parsed) {
+	std::vector<size_t> order(tracks.size());
+	size_t totalBytes = 0;
+	for (size_t i = 0; i < tracks.size(); ++i) {
+		order[i] = i;
+		totalBytes += tracks[i].remaining();
+	}
+	std::stable_sort(order.begin(), order.end(), [&tracks](const size_t a, const size_t b) { return tracks[a].remaining() > tracks[b].remaining(); });
+
+	size_t numThreads = parseThreads ? parseThreads : (PARSE_MAX_THREADS ? PARSE_MAX_THREADS : std::thread::hardware_concurrency());
+	numThreads = std::min(numThreads, std::min(tracks.size(), totalBytes / PARSE_MIN_BYTES_PER_THREAD));
+	if (numThreads == 0)
+		numThreads = 1;
+
+	std::atomic<size_t> next(0);
+	auto worker = [&]() {
+		size_t i;
+		while (!isClosing && (i = next.fetch_add(1, std::memory_order_relaxed)) < order.size()) {
+			const size_t track = order[i];
+			parsed[track] = parseChunk(tracks[track], chunks[track]);
+		}
+	};
+
+	// this thread is one of the workers
+	std::vector<std::thread> pool;
+	for (size_t i = 1; i < numThreads; ++i)
+		pool.push_back(std::thread(worker));
+	worker();
+	for (auto it = pool.begin(), end = pool.end(); it != end; ++it)
+		it->join();
+}
+
 bool MIDI::parseMIDIFile() {
 
-	pos = 0;
+	ByteReader in(rawMIDI.data(), fileSize);
 
-	if (!parseHeader()) {
-		std::cout << "Failed to parse MIDI header." << std::endl;
+	if (!parseHeader(in)) {
+		*console << "Failed to parse MIDI header." << std::endl;
 		return false;
 	}
 
-	while (pos < fileSize) {
-		if (!parseChunk()) {
-			std::cout << "Failed to parse MIDI chunk." << std::endl;
-			return false;
+	std::vector<ByteReader> tracks;
+	const bool scanned = scanChunks(in, tracks);
+
+	chunks.assign(tracks.size(), TrackChunk());
+	std::vector<uint8_t> parsed(tracks.size(), 0);
+	parseChunks(tracks, parsed);
+
+	if (isClosing) {
+		cleanUpMemory();
+		return false;
+	}
+
+	// keep what a chunk-by-chunk parse would have:
+	// everything before the first bad chunk
+	size_t numGood = 0;
+	while (numGood < tracks.size() && parsed[numGood])
+		++numGood;
+
+	if (!scanned || numGood < tracks.size()) {
+		chunks.resize(numGood);
+		*console << "Failed to parse MIDI chunk." << std::endl;
+		return false;
+	}
+
+	buildTempoMap();
+
+	// offline rendering and compiling always run from the timeline
+#if defined(USE_MERGED_TIMELINE) || defined(USE_COMPILED_SONG_CACHE)
+	buildTimeline();
+#else
+	if (!renderFileName.empty())
+		buildTimeline();
+#endif
+
+	return true;
+}
+
+// gather every tempo change, from any track, into the map
+// all playback times come from
+void MIDI::buildTempoMap() {
+	struct TempoChange {
+		uint64_t tick;
+		uint32_t usecPerQtrNote;
+	};
+	std::vector<TempoChange> changes;
+
+	// format 2 files hold independent sequences
+	// played one after another rather than simultaneously
+	uint64_t trackStartTick = 0;
+	for (auto&& chunk : chunks) {
+		chunk.startTick = trackStartTick;
+
+		uint64_t tick = trackStartTick;
+		for (const MTrkEvent& evt : chunk.mtrkEvents) {
+			tick += evt.deltaTime;
+			if (evt.type == META_EVENT && evt.status == 0x51)
+				changes.push_back({ tick, static_cast<uint32_t>(ThreeBinaryBytesDirectToInt(eventBytes(evt))) });
 		}
-		if (isClosing) {
-			cleanUpMemory();
-			return false;
+
+		if (header.format == 2)
+			trackStartTick = tick;
+	}
+
+	// tracks were gathered in order, so at a shared tick the
+	// higher track's change comes last and wins, as it does
+	// when the timeline plays them
+	std::stable_sort(changes.begin(), changes.end(), [](const TempoChange& a, const TempoChange& b) { return a.tick < b.tick; });
+
+	tempoMap.reset(header.division);
+	for (const TempoChange& change : changes)
+		tempoMap.setTempo(change.tick, change.usecPerQtrNote);
+}
+
+// k-way merge every track's events into a single timeline
+// sorted by absolute time, timed by the tempo map, so that a
+// single scheduler can dispatch everything without per-track
+// threads
+void MIDI::buildTimeline() {
+	struct TrackCursor {
+		size_t tick, track, idx;
+
+		// ties at the same tick go to the lower track first,
+		// and events within a track always keep their order
+		bool operator>(const TrackCursor& other) const {
+			return (tick != other.tick) ? tick > other.tick : track > other.track;
 		}
+	};
+
+	timeline.clear();
+	timeline.reserve(numEvents());
+
+	std::priority_queue<TrackCursor, std::vector<TrackCursor>, std::greater<TrackCursor>> heap;
+
+	for (size_t i = 0; i < chunks.size(); ++i) {
+		if (!chunks[i].mtrkEvents.empty())
+			heap.push({ chunks[i].startTick + chunks[i].mtrkEvents[0].deltaTime, i, 0 });
 	}
 
-	return true;
+	while (!heap.empty()) {
+		TrackCursor cur = heap.top();
+		heap.pop();
+
+		const MTrkEvent& evt = chunks[cur.track].mtrkEvents[cur.idx];
+		timeline.push_back({ tempoMap.tickToUsec(cur.tick), static_cast<uint32_t>(cur.track), evt });
+
+		if (++cur.idx < chunks[cur.track].mtrkEvents.size()) {
+			cur.tick += chunks[cur.track].mtrkEvents[cur.idx].deltaTime;
+			heap.push(cur);
+		}
+	}
 }
 
-void extractTimeSignature(std::string bytes, std::ofstream& log) {
+void extractTimeSignature(const ByteView& bytes, std::ofstream& log) {
 	// numerator
 	std::string num = (bytes.size() <= 0) ? "??" : std::to_string(bytes[0]);
 
@@ -222,11 +332,11 @@ void extractTimeSignature(std::string bytes, std::ofstream& log) {
 
 	log << num << "/" << den
 		<< ", " << clocksPerClick << " clocks/metronome tick, "
-		<< clocksPerQtrNote << " clocks/qtr-note." << std::endl;
+		<< clocksPerQtrNote << " clocks/qtr-note." << '\n';
 }
 
 // see SMPTE timecode standard
-void extractSMPTE(std::string bytes, std::ofstream& log) {
+void extractSMPTE(const ByteView& bytes, std::ofstream& log) {
 	std::string hr = (bytes.size() <= 0) ? "??" : std::to_string(bytes[0]);
 	std::string min = (bytes.size() <= 1) ? "??" : std::to_string(bytes[1]);
 	std::string sec = (bytes.size() <= 2) ? "??" : std::to_string(bytes[2]);
@@ -243,21 +353,21 @@ void extractSMPTE(std::string bytes, std::ofstream& log) {
 	}
 
 	log << std::setw(2) << std::setfill('0') << hr << ":" << std::setw(2) << std::setfill('0') << min
-		<< ":" << std::setw(2) << std::setfill('0') << sec << " and " << frames << " frames" << std::endl;
+		<< ":" << std::setw(2) << std::setfill('0') << sec << " and " << frames << " frames" << '\n';
 }
 
-void extractKeySignature(std::string bytes, std::ofstream& log) {
+void extractKeySignature(const ByteView& bytes, std::ofstream& log) {
 
 	if (bytes.size() != 2) {
-		log << "<invalid>" << std::endl;
+		log << "<invalid>" << '\n';
 		return;
 	}
 
 	// sharps and flats
-	int8_t sf = bytes[0];
+	int8_t sf = static_cast<int8_t>(bytes[0]);
 
 	// major/minor
-	int8_t mi = bytes[1];
+	int8_t mi = static_cast<int8_t>(bytes[1]);
 
 	if (sf < 0) {
 		size_t numFlats = static_cast<size_t>(-sf);
@@ -271,7 +381,7 @@ void extractKeySignature(std::string bytes, std::ofstream& log) {
 		log << "Key of C ";
 	}
 
-	log << ((mi == 1) ? "minor" : "major") << std::endl;
+	log << ((mi == 1) ? "minor" : "major") << '\n';
 }
 
 // progs that play percussion or other atonal sounds
@@ -281,277 +391,330 @@ bool invalidProg(uint8_t prog) {
 	return (prog > 112 || (prog >= 97 && prog <= 104));
 }
 
-std::string MIDI::extractNote(const size_t chan, const MidiEvent& evt, const bool logDrives) {
-	if (logDrives && chan != 10 && !channels[chan - 1].channelHasBeenUsed && !invalidProg(channels[chan - 1].prog)) {
-		++maxTotalChannels;
-		channels[chan - 1].channelHasBeenUsed = true;
-
-#ifndef ASSIGN_CHANNELS_TO_DRIVES_SEQUENTIALLY
-		if (freeDrive < MAX_DRIVES) channels[chan - 1].chanToDrive = freeDrive++;
-#endif
-
-	}
+// e.g. "C#4, Velocity (0 - 127): 100"
+void extractNote(const MTrkEvent& evt, std::ostream& out) {
+	static const char* const noteSelect[12] = { "C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B" };
 
 	// get octave (see MIDI standard)
-	unsigned short octave = evt.byte1 / 12 - 1;
+	const unsigned short octave = evt.byte1 / 12 - 1;
 
-	// get note
-	const std::string noteSelect[12] = { "C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B" };
-	const std::string note = noteSelect[evt.byte1 % 12];
-	return note + std::to_string(octave) + ", Velocity (0 - 127): " + std::to_string(evt.byte2);
+	out << noteSelect[evt.byte1 % 12] << octave << ", Velocity (0 - 127): " << static_cast<unsigned>(evt.byte2);
 }
 
-uint16_t pitchBendBytes(const MidiEvent& evt) {
+uint16_t pitchBendBytes(const MTrkEvent& evt) {
 	return static_cast<uint16_t>(evt.byte2 << 7) + static_cast<uint16_t>(evt.byte1);
 }
 
-std::string extractPitchBendChange(MidiEvent& evt) {
-	return std::to_string(pitchBendBytes(evt));
-}
-
-std::string MIDI::extractProgramChange(const uint8_t chan, const MidiEvent& evt) {
-	return std::to_string(channels[chan - 1].prog = evt.byte1);
-}
-
-std::string extractModeChange(MidiEvent& evt) {
+void extractModeChange(const MTrkEvent& evt, std::ofstream& log) {
 	switch (evt.byte1) {
 	case 0x00:
-		return "Bank Select (0-127): " + std::to_string(evt.byte2);
+		log << "Bank Select (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x01:
-		return "Modulation Wheel (0-127): " + std::to_string(evt.byte2);
+		log << "Modulation Wheel (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x05:
-		return "Portamento Time (0-127): " + std::to_string(evt.byte2);
+		log << "Portamento Time (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x06:
-		return "Data Entry, MSB (0-127): " + std::to_string(evt.byte2);
+		log << "Data Entry, MSB (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x07:
-		return "Channel Volume (0-127): " + std::to_string(evt.byte2);
+		log << "Channel Volume (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x0A:
-		return "Channel Pan (0-127): " + std::to_string(evt.byte2);
+		log << "Channel Pan (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x0B:
-		return "Expression Control (0-127): " + std::to_string(evt.byte2);
+		log << "Expression Control (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x20:
-		return "LSB for Control 0 (Bank Select) (0-127): " + std::to_string(evt.byte2);
+		log << "LSB for Control 0 (Bank Select) (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x21:
-		return "LSB for Control 1 (Modulation Wheel) (0-127): " + std::to_string(evt.byte2);
+		log << "LSB for Control 1 (Modulation Wheel) (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x22:
-		return "LSB for Control 2 (Breath Controller) (0-127): " + std::to_string(evt.byte2);
+		log << "LSB for Control 2 (Breath Controller) (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x23:
-		return "LSB for Control 3 (undef) (0-127): " + std::to_string(evt.byte2);
+		log << "LSB for Control 3 (undef) (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x24:
-		return "LSB for Control 4 (Foot Controller) (0-127): " + std::to_string(evt.byte2);
+		log << "LSB for Control 4 (Foot Controller) (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x25:
-		return "LSB for Control 5 (Portamento Time) (0-127): " + std::to_string(evt.byte2);
+		log << "LSB for Control 5 (Portamento Time) (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x26:
-		return "LSB for Control 6 (Data Entry) (0-127): " + std::to_string(evt.byte2);
+		log << "LSB for Control 6 (Data Entry) (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x27:
-		return "LSB for Control 7 (Channel Volume) (0-127): " + std::to_string(evt.byte2);
+		log << "LSB for Control 7 (Channel Volume) (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x28:
-		return "LSB for Control 8 (Balance) (0-127): " + std::to_string(evt.byte2);
+		log << "LSB for Control 8 (Balance) (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x29:
-		return "LSB for Control 9 (undef) (0-127): " + std::to_string(evt.byte2);
+		log << "LSB for Control 9 (undef) (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x2A:
-		return "LSB for Control 10 (Pan) (0-127): " + std::to_string(evt.byte2);
+		log << "LSB for Control 10 (Pan) (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x2B:
-		return "LSB for Control 11 (Expression Controller) (0-127): " + std::to_string(evt.byte2);
+		log << "LSB for Control 11 (Expression Controller) (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x2C:
-		return "LSB for Control 12 (Effect control 1) (0-127): " + std::to_string(evt.byte2);
+		log << "LSB for Control 12 (Effect control 1) (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x2D:
-		return "LSB for Control 13 (Effect control 2) (0-127): " + std::to_string(evt.byte2);
+		log << "LSB for Control 13 (Effect control 2) (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x40:
-		return "Damper/sustain " + std::string((evt.byte2 >= 64) ? "ON" : "OFF");
+		log << "Damper/sustain " << ((evt.byte2 >= 64) ? "ON" : "OFF");
 		break;
 	case 0x41:
-		return "Portamento " + std::string((evt.byte2 >= 64) ? "ON" : "OFF");
+		log << "Portamento " << ((evt.byte2 >= 64) ? "ON" : "OFF");
 		break;
 	case 0x46:
-		return "Sound Controller 1 (default: Sound Variation) (0-127): " + std::to_string(evt.byte2);
+		log << "Sound Controller 1 (default: Sound Variation) (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x47:
-		return "Sound Controller 2 (default: Timbre/Harmonic Intens.) (0-127): " + std::to_string(evt.byte2);
+		log << "Sound Controller 2 (default: Timbre/Harmonic Intens.) (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x48:
-		return "Sound Controller 3 (default: Release Time) (0-127): " + std::to_string(evt.byte2);
+		log << "Sound Controller 3 (default: Release Time) (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x49:
-		return "Sound Controller 4 (default: Attack Time) (0-127): " + std::to_string(evt.byte2);
+		log << "Sound Controller 4 (default: Attack Time) (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x4A:
-		return "Sound Controller 5 (default: Brightness) (0-127): " + std::to_string(evt.byte2);
+		log << "Sound Controller 5 (default: Brightness) (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x4B:
-		return "Sound Controller 6 (default: Decay Time) (0-127): " + std::to_string(evt.byte2);
+		log << "Sound Controller 6 (default: Decay Time) (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x4C:
-		return "Sound Controller 7 (default: Vibrato Rate) (0-127): " + std::to_string(evt.byte2);
+		log << "Sound Controller 7 (default: Vibrato Rate) (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x4D:
-		return "Sound Controller 8 (default: Vibrato Depth) (0-127): " + std::to_string(evt.byte2);
+		log << "Sound Controller 8 (default: Vibrato Depth) (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x4E:
-		return "Sound Controller 9 (default: Vibrato Delay) (0-127): " + std::to_string(evt.byte2);
+		log << "Sound Controller 9 (default: Vibrato Delay) (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x4F:
-		return "Sound Controller 10 (default: undef) (0-127): " + std::to_string(evt.byte2);
+		log << "Sound Controller 10 (default: undef) (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x5B:
-		return "Effects 1 (Default==Reverb) Depth (0-127): " + std::to_string(evt.byte2);
+		log << "Effects 1 (Default==Reverb) Depth (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x5C:
-		return "Effects 2 (Default==Tremolo) Depth (0-127): " + std::to_string(evt.byte2);
+		log << "Effects 2 (Default==Tremolo) Depth (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x5D:
-		return "Effects 3 (Default==Chorus) Depth (0-127): " + std::to_string(evt.byte2);
+		log << "Effects 3 (Default==Chorus) Depth (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x5E:
-		return "Effects 4 (Default==Celeste/Detune) Depth (0-127): " + std::to_string(evt.byte2);
+		log << "Effects 4 (Default==Celeste/Detune) Depth (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x5F:
-		return "Effects 5 (Default==Phaser) Depth (0-127): " + std::to_string(evt.byte2);
+		log << "Effects 5 (Default==Phaser) Depth (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x62:
-		return "NRPN LSB (0-127): " + std::to_string(evt.byte2);
+		log << "NRPN LSB (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x63:
-		return "NRPN MSB (0-127): " + std::to_string(evt.byte2);
+		log << "NRPN MSB (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x64:
-		return "RPN LSB (0-127): " + std::to_string(evt.byte2);
+		log << "RPN LSB (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x65:
-		return "RPN MSB (0-127): " + std::to_string(evt.byte2);
+		log << "RPN MSB (0-127): " << static_cast<unsigned>(evt.byte2);
 		break;
 	case 0x78:
-		return "All Sound OFF";
+		log << "All Sound OFF";
 		break;
 	case 0x79:
-		return "Reset All Controllers";
+		log << "Reset All Controllers";
 		break;
 	case 0x7A:
-		return "Local Control: " + std::string((evt.byte2 == 0) ? "OFF" : "ON");
+		log << "Local Control: " << ((evt.byte2 == 0) ? "OFF" : "ON");
 		break;
 	case 0x7B:
-		return "All Notes OFF";
+		log << "All Notes OFF";
 		break;
 	case 0x7C:
-		return "Omni Mode OFF";
+		log << "Omni Mode OFF";
 		break;
 	case 0x7D:
-		return "Omni Mode ON";
+		log << "Omni Mode ON";
 		break;
 	case 0x7E:
-		return "Mono Mode ON";
+		log << "Mono Mode ON";
 		break;
 	case 0x7F:
-		return "Poly Mode ON";
+		log << "Poly Mode ON";
 		break;
 	default:
-		return "Unknown mode (Code " + std::to_string(evt.byte1) + ")";
+		log << "Unknown mode (Code " << static_cast<unsigned>(evt.byte1) << ")";
 	}
 }
 
-double noteToFreq(uint8_t noteID) {
-	return pow(2.0, static_cast<double>(static_cast<int>(noteID - 69)) / 12.0)*440.0;
+// voice currently sounding this note, or NOT_ACTIVE
+// if it never started or has since been stolen
+uint16_t MIDI::activeVoice(const size_t chan, const uint8_t note) const {
+	const uint16_t idx = channels[chan - 1].activeNotes[note];
+	return voices.owns(idx, voiceOwner(chan, note)) ? idx : NOT_ACTIVE;
 }
 
-void MIDI::noteOff(const size_t chan, const MidiEvent& evt) {
-#ifdef PLAY_SINE
-	uint16_t idx = channels[chan - 1].activeNotes[evt.byte1];
-	if (idx != NOT_ACTIVE) {
-		stream->stopAudio(idx);
-		channels[chan - 1].activeNotes[evt.byte1] = NOT_ACTIVE;
+// true if noteOn etc. should generate floppy packets
+bool MIDI::drivingFloppies() const {
+	return compiling || nullSink || (!playingCompiled && controllers && controllers->isConnected());
+}
 
-		mtx.lock();
-		availablePlayIndices.push(idx);
-		mtx.unlock();
+// drive currently sounding this note, or NO_DRIVE
+// if it never started or has since been taken over
+uint8_t MIDI::activeDrive(const size_t chan, const uint8_t note) const {
+	const uint8_t drive = channels[chan - 1].activeDrives[note];
+	return drives.owns(drive, voiceOwner(chan, note)) ? drive : NO_DRIVE;
+}
+
+void MIDI::sendPacket(const FloppyMessage& packet) {
+	if (nullSink) {
+		++nullSinkPackets;
 	}
-#endif
+	else if (compiling) {
+		CompiledEvent ce = {};
+		ce.usec = compileUsec;
+		ce.floppy = packet;
+		ce.type = COMPILED_PACKET;
+		compiled.built.push_back(ce);
+	}
+	else if (batchingPackets) {
+		controllers->queuePacket(packet);
+	}
+	else {
+		controllers->sendPacket(packet);
+	}
+}
 
-#ifdef PLAY_FLOPPY
-	if (serial->isConnected()) {
-		channels[chan - 1].isPlayingOnFloppy = false;
-		uint32_t outBytes = static_cast<uint32_t>(channels[chan - 1].chanToDrive);
-		serial->writeData(reinterpret_cast<void*>(&outBytes), PACKET_SIZE_BYTES);
+static_assert(MAX_DRIVES <= DRIVE_ALLOCATOR_MAX_DRIVES, "global drive ids must fit in a FloppyMessage's drive byte");
+static_assert(NO_DRIVE == EVENT_LOG_NO_DRIVE, "the event log prints drives as allocated");
+
+// one send per controller for everything queued this tick. never
+// waits on the wire: a backed-up link keeps its batch, which merges
+// into the next tick's (latest state per drive still wins).
+// mustSend waits for room instead (i.e. final drive stops)
+void MIDI::flushPackets(const bool mustSend, const int64_t originNs) {
+	if (controllers && controllers->isConnected())
+		controllers->flush(mustSend, originNs);
+}
+
+void MIDI::noteOff(const size_t chan, const MTrkEvent& evt) {
+	const uint8_t note = evt.byte1 & 0x7F;
+	uint16_t idx = channels[chan - 1].activeNotes[note];
+	if (stream && idx != NOT_ACTIVE) {
+		channels[chan - 1].activeNotes[note] = NOT_ACTIVE;
+		channels[chan - 1].voicedNotes[note >> 6].fetch_and(~(1ULL << (note & 63)), std::memory_order_relaxed);
+
+		// if stolen, the voice now belongs to another note
+		// and must keep playing
+		if (voices.release(idx, voiceOwner(chan, note)))
+			stream->stopAudio(idx);
+	}
+
+	uint8_t drive = NO_DRIVE;
+	if (drivingFloppies()) {
+		drive = channels[chan - 1].activeDrives[note];
+		channels[chan - 1].activeDrives[note] = NO_DRIVE;
+
+		// if taken over, the drive is playing a newer note
+		if (drives.release(drive, voiceOwner(chan, note))) {
+			FloppyMessage msg = {};
+			msg.drive = drive;
+			msg.type = FLOPPY_NOTE_OFF;
+			sendPacket(msg);
+		}
+		else {
+			drive = NO_DRIVE;
+		}
 	}
-#endif
 
 #if defined(LOG_NOTES) && defined(VERBOSE_1) && defined(VERBOSE_2)
-		// printf for speed and for atomicity
-		// (intentionally outside mtx for performance)
-	printf("Channel %u Note OFF: %s\n", chan, extractNote(chan, evt, false).c_str());
+	if (!compiling)
+		playbackLog.note(PLAYBACK_NOTE_OFF, chan, note, evt.byte2, drive);
 #endif
 }
 
-// pack drive select and note frequency into single 4 byte
-// unsigned int for sending efficiently over serial
-// This is done by letting first byte store drive select
-// and next 3 bytes store (freq*10000.0), truncated to an
-// int. This way the Arduino can cast that int to float
-// and divide by 10000 to get a decimal freq with up to
-// 4 decimal place accuracy, while still allowing
-// up to ~1677 Hz (floppies typically can only play up
-// to ~400 Hz before the stepper motors slip)
-#ifdef PLAY_FLOPPY
-void MIDI::sendNoteToFloppy(const size_t chan) {
+// describe the channel's floppy note both ways: as a
+// v1 frequency, i.e. (freq*10000.0) truncated to an int
+// that the Arduino divides back down to a decimal freq
+// with up to 4 decimal place accuracy, up to ~1677 Hz
+// (floppies typically can only play up to ~400 Hz
+// before the stepper motors slip), and as a note number
+// plus bend in cents for v2. The encoder for the drive's
+// controller picks whichever it speaks
+void MIDI::sendNoteToFloppy(const size_t chan, const uint8_t drive, const uint8_t note, const FloppyMessageType type) {
 	// floppies can't do note velocities, but
 	// don't play super quiet notes
 	if (static_cast<float>(channels[chan - 1].expression) * static_cast<float>(channels[chan - 1].volume) >= MIN_FLOPPY_VOLUME) {
-		uint32_t convertedFreq = static_cast<uint32_t>(channels[chan - 1].floppyFreq*channels[chan - 1].pitchBendFactor*FREQ_MULTIPLIER);
-		uint32_t outBytes = static_cast<uint32_t>(channels[chan - 1].chanToDrive) + (convertedFreq << 8);
-		serial->writeData(reinterpret_cast<void*>(&outBytes), PACKET_SIZE_BYTES);
+		const uint8_t floppyNote = toFloppyNote(note);
+		FloppyMessage msg = {};
+		msg.freq = static_cast<uint32_t>(noteToFreq(floppyNote)*channels[chan - 1].pitchBendFactor*FREQ_MULTIPLIER);
+		msg.bendCents = static_cast<int16_t>(pitchBendBytesToCents(channels[chan - 1].pitchBend) + tuning.noteCents[floppyNote]);
+		msg.note = floppyNote;
+		msg.drive = drive;
+		msg.type = type;
+		sendPacket(msg);
 	}
 }
-#endif
 
 void MIDI::updatePlayingNotes(const size_t chan) {
-#ifdef PLAY_SINE
-	uint16_t idx;
-	for (size_t i = 0; i < MAX_NOTES; ++i) {
-		idx = channels[chan - 1].activeNotes[i];
-		if (idx != NOT_ACTIVE) {
-			stream->setPitchBend(idx, channels[chan - 1].pitchBendFactor);
-			stream->setChannelVel(idx, channels[chan - 1].volume);
-			stream->setChannelExpression(idx, channels[chan - 1].expression);
+	// only the notes given a voice (some may since have been stolen)
+	if (stream) {
+		uint16_t idx;
+		for (size_t w = 0; w < MAX_NOTES / 64; ++w) {
+			uint64_t voiced = channels[chan - 1].voicedNotes[w].load(std::memory_order_relaxed);
+			while (voiced) {
+				idx = activeVoice(chan, static_cast<uint8_t>(w * 64 + lowestBit(voiced)));
+				voiced &= voiced - 1;
+				if (idx != NOT_ACTIVE) {
+					stream->setPitchBend(idx, channels[chan - 1].pitchBendFactor);
+					stream->setChannelVel(idx, channels[chan - 1].volume);
+					stream->setChannelExpression(idx, channels[chan - 1].expression);
+				}
+			}
 		}
 	}
-#endif
 
-#ifdef PLAY_FLOPPY
-	if (channels[chan - 1].isPlayingOnFloppy)
-		sendNoteToFloppy(chan);
-#endif
+	// every drive in the channel's pool still sounding one of its notes
+	if (drivingFloppies()) {
+		const uint32_t first = drives.poolFirst(chan), end = first + drives.poolSize(chan);
+		for (uint32_t d = first; d < end; ++d) {
+			const uint32_t owner = drives.ownerOf(static_cast<uint8_t>(d));
+			if (owner != VOICE_FREE && (owner - 1) >> 8 == chan)
+				sendNoteToFloppy(chan, static_cast<uint8_t>(d), static_cast<uint8_t>((owner - 1) & 0xFF), FLOPPY_UPDATE);
+		}
+	}
 }
 
-void MIDI::noteOn(const size_t chan, const MidiEvent& evt) {
+void MIDI::noteOn(const size_t chan, const MTrkEvent& evt) {
+	// any index into the note arrays stays in bounds
+	const uint8_t note = evt.byte1 & 0x7F;
+
 #ifdef ASSIGN_CHANNELS_TO_DRIVES_SEQUENTIALLY
-	if (chan != 10 && !channels[chan - 1].channelHasBeenUsed && !invalidProg(channels[chan - 1].prog)) {
+	// a compiled song's drives were assigned when it was compiled
+	const bool assignOnFirstNote = !playingCompiled;
+#else
+	// live input's channels aren't known until they play
+	const bool assignOnFirstNote = playingLive;
+#endif
+	if (assignOnFirstNote && chan != 10 && !channels[chan - 1].channelHasBeenUsed && !invalidProg(channels[chan - 1].prog)) {
 		channels[chan - 1].channelHasBeenUsed = true;
-
-		mtx.lock();
-		if (freeDrive < MAX_DRIVES) channels[chan - 1].chanToDrive = freeDrive++;
-		mtx.unlock();
+		drives.assignPool(chan);
 	}
-#endif
 
 	uint8_t velocity = evt.byte2;
 
@@ -565,135 +728,122 @@ void MIDI::noteOn(const size_t chan, const MidiEvent& evt) {
 		return;
 	}
 
-#ifdef PLAY_SINE
-	uint16_t idx = channels[chan - 1].activeNotes[evt.byte1];
-	if (idx == NOT_ACTIVE) {
-
-		// new note
-		mtx.lock();
-		if (availablePlayIndices.size() == 0) {
-			std::cout << "ERROR: too many simultaneous voices!" << std::endl;
-			mtx.unlock();
+	if (stream) {
+		uint16_t idx = activeVoice(chan, note);
+		if (idx == NOT_ACTIVE) {
+
+			// new note. may steal a sounding voice (whose old note's
+			// noteOff then finds it gone) or be dropped, per
+			// VOICE_STEAL_POLICY; see the counters after playback
+			const float loudness = static_cast<float>(velocity) * static_cast<float>(channels[chan - 1].volume) * static_cast<float>(channels[chan - 1].expression);
+			uint32_t stolenFrom;
+			idx = voices.allocate(voiceOwner(chan, note), note, loudness, stolenFrom);
+			channels[chan - 1].activeNotes[note] = idx;
+			if (idx != NO_VOICE) {
+				channels[chan - 1].voicedNotes[note >> 6].fetch_or(1ULL << (note & 63), std::memory_order_relaxed);
+				stream->setFreqs(idx, noteToFreq(note), channels[chan - 1].pitchBendFactor);
+				stream->setVels(idx, channels[chan - 1].expression, channels[chan - 1].volume, velocity);
+				stream->startAudio(idx);
+			}
+
+#if defined(LOG_NOTES) && defined(VERBOSE_1)
+			if (stolenFrom != VOICE_FREE)
+				playbackLog.voiceStolen(idx, (stolenFrom - 1) >> 8, static_cast<uint8_t>((stolenFrom - 1) & 0xFF));
+#endif
 		}
 		else {
-			idx = channels[chan - 1].activeNotes[evt.byte1] = availablePlayIndices.front();
-			availablePlayIndices.pop();
-			mtx.unlock();
-			stream->setFreqs(idx, noteToFreq(evt.byte1), channels[chan - 1].pitchBendFactor);
+
+			// already playing note, just updated freq and/or velocity
+			stream->setFreqs(idx, noteToFreq(note), channels[chan - 1].pitchBendFactor);
 			stream->setVels(idx, channels[chan - 1].expression, channels[chan - 1].volume, velocity);
-			stream->startAudio(idx);
 		}
 	}
-	else {
-
-		// already playing note, just updated freq and/or velocity
-		stream->setFreqs(idx, noteToFreq(evt.byte1), channels[chan - 1].pitchBendFactor);
-		stream->setVels(idx, channels[chan - 1].expression, channels[chan - 1].volume, velocity);
-	}
-#endif
 
-#ifdef PLAY_FLOPPY
-	if (serial->isConnected() && channels[chan - 1].chanToDrive != CHANNEL_NOT_ASSIGNED) {
-		// shift all notes down to sound better on floppies...
-		uint8_t note = evt.byte1 - NOTE_DOWN_SHIFT_SEMITONES;
-
-		// ... and if note is still too high for floppy drives,
-		// drop octaves until it's in range...
-		while (note > MAX_FLOPPY_NOTE)
-			note -= NUM_SEMITONES_IN_OCTAVE;
-
-		// ...or if note is too low for floppy drives,
-		// climb octaves until it's in range.
-		while (note < MIN_FLOPPY_NOTE)
-			note += NUM_SEMITONES_IN_OCTAVE;
+	uint8_t drive = NO_DRIVE;
+	if (drivingFloppies()) {
+		// a repeated note re-articulates on its own drive. a new one
+		// takes the next idle drive in the channel's pool, or the
+		// drive of its oldest note if all are sounding
+		drive = activeDrive(chan, note);
+		if (drive == NO_DRIVE) {
+			uint32_t takenFrom;
+			drive = drives.allocate(chan, voiceOwner(chan, note), takenFrom);
+			channels[chan - 1].activeDrives[note] = drive;
+		}
 
-		channels[chan - 1].floppyFreq = noteToFreq(note);
-		channels[chan - 1].isPlayingOnFloppy = true;
-		sendNoteToFloppy(chan);
+		if (drive != NO_DRIVE)
+			sendNoteToFloppy(chan, drive, note, FLOPPY_NOTE_ON);
 	}
-#endif
 
 #if defined(LOG_NOTES) && defined(VERBOSE_1)
-		// printf for speed and for atomicity
-		// (intentionally outside mtx for performance)
-	printf("Channel %llu Note ON: %s\n", static_cast<unsigned long long>(chan), extractNote(chan, evt, false).c_str());
+	if (!compiling)
+		playbackLog.note(PLAYBACK_NOTE_ON, chan, note, velocity, drive);
 #endif
 }
 
-void MIDI::setChannelExpression(const size_t chan, const MidiEvent& evt) {
+void MIDI::setChannelExpression(const size_t chan, const MTrkEvent& evt) {
 	channels[chan - 1].expression = evt.byte2;
 	updatePlayingNotes(chan);
 
 #if defined(LOG_NOTES) && defined(VERBOSE_1)
-	// printf for speed and for atomicity
-	// (intentionally outside mtx for performance)
-	printf("Channel %llu Expression Change: %u\n", static_cast<unsigned long long>(chan), channels[chan - 1].expression);
+	if (!compiling)
+		playbackLog.controller(PLAYBACK_EXPRESSION, chan, channels[chan - 1].expression);
 #endif
 }
 
-void MIDI::setChannelVolume(const size_t chan, const MidiEvent& evt) {
+void MIDI::setChannelVolume(const size_t chan, const MTrkEvent& evt) {
 	channels[chan - 1].volume = evt.byte2;
 	updatePlayingNotes(chan);
 
 #ifdef LOG_NOTES
-	// printf for speed and for atomicity
-	// (intentionally outside mtx for performance)
-	printf("Channel %llu Master Volume: %u\n", static_cast<unsigned long long>(chan), channels[chan - 1].volume);
+	if (!compiling)
+		playbackLog.controller(PLAYBACK_VOLUME, chan, channels[chan - 1].volume);
 #endif
 }
 
-double pitchBendBytesToFactor(uint16_t bytes) {
-	return pow(2.0, MAX_PITCH_BEND_SEMITONES*(static_cast<double>(bytes) - 8192.0) / 8192.0 / fNUM_SEMITONES_IN_OCTAVE);
-}
-
-void MIDI::setPitchBend(const size_t chan, const MidiEvent& evt) {
-	channels[chan - 1].pitchBendFactor = pitchBendBytesToFactor(pitchBendBytes(evt));
+void MIDI::setPitchBend(const size_t chan, const MTrkEvent& evt) {
+	channels[chan - 1].pitchBend = pitchBendBytes(evt);
+	channels[chan - 1].pitchBendFactor = pitchBendBytesToFactor(channels[chan - 1].pitchBend);
 	updatePlayingNotes(chan);
 
 #ifdef LOG_NOTES
-	// printf for speed and for atomicity
-	// (intentionally outside mtx for performance)
-	printf("Channel %llu Pitch BEND! x%g\n", static_cast<unsigned long long>(chan), channels[chan - 1].pitchBendFactor);
+	if (!compiling)
+		playbackLog.pitchBend(chan, channels[chan - 1].pitchBendFactor);
 #endif
 }
 
 // output hex string for SysEx events
 // ignored (not handled, just printed directly to log)
 // by this program
-void generateVariableLengthMessage(const std::string& bytes, std::ofstream& log) {
+void generateVariableLengthMessage(const ByteView& bytes, std::ofstream& log) {
 	log << "0x";
 	for (size_t i = 0; i < bytes.size(); ++i) {
 		log << std::hex << static_cast<uint16_t>(bytes[i]);
 	}
-	log << std::dec << std::endl;
+	log << std::dec << '\n';
 }
 
-void MIDI::decodeDivision() {
+// delta-time ticks per second at usecPerQtrNote (logging only;
+// playback asks the tempo map)
+double MIDI::decodeDivision(const size_t usecPerQtrNote) const {
 	// if bit 15 is 0, remaining bits give delta-time ticks per quarter note.
 	// if bit 15 is 1, bits 14->8 give SMPTE fps and bits 7->0 give delta-time ticks/frame
 
 	// if bit 15 is 0
-	if (header.division < 0x8000) {
-		header.TicksPerQtrNoteMode = true;
-		ticksPerQtrNote = header.division;
-		ticksPerSecond = MICROSECONDS_PER_SECOND * static_cast<double>(ticksPerQtrNote) / static_cast<double>(usecPerQtrNote);
+	if (header.TicksPerQtrNoteMode) {
+		return MICROSECONDS_PER_SECOND * static_cast<double>(header.division) / static_cast<double>(usecPerQtrNote);
 	}
 	else { //bit 15 is 1
-		header.TicksPerQtrNoteMode = false;
-		uint8_t fps = -static_cast<uint8_t>((header.division - 0x8000) >> 8);
+		uint8_t fps = static_cast<uint8_t>(-static_cast<int8_t>(header.division >> 8));
 		uint8_t ticksPerFrame = static_cast<uint8_t>(header.division & 0xFF);
 
-		FPS = (fps == 29) ? 29.97 : static_cast<double>(fps);
-		ticksPerSecond = ticksPerFrame * FPS;
+		const double FPS = (fps == 29) ? 29.97 : static_cast<double>(fps);
+		return ticksPerFrame * FPS;
 	}
 }
 
-void MIDI::stepThroughCompletedMidiStructure() {
-
-	maxTotalChannels = 0;
-
-	freeDrive = 0;
-
+// piano at default volume and expression, none yet played
+void MIDI::resetChannelDefaults() {
 	for (size_t i = 0; i < NUM_CHANNELS; ++i) {
 		// default to piano
 		channels[i].prog = DEFAULT_INSTRUMENT;
@@ -704,62 +854,237 @@ void MIDI::stepThroughCompletedMidiStructure() {
 		// default to 127/127 expression
 		channels[i].expression = DEFAULT_EXPRESSION;
 
-		channels[i].chanToDrive = CHANNEL_NOT_ASSIGNED;
 		channels[i].channelHasBeenUsed = false;
-		channels[i].isPlayingOnFloppy = false;
 	}
+}
+
+// channel state playback starts from: defaults, each channel's
+// last program, and a pool of drives per channel sized from the
+// most notes it sounds at once, planned in order of each one's
+// first playable note, track by track (and assigned now, unless
+// assigned at that first note during playback). then what the
+// song needs of the voices, drives and link (see songAnalysis.h)
+void MIDI::analyzeMidiStructure() {
+
+	maxTotalChannels = 0;
+	resetChannelDefaults();
+
+	// peak polyphony per channel: the most notes that get a drive
+	// at once within a track, summed across tracks
+	uint8_t order[NUM_CHANNELS];
+	unsigned peak[NUM_CHANNELS] = {};
+	for (const TrackChunk& chunk : chunks) {
+		bool sounding[NUM_CHANNELS][MAX_NOTES] = {};
+		unsigned numSounding[NUM_CHANNELS] = {}, trackPeak[NUM_CHANNELS] = {};
+
+		for (const MTrkEvent& evt : chunk.mtrkEvents) {
+			if (evt.type != MIDI_EVENT)
+				continue;
+
+			if (evt.status >= 0x80 && evt.status <= 0x9F) {
+				const size_t chan = (evt.status & 0x0F) + 1;
+				const bool playable = evt.status >= 0x90 && !invalidProg(channels[chan - 1].prog);
+				if (playable && chan != 10 && !channels[chan - 1].channelHasBeenUsed) {
+					order[maxTotalChannels++] = static_cast<uint8_t>(chan - 1);
+					channels[chan - 1].channelHasBeenUsed = true;
+				}
+
+				// as noteOn, a velocity of 0 or 1 is a note off
+				const bool on = playable && evt.byte2 > 1;
+				bool& s = sounding[chan - 1][evt.byte1 & 0x7F];
+				if (on && !s && ++numSounding[chan - 1] > trackPeak[chan - 1])
+					trackPeak[chan - 1] = numSounding[chan - 1];
+				else if (!on && s)
+					--numSounding[chan - 1];
+				s = on;
+			}
+			else if (evt.status >= 0xC0 && evt.status <= 0xCF) {
+				channels[evt.status - 0xC0].prog = evt.byte1;
+			}
+		}
+
+		for (size_t i = 0; i < NUM_CHANNELS; ++i)
+			peak[i] += trackPeak[i];
+	}
+
+	// the timeline knows how the tracks actually overlap
+	// (per-track threads without one fall back to the sum)
+	const bool analyzed = !timeline.empty();
+	if (analyzed) {
+#ifdef THIN_CONTROL_EVENTS
+		size_t considered;
+		const size_t thinned = thinControlEvents(timeline, channels, configuredThinning(), considered);
+		*console << "Thinned " << thinned << " of " << considered << " pitch bend/volume/expression events." << std::endl;
+#endif
+		analyzeSong(timeline, channels, analysis);
+		for (size_t i = 0; i < NUM_CHANNELS; ++i)
+			peak[i] = analysis.peakNotes[i];
+	}
+
+	uint8_t wanted[NUM_CHANNELS];
+	for (size_t i = 0; i < NUM_CHANNELS; ++i) {
+#ifdef POLYPHONIC_FLOPPY_CHANNELS
+		wanted[i] = static_cast<uint8_t>((peak[i] < DRIVE_ALLOCATOR_MAX_DRIVES) ? peak[i] : DRIVE_ALLOCATOR_MAX_DRIVES);
+#else
+		wanted[i] = peak[i] ? 1 : 0;
+#endif
+	}
+
+#if defined(POLYPHONIC_FLOPPY_CHANNELS) && defined(SHARE_SPARE_DRIVES)
+	const bool shareSpares = true;
+#else
+	const bool shareSpares = false;
+#endif
+
+	drives.reset(MAX_DRIVES);
+	drives.plan(wanted, order, maxTotalChannels, shareSpares);
+
+#ifndef ASSIGN_CHANNELS_TO_DRIVES_SEQUENTIALLY
+	for (size_t k = 0; k < maxTotalChannels; ++k)
+		drives.assignPool(order[k] + 1);
+#endif
+
+	*console << "Total channels used: " << maxTotalChannels << std::endl;
+
+	uint32_t drivesPlanned = 0;
+	if (maxTotalChannels) {
+		*console << "Drive pools (of " << MAX_DRIVES << " drives):";
+		for (size_t k = 0; k < maxTotalChannels; ++k) {
+			drivesPlanned += drives.plannedSize(order[k] + 1);
+			*console << " ch" << order[k] + 1 << " x" << static_cast<unsigned>(drives.plannedSize(order[k] + 1)) << " (peak " << peak[order[k]] << ")";
+		}
+		*console << std::endl;
+	}
+
+	if (analyzed)
+		reportAnalysis(drivesPlanned);
+}
 
-	std::ofstream log("midi_log.txt");
+// print what analyzeSong found, warn about whatever playback
+// won't keep up with, and thin the timeline if the link is short
+void MIDI::reportAnalysis(const uint32_t drivesPlanned) {
+	*console << "Analyzed " << analysis.events << " events in " << analysis.elapsedMs << " ms: up to "
+		<< analysis.peakTotalNotes << " notes at once, " << analysis.peakEventsPerSec << " events/sec at the busiest"
+		<< ", " << analysis.foldedNotes << " notes folded into floppy range." << std::endl;
+
+	// bytes/sec per controller (start, 8 data and stop bits per byte),
+	// with the planned drives spread over as few controllers as hold them
+	size_t linkControllers = (drivesPlanned + DRIVES_PER_CONTROLLER - 1) / DRIVES_PER_CONTROLLER;
+	if (linkControllers < 1)
+		linkControllers = 1;
+	if (linkControllers > NUM_CONTROLLERS)
+		linkControllers = NUM_CONTROLLERS;
+	const double linkBytesPerSec = static_cast<double>(BAUD) / 10.0 * static_cast<double>(linkControllers);
+
+	*console << "Floppy link: ~" << analysis.floppyPackets << " packets, up to " << analysis.peakFloppyBytesPerSec << " of "
+		<< linkBytesPerSec << " bytes/sec (" << 100.0 * analysis.peakFloppyBytesPerSec / linkBytesPerSec << "%), busiest instant "
+		<< analysis.worstTickBytes << " bytes at " << static_cast<double>(analysis.worstTickUsec) / MICROSECONDS_PER_SECOND << " sec." << std::endl;
+
+#ifdef PLAY_SINE
+	if (analysis.peakTotalNotes > MAX_SIMUL)
+		*console << "Warning: up to " << analysis.peakTotalNotes << " notes sound at once, but there are only " << MAX_SIMUL << " sine voices (VOICE_STEAL_POLICY decides who gives way)." << std::endl;
+#endif
+
+#ifdef POLYPHONIC_FLOPPY_CHANNELS
+	if (analysis.peakTotalNotes > MAX_DRIVES)
+		*console << "Warning: up to " << analysis.peakTotalNotes << " notes sound at once, but there are only " << MAX_DRIVES << " drives (a channel's oldest note gives its drive up)." << std::endl;
+#else
+	if (maxTotalChannels > MAX_DRIVES)
+		*console << "Warning: " << maxTotalChannels << " channels play, but there are only " << MAX_DRIVES << " drives (the last to start go unheard)." << std::endl;
+#endif
+
+	if (analysis.peakFloppyBytesPerSec <= linkBytesPerSec)
+		return;
+
+	*console << "Warning: floppy updates need up to " << analysis.peakFloppyBytesPerSec << " bytes/sec, more than the link carries; notes will land late." << std::endl;
+
+#ifdef ADAPT_TO_LINK_BANDWIDTH
+	if (analysis.redundantEvents) {
+		size_t considered;
+		const size_t removed = thinControlEvents(timeline, channels, exactThinning(), considered);
+		*console << "Dropped " << removed << " pitch bend/volume/expression events that change nothing: now up to "
+			<< analysis.peakNeededFloppyBytesPerSec << " bytes/sec." << std::endl;
+	}
+#endif
+}
+
+void MIDI::startMidiLog() {
+	finishMidiLog();
+	logWriter = std::thread(&MIDI::writeMidiLog, this);
+}
+
+void MIDI::finishMidiLog() {
+	if (logWriter.joinable())
+		logWriter.join();
+}
+
+// log thread only. reads nothing playback writes, so
+// it can run alongside compiling and playing
+void MIDI::writeMidiLog() const {
+
+	// one large buffer rather than a flush per line.
+	// declared first so it outlives the stream
+	std::vector<char> buffer(MIDI_LOG_BUFFER_BYTES);
+	std::ofstream log;
+	log.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+	log.open("midi_log.txt");
 	if (!log) {
-		std::cout << "Failed to open midi_log.txt for logging. Aborting." << std::endl;
+		std::cout << "Failed to open midi_log.txt for logging." << std::endl;
 		return;
 	}
 
-	log << "Stepping through parsed MIDI structure:" << std::endl;
-	log << "File Name: " << fileName << std::endl;
-	log << "File Size (bytes): " << fileSize << std::endl << std::endl;
-	log << "> Delta-times appear before each event." << std::endl << std::endl;
-	log << ">>> MIDI Header:" << std::endl;
-	log << "File format: " << header.format << std::endl;
-	log << "Division: " << header.division << std::endl;
-	log << "# of tracks: " << header.ntrks << std::endl;
+	log << "Stepping through parsed MIDI structure:" << '\n';
+	log << "File Name: " << fileName << '\n';
+	log << "File Size (bytes): " << fileSize << '\n' << '\n';
+	log << "> Delta-times appear before each event." << '\n' << '\n';
+	log << ">>> MIDI Header:" << '\n';
+	log << "File format: " << header.format << '\n';
+	log << "Division: " << header.division << '\n';
+	log << "# of tracks: " << header.ntrks << '\n';
 
 	for (size_t i = 0; i < chunks.size(); ++i) {
-		log << ">>> Track " << i << ":" << std::endl;
+		log << ">>> Track " << i << ":" << '\n';
 
-		log << "# of MTrkEvents: " << chunks[i].mtrkEvents.size() << std::endl;
-		for (BaseMTrkEvent* evt : chunks[i].mtrkEvents) {
-			if (isClosing) {
-				log.close();
-				cleanUpMemory();
+		log << "# of MTrkEvents: " << chunks[i].mtrkEvents.size() << '\n';
+		for (const MTrkEvent& evt : chunks[i].mtrkEvents) {
+			if (isClosing)
 				return;
-			}
-			log << std::left << std::setw(DELTA_TIME_WIDTH) << evt->deltaTime << "|  " << std::setw(0);
-			evt->processEvent(*this, log);
+			log << std::left << std::setw(DELTA_TIME_WIDTH) << evt.deltaTime << "|  " << std::setw(0);
+			processEvent(evt, log);
 		}
 	}
 
-	log << "Total channels used: " << maxTotalChannels << std::endl;
-	std::cout << "Total channels used: " << maxTotalChannels << std::endl;
-	log.close();
+	log << "Total channels used: " << maxTotalChannels << '\n';
+}
+
+// when an event usec into the song is due, at PLAYBACK_SPEED
+PrecisionTimer::Clock::time_point MIDI::dueTime(const uint64_t usec) const {
+	return startTime + std::chrono::nanoseconds(static_cast<int64_t>(usec * 1000 / PLAYBACK_SPEED));
+}
+
+// how far behind its scheduled time an event is being played
+void MIDI::recordDispatch(const uint64_t usec) const {
+	dispatchLatency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(PrecisionTimer::Clock::now() - dueTime(usec)).count());
 }
 
 void MIDI::playTrack(const size_t track) {
 
 	printf("Thread %lu launched for track playback.\n", track);
 
-	chunks[track].elapsedMS = 0.0;
-	for (BaseMTrkEvent* evt : chunks[track].mtrkEvents) {
+	// one per track thread, each calibrating itself
+	PrecisionTimer trackTimer;
 
-		if (evt->deltaTime != 0) {
-			if (track == 0) {
-				ready = true;
-				cv.notify_one();
-			}
-			mtx.lock();
-			chunks[track].elapsedMS += static_cast<double>(evt->deltaTime) / ticksPerSecond * MILLISECONDS_PER_SECOND;
-			mtx.unlock();
-			std::this_thread::sleep_until(startTime + std::chrono::nanoseconds(static_cast<long long>(NANOSECONDS_PER_MILLISECOND*chunks[track].elapsedMS)));
+	// the tempo map is read-only by now, so every
+	// thread lands each tick on the same microsecond
+	uint64_t tick = chunks[track].startTick;
+	chunks[track].elapsedUsec = tempoMap.tickToUsec(tick);
+	for (const MTrkEvent& evt : chunks[track].mtrkEvents) {
+
+		if (evt.deltaTime != 0) {
+			tick += evt.deltaTime;
+			chunks[track].elapsedUsec = tempoMap.tickToUsec(tick);
+			trackTimer.waitUntil(dueTime(chunks[track].elapsedUsec));
+			serviceLatencyDump();
 		}
 		
 		if (isClosing) {
@@ -771,166 +1096,752 @@ void MIDI::playTrack(const size_t track) {
 			exit(EXIT_FAILURE);
 		}
 
-		evt->playEvent(*this, track);
+		recordDispatch(chunks[track].elapsedUsec);
+		playEvent(evt, track);
 	}
 
 	printf("Thread %lu terminating.\n", track);
 }
 
-void MIDI::playMusic() {
+// single scheduler: walk the pre-timed merged timeline,
+// sleeping only when the next event is at a new time
+void MIDI::playTimeline() {
 
-#ifdef ASSIGN_CHANNELS_TO_DRIVES_SEQUENTIALLY
-	for (size_t i = 0; i < NUM_CHANNELS; ++i)
-		channels[i].channelHasBeenUsed = false;
+	printf("Scheduler launched for playback of %llu events.\n", static_cast<unsigned long long>(timeline.size()));
+
+	batchingPackets = true;
+
+	size_t next = 0;
+	if (playFromUsec || loopToUsec) {
+		const std::chrono::high_resolution_clock::time_point indexStart = std::chrono::high_resolution_clock::now();
+		seekIndex.build(timeline, channels);
+		std::cout << "Indexed " << seekIndex.size() << " seek checkpoints in " << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - indexStart).count() << " ms." << std::endl;
+
+		next = seekTo(playFromUsec);
+
+		// nothing between A and B would spin forever
+		if (loopToUsec && next == timeline.size()) {
+			const uint64_t endUsec = timeline.empty() ? 0 : timeline.back().usec;
+			std::cout << "Song ends at " << endUsec / MICROSECONDS_PER_SECOND << " s, before the loop starts at " << playFromUsec / MICROSECONDS_PER_SECOND << " s." << std::endl;
+			loopToUsec = 0;
+		}
+		else if (loopToUsec && timeline[next].usec >= loopToUsec) {
+			std::cout << "Nothing to loop between " << playFromUsec / MICROSECONDS_PER_SECOND << " s and " << loopToUsec / MICROSECONDS_PER_SECOND << " s; playing to the end." << std::endl;
+			loopToUsec = 0;
+		}
+	}
+
+	uint64_t lastUsec = playFromUsec;
+	for (;;) {
+		const bool ended = next == timeline.size();
+
+		if (ended || timeline[next].usec != lastUsec) {
+			// previous tick is complete
+			flushPackets();
+
+			// B (or the end of the song): back to A
+			if (loopToUsec && (ended || timeline[next].usec >= loopToUsec)) {
+				if (!ended)
+					timer.waitUntil(dueTime(loopToUsec));
+				if (isClosing)
+					break;
+
+				next = seekTo(playFromUsec);
+				lastUsec = playFromUsec;
+				continue;
+			}
+
+			if (ended)
+				break;
+
+			lastUsec = timeline[next].usec;
+			timer.waitUntil(dueTime(lastUsec));
+			serviceLatencyDump();
+		}
+
+		if (isClosing) {
+			cleanUpAudio();
+			cleanUpMemory();
+			exit(EXIT_FAILURE);
+		}
+
+		const TimelineEvent& te = timeline[next++];
+		chunks[te.track].elapsedUsec = te.usec;
+		recordDispatch(te.usec);
+		playEvent(te.evt, te.track);
+	}
+
+	printf("Scheduler terminating.\n");
+}
+
+void MIDI::playCompiled() {
+
+	const CompiledEvent* const events = compiled.events();
+	const size_t numEvents = compiled.size();
+
+	printf("Scheduler launched for playback of %llu compiled events.\n", static_cast<unsigned long long>(numEvents));
+
+	playingCompiled = true;
+	batchingPackets = true;
+
+	uint64_t lastUsec = 0;
+	for (size_t i = 0; i < numEvents; ++i) {
+		const CompiledEvent& ce = events[i];
+
+		if (ce.usec != lastUsec) {
+			// previous tick is complete
+			flushPackets();
+
+			lastUsec = ce.usec;
+			timer.waitUntil(dueTime(ce.usec));
+			serviceLatencyDump();
+		}
+
+		if (isClosing) {
+			cleanUpAudio();
+			cleanUpMemory();
+			exit(EXIT_FAILURE);
+		}
+
+		recordDispatch(ce.usec);
+
+		if (ce.type == COMPILED_PACKET) {
+			if (controllers && controllers->isConnected())
+				sendPacket(ce.floppy);
+
+#if defined(LOG_NOTES) && defined(VERBOSE_1)
+			playbackLog.floppy(ce.floppy);
 #endif
+		}
+		else if (stream) {
+			MTrkEvent evt = {};
+			evt.type = MIDI_EVENT;
+			evt.status = static_cast<uint8_t>(ce.channelEvent);
+			evt.byte1 = static_cast<uint8_t>(ce.channelEvent >> 8);
+			evt.byte2 = static_cast<uint8_t>(ce.channelEvent >> 16);
+			playMidiEvent(evt);
+		}
+	}
 
-#ifdef LOG_NOTES
-	std::cout << "Logging notes." << std::endl;
+	flushPackets();
+	playingCompiled = false;
+
+	printf("Scheduler terminating.\n");
+}
+
+// everything, besides the MIDI file itself, that
+// changes which packets a song compiles to
+uint64_t MIDI::settingsHash() const {
+	const double settings[] = {
+		MAX_DRIVES, MIN_FLOPPY_NOTE, MAX_FLOPPY_NOTE, NOTE_DOWN_SHIFT_SEMITONES,
+		MAX_PITCH_BEND_SEMITONES, MIN_FLOPPY_VOLUME, FREQ_MULTIPLIER,
+		TUNING_SYSTEM, TUNING_ROOT_NOTE, TUNING_REFERENCE_HZ,
+#ifdef ASSIGN_CHANNELS_TO_DRIVES_SEQUENTIALLY
+		1.0,
+#else
+		0.0,
 #endif
-#ifdef VERBOSE_1
-	std::cout << "Verbosity Level 1 enabled." << std::endl;
+#ifdef POLYPHONIC_FLOPPY_CHANNELS
+		1.0,
+#else
+		0.0,
 #endif
-#ifdef VERBOSE_2
-	std::cout << "Verbosity Level 2 enabled." << std::endl;
+#ifdef SHARE_SPARE_DRIVES
+		1.0,
+#else
+		0.0,
 #endif
 
-	// MIDI default, will probably be replaced by a 
-	// MIDI 0x51 "Set Tempo" event, but maybe not
-	usecPerQtrNote = MIDI_STANDARD_DEFAULT_USEC_PER_QTR_NOTE;
-	decodeDivision();
+		// whether the timeline is thinned depends on the link and speed
+#ifdef ADAPT_TO_LINK_BANDWIDTH
+		BAUD, PLAYBACK_SPEED,
+#else
+		0.0, 0.0,
+#endif
+#ifdef THIN_CONTROL_EVENTS
+		THIN_CONTROL_MIN_INTERVAL_MS, THIN_BEND_TOLERANCE_CENTS, THIN_CONTROLLER_TOLERANCE
+#else
+		-1.0, -1.0, -1.0
+#endif
+	};
+	return fnv1a64(reinterpret_cast<const uint8_t*>(settings), sizeof settings);
+}
 
-#ifdef PLAY_FLOPPY
-	serial = new Serial();
-	if (!serial->isConnected()) {
-		std::cout << "Aborting." << std::endl;
-		return;
+std::string MIDI::compiledSongFileName() const {
+	return fileName + COMPILED_SONG_EXTENSION;
+}
+
+// on a hit, the song is ready to play without parsing
+bool MIDI::loadCompiledSong() {
+	if (!compiled.load(compiledSongFileName(), fnv1a64(rawMIDI.data(), rawMIDI.size()), settingsHash(), rawMIDI.size(), *console))
+		return false;
+
+	for (size_t i = 0; i < NUM_CHANNELS; ++i) {
+		channels[i].prog = compiled.header.channels[i].prog;
+		channels[i].volume = compiled.header.channels[i].volume;
+		channels[i].expression = compiled.header.channels[i].expression;
+		channels[i].channelHasBeenUsed = false;
 	}
-#endif
 
-#ifdef PLAY_SINE
+	drives.reset(MAX_DRIVES);
+	for (size_t i = 0; i < NUM_CHANNELS; ++i)
+		drives.restorePool(i + 1, compiled.header.channels[i].firstDrive, compiled.header.channels[i].numDrives);
 
-	std::cout << "Launching audio stream..." << std::endl;
-	stream = new Stream();
-	if (!stream->streamInitialized) {
-		std::cout << "Aborting." << std::endl;
-		return;
+	hasCompiledSong = true;
+	return true;
+}
+
+// run the timeline through the same dispatch as playback,
+// recording floppy packets instead of sending them, plus every
+// channel event for the sine side. then cache the result
+bool MIDI::compileSong() {
+	compiled.clear();
+	compiled.header = CompiledSongHeader();
+	compiled.header.sourceHash = fnv1a64(rawMIDI.data(), rawMIDI.size());
+	compiled.header.settingsHash = settingsHash();
+	compiled.header.sourceSize = rawMIDI.size();
+
+	// state playback starts from (as left by
+	// analyzeMidiStructure)
+	for (size_t i = 0; i < NUM_CHANNELS; ++i) {
+		compiled.header.channels[i].prog = channels[i].prog;
+		compiled.header.channels[i].volume = channels[i].volume;
+		compiled.header.channels[i].expression = channels[i].expression;
 	}
 
-	stream->initSineTable();
+	resetPlaybackState();
+	compiled.built.reserve(2 * timeline.size());
+
+	compiling = true;
+	playingTimeline = true;
+	for (const TimelineEvent& te : timeline) {
+		if (isClosing)
+			break;
+
+		compileUsec = te.usec;
+		if (te.evt.type == MIDI_EVENT && te.evt.status >= 0x80 && te.evt.status < 0xF0) {
+			CompiledEvent ce = {};
+			ce.usec = te.usec;
+			ce.channelEvent = static_cast<uint32_t>(te.evt.status) | (static_cast<uint32_t>(te.evt.byte1) << 8) | (static_cast<uint32_t>(te.evt.byte2) << 16);
+			ce.type = COMPILED_CHANNEL_EVENT;
+			compiled.built.push_back(ce);
+		}
 
-	std::cout << "Done." << std::endl;
-#endif
+		// meta events only log during playback
+		if (te.evt.type == MIDI_EVENT)
+			playMidiEvent(te.evt);
+	}
+	compiling = false;
 
-	std::vector<std::thread> threads;
+	// pools as assigned by the end of the song
+	compiled.header.numDrives = static_cast<uint8_t>(drives.drivesAssigned());
+	for (size_t i = 0; i < NUM_CHANNELS; ++i) {
+		compiled.header.channels[i].firstDrive = drives.poolFirst(i + 1);
+		compiled.header.channels[i].numDrives = drives.poolSize(i + 1);
+	}
 
-	for (int16_t i = MAX_SIMUL - 1; i >= 0; --i) {
-		availablePlayIndices.push(i);
+	// compiling changed channel state; put back what
+	// playback (and the cache) starts from
+	for (size_t i = 0; i < NUM_CHANNELS; ++i) {
+		channels[i].prog = compiled.header.channels[i].prog;
+		channels[i].volume = compiled.header.channels[i].volume;
+		channels[i].expression = compiled.header.channels[i].expression;
+		channels[i].channelHasBeenUsed = false;
 	}
+	drives.releaseAll();
+
+	if (isClosing)
+		return false;
+
+	hasCompiledSong = true;
+	*console << "Compiled " << compiled.size() << " events." << std::endl;
+
+	// a failed save just means no cache next time
+	if (compiled.save(compiledSongFileName(), *console))
+		*console << "Cached compiled song to " << compiledSongFileName() << "." << std::endl;
+
+	return true;
+}
+
+// channel, voice and tempo state at the top of the song
+void MIDI::resetPlaybackState() {
+#ifdef ASSIGN_CHANNELS_TO_DRIVES_SEQUENTIALLY
+	for (size_t i = 0; i < NUM_CHANNELS; ++i)
+		channels[i].channelHasBeenUsed = false;
+
+	// pools are handed out again as each channel first plays
+	// (a compiled song's were handed out when it was compiled)
+	if (!hasCompiledSong)
+		drives.clearPools();
+#endif
+
+	voices.reset(VOICE_STEAL_POLICY);
+	drives.releaseAll();
 
 	for (size_t i = 0; i < NUM_CHANNELS; ++i) {
+		channels[i].pitchBend = 8192;
 		channels[i].pitchBendFactor = 1.0;
 		for (size_t j = 0; j < MAX_NOTES; ++j) {
 			channels[i].activeNotes[j] = NOT_ACTIVE;
+			channels[i].activeDrives[j] = NO_DRIVE;
 		}
+		for (auto&& w : channels[i].voicedNotes)
+			w.store(0, std::memory_order_relaxed);
 	}
+}
 
-	// wait for Arduino ready signal...
-#ifdef PLAY_FLOPPY
-	int buffer;
-	std::cout << std::endl << "Waiting for Arduino to signal READY..." << std::endl;
-	while (serial->readData(reinterpret_cast<void*>(&buffer), sizeof buffer) <= 0) {
-		if (isClosing) {
-			cleanUpAudio();
-			cleanUpMemory();
-			return;
+// stop every sounding note as its note off would
+void MIDI::allNotesOff() {
+	MTrkEvent evt = {};
+	evt.type = MIDI_EVENT;
+	for (size_t i = 0; i < NUM_CHANNELS; ++i) {
+		for (size_t j = 0; j < MAX_NOTES; ++j) {
+			if (channels[i].activeNotes[j] != NOT_ACTIVE || channels[i].activeDrives[j] != NO_DRIVE) {
+				evt.byte1 = static_cast<uint8_t>(j);
+				noteOff(i + 1, evt);
+			}
 		}
-		std::this_thread::sleep_for(std::chrono::microseconds(US_TO_WAIT_BETWEEN_ARDUINO_READINESS_CHECKS));
 	}
+}
 
-	std::cout << "Arduino ready!" << std::endl << std::endl;
+// pick up at usec with every channel as the song has it there,
+// sounding again the notes held across it, and the clock moved to
+// match. returns the first event still to play
+size_t MIDI::seekTo(const uint64_t usec) {
+	allNotesOff();
+
+	SeekState state;
+	seekIndex.seek(usec, state);
+	for (size_t i = 0; i < NUM_CHANNELS; ++i) {
+		channels[i].prog = state.channels[i].prog;
+		channels[i].volume = state.channels[i].volume;
+		channels[i].expression = state.channels[i].expression;
+		channels[i].pitchBend = state.channels[i].pitchBend;
+		channels[i].pitchBendFactor = pitchBendBytesToFactor(channels[i].pitchBend);
+	}
+
+	MTrkEvent evt = {};
+	evt.type = MIDI_EVENT;
+	for (const SeekHeldNote& h : state.held) {
+		evt.status = static_cast<uint8_t>(0x90 + h.channel - 1);
+		evt.byte1 = h.note;
+		evt.byte2 = h.velocity;
+		playMidiEvent(evt);
+	}
+	flushPackets(true);
+
+	std::cout << "Playing from " << usec / MICROSECONDS_PER_SECOND << " s";
+	const uint32_t usecPerQtrNote = tempoMap.usecPerQtrNoteAt(usec);
+	if (usecPerQtrNote)
+		std::cout << " (" << 60.0 * MICROSECONDS_PER_SECOND / usecPerQtrNote << " bpm)";
+	std::cout << ", " << state.held.size() << " notes held." << std::endl;
+
+	startTime = PrecisionTimer::Clock::now() - std::chrono::nanoseconds(static_cast<int64_t>(usec * 1000 / PLAYBACK_SPEED));
+	return state.eventIndex;
+}
+
+size_t MIDI::numEvents() const {
+	size_t total = 0;
+	for (auto&& chunk : chunks)
+		total += chunk.mtrkEvents.size();
+	return total;
+}
+
+uint64_t MIDI::dispatchToNullSink(uint64_t& packets) {
+	if (timeline.empty())
+		buildTimeline();
+
+	// leave the song as it was, so every run does the same work
+	// (the rest of channel state is reset before every run)
+	uint8_t startState[NUM_CHANNELS][3];
+	for (size_t i = 0; i < NUM_CHANNELS; ++i) {
+		startState[i][0] = channels[i].prog;
+		startState[i][1] = channels[i].volume;
+		startState[i][2] = channels[i].expression;
+	}
+
+	resetPlaybackState();
+	playingTimeline = true;
+	nullSink = true;
+	nullSinkPackets = 0;
+
+	for (const TimelineEvent& te : timeline) {
+		chunks[te.track].elapsedUsec = te.usec;
+		playEvent(te.evt, te.track);
+	}
+
+	nullSink = false;
+	for (size_t i = 0; i < NUM_CHANNELS; ++i) {
+		channels[i].prog = startState[i][0];
+		channels[i].volume = startState[i][1];
+		channels[i].expression = startState[i][2];
+	}
+	drives.releaseAll();
+
+	packets = nullSinkPackets;
+	return timeline.size();
+}
+
+// same voice/envelope model as live sine playback, but driven
+// straight from the timeline: render up to each event's sample,
+// dispatch it, repeat. no sleeping, no audio device, no floppies
+bool MIDI::renderToFile() {
+	const std::chrono::high_resolution_clock::time_point renderStart = std::chrono::high_resolution_clock::now();
+
+	resetPlaybackState();
+
+	stream = new Stream(true);
+
+	WavWriter wav;
+	if (!wav.open(renderFileName, static_cast<uint32_t>(SAMPLE_RATE), 2)) {
+		cleanUpMemory();
+		return false;
+	}
+
+	std::cout << "Rendering " << timeline.size() << " events to " << renderFileName << "..." << std::endl;
+
+	playingTimeline = true;
+
+#ifdef LOG_NOTES
+	playbackLog.start();
 #endif
 
-	// ...and a bit more for aesthetics (pause between calibration and music)
-	std::this_thread::sleep_for(std::chrono::milliseconds(MS_TO_WAIT_AFTER_CALIBRATION));
+	float block[2 * MIX_BLOCK_FRAMES];
+	uint64_t renderedFrames = 0;
+
+	for (const TimelineEvent& te : timeline) {
+		const uint64_t dueFrame = static_cast<uint64_t>(static_cast<double>(te.usec) * SAMPLE_RATE / MICROSECONDS_PER_SECOND);
+		while (renderedFrames < dueFrame) {
+			const unsigned long n = static_cast<unsigned long>((dueFrame - renderedFrames < MIX_BLOCK_FRAMES) ? dueFrame - renderedFrames : MIX_BLOCK_FRAMES);
+			stream->render(block, n);
+			wav.write(block, n);
+			renderedFrames += n;
+		}
+
+		if (isClosing)
+			break;
+
+		chunks[te.track].elapsedUsec = te.usec;
+		playEvent(te.evt, te.track);
+	}
+
+	// let everything fade out, as live playback does
+	for (uint16_t i = 0; i < MAX_SIMUL; ++i)
+		stream->stopAudio(i);
+	const uint64_t tailFrames = static_cast<uint64_t>(MS_TO_WAIT_AFTER_PLAYING / MILLISECONDS_PER_SECOND * SAMPLE_RATE);
+	for (uint64_t done = 0; done < tailFrames; done += MIX_BLOCK_FRAMES) {
+		const unsigned long n = static_cast<unsigned long>((tailFrames - done < MIX_BLOCK_FRAMES) ? tailFrames - done : MIX_BLOCK_FRAMES);
+		stream->render(block, n);
+		wav.write(block, n);
+	}
+
+#ifdef LOG_NOTES
+	playbackLog.stop();
+#endif
+
+	const bool ok = wav.close();
+	cleanUpMemory();
+
+	const double elapsedMS = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - renderStart).count();
+	std::cout << "Rendered " << static_cast<double>(wav.frames()) / SAMPLE_RATE << " sec of audio in " << elapsedMS << " ms." << std::endl;
+	std::cout << "Voices: " << voices.allocations() << " started, " << voices.steals() << " stolen, " << voices.drops() << " dropped." << std::endl;
+
+	return ok && !isClosing;
+}
+
+void MIDI::playMusic() {
+
+#ifdef LOG_NOTES
+	std::cout << "Logging notes." << std::endl;
+#endif
+#ifdef VERBOSE_1
+	std::cout << "Verbosity Level 1 enabled." << std::endl;
+#endif
+#ifdef VERBOSE_2
+	std::cout << "Verbosity Level 2 enabled." << std::endl;
+#endif
+
+	resetPlaybackState();
+
+	// outputs handed over by the previous song are ready to go,
+	// but their stats (and this object's timer's, if it played a
+	// song before that) are the previous songs'
+	timer.resetStats();
+	if (controllers || stream) {
+		if (controllers)
+			controllers->resetStats();
+		resetLatencyHistograms();
+	}
+	else if (!openOutputs()) {
+		return;
+	}
+
+	std::vector<std::thread> threads;
 
 	std::cout << "Launching playback..." << std::endl;
 
+#ifdef LOG_NOTES
+	playbackLog.start();
+#endif
+
+	// this thread becomes the scheduler
+	timer.configureThread();
+
 	// mark start of playback to sync all future events to
-	startTime = std::chrono::high_resolution_clock::now();
-
-	// format 1 files must play multiple tracks simultaneously.
-	if (header.format == 1) {
-
-		// launch thread 0 first and lock until track 0
-		// either ends or hits a non-zero delta time
-		// so that tempo (which is first signaled at delta-time 0
-		// in thread 0) can be established
-		// before others start playing notes
-		ready = false;
-		threads.push_back(std::thread(&MIDI::playTrack, this, 0));
-		std::unique_lock<std::mutex> lk(track0mtx);
-		cv.wait(lk, []{ return ready; });
-
-		for (size_t i = 1; i < chunks.size(); ++i) {
-			threads.push_back(std::thread(&MIDI::playTrack, this, i));
-		}
+	startTime = PrecisionTimer::Clock::now();
 
-		// wait for song to finish playing
-		for (auto it = threads.begin(), end = threads.end(); it != end; ++it){
-			it->join();
-		}
+	if (hasCompiledSong) {
+		// everything is pre-timed and pre-packed
+		playingTimeline = true;
+		playCompiled();
 	}
 	else {
-		for (size_t i = 0; i < chunks.size(); ++i) {
-			playTrack(i);
+#ifdef USE_MERGED_TIMELINE
+		// everything is pre-timed, so one thread plays all tracks
+		playingTimeline = true;
+		playTimeline();
+#else
+		playingTimeline = false;
+
+		if (playFromUsec || loopToUsec)
+			std::cout << "Seeking needs USE_MERGED_TIMELINE; playing from the start." << std::endl;
+
+		// format 1 files must play multiple tracks simultaneously.
+		// tempo comes from the map, so no track has to go first
+		if (header.format == 1) {
+			for (size_t i = 0; i < chunks.size(); ++i) {
+				threads.push_back(std::thread(&MIDI::playTrack, this, i));
+			}
+
+			// wait for song to finish playing
+			for (auto it = threads.begin(), end = threads.end(); it != end; ++it){
+				it->join();
+			}
 		}
+		else {
+			for (size_t i = 0; i < chunks.size(); ++i) {
+				playTrack(i);
+			}
+		}
+#endif
 	}
 
-	cleanUpAudio();
-	cleanUpMemory();
+#ifdef LOG_NOTES
+	playbackLog.stop();
+#endif
+
+	if (playingTimeline)
+		timer.printStats("Scheduler");
+
+	finishPlayback();
 }
 
-void MIDI::cleanUpMemory() {
-	for (auto&& chunk : chunks) {
-		for (BaseMTrkEvent* evt : chunk.mtrkEvents) {
-			delete evt;
-		}
+// stats, then silence (or release) the outputs
+void MIDI::finishPlayback() {
+#ifdef PLAY_SINE
+	std::cout << "Voices: " << voices.allocations() << " started, " << voices.steals() << " stolen, " << voices.drops() << " dropped." << std::endl;
+#endif
+
+	// a compiled song's drives were allocated when it was compiled
+	if (drives.allocations())
+		std::cout << "Drives: " << drives.drivesAssigned() << " in use, " << drives.allocations() << " notes started, " << drives.steals() << " taken over, " << drives.drops() << " dropped." << std::endl;
+
+	// the next song starts right away on outputs kept open
+	if (keepOutputsOpen)
+		stopOutputs();
+	else
+		cleanUpAudio();
+
+	// cleanup's stops are in flight; the rest are final
+	if (controllers && controllers->isConnected())
+		controllers->printStats();
+
+	printLatencyHistograms();
+
+	if (!keepOutputsOpen)
+		cleanUpMemory();
+}
+
+// no file, no tracks and no scheduling: each message goes through
+// the same dispatch as a song's, and its packets are sent the
+// moment the input that carried it has been dispatched
+bool MIDI::playLive(const std::string& device) {
+	MidiInput input;
+	if (!input.open(device))
+		return false;
+
+	resetChannelDefaults();
+
+#ifdef POLYPHONIC_FLOPPY_CHANNELS
+	const uint8_t drivesPerChannel = LIVE_DRIVES_PER_CHANNEL;
+#else
+	const uint8_t drivesPerChannel = 1;
+#endif
+	drives.reset(MAX_DRIVES);
+	drives.planEvenly(drivesPerChannel);
+
+	clearSong();
+	resetPlaybackState();
+	playingLive = true;
+
+	if (!controllers && !stream && !openOutputs()) {
+		playingLive = false;
+		return false;
 	}
 
-#ifdef PLAY_FLOPPY
-	delete serial;
+	std::cout << "Playing live from " << device << " (Ctrl+C to stop)." << std::endl;
+
+#ifdef LOG_NOTES
+	playbackLog.start();
 #endif
 
-#ifdef PLAY_SINE
-	delete stream;
+	// this thread becomes the dispatcher
+	timer.configureThread();
+	batchingPackets = true;
+
+	MidiInputParser parser;
+	MTrkEvent evt = {};
+	evt.type = MIDI_EVENT;
+
+	uint64_t messages = 0;
+	uint8_t bytes[MIDI_INPUT_READ_BYTES];
+	while (!isClosing && input.isOpen()) {
+		int64_t receivedNs;
+		const size_t n = input.read(bytes, sizeof bytes, receivedNs);
+
+		for (size_t i = 0; i < n; ++i) {
+			MidiChannelMessage msg;
+			if (parser.feed(bytes[i], msg)) {
+				evt.status = msg.status;
+				evt.byte1 = msg.byte1;
+				evt.byte2 = msg.byte2;
+				playMidiEvent(evt);
+				++messages;
+			}
+		}
+
+		// one send per controller for everything this input carried
+		if (n)
+			flushPackets(true, receivedNs);
+
+		serviceLatencyDump();
+	}
+
+	if (!input.isOpen())
+		std::cout << "MIDI input " << device << " closed." << std::endl;
+
+#ifdef LOG_NOTES
+	playbackLog.stop();
 #endif
+
+	std::cout << "Live input: " << messages << " channel messages." << std::endl;
+	finishPlayback();
+	playingLive = false;
+	return true;
 }
 
-void MIDI::cleanUpAudio() {
-#ifdef PLAY_SINE
-	for (uint16_t i = 0; i < MAX_SIMUL; ++i)
-		stream->stopAudio(i);
-	
+// connect the floppies and/or audio stream, and wait until
+// the drives are calibrated. false (and nothing left open)
+// if any of it fails
+bool MIDI::openOutputs() {
+#ifdef PLAY_FLOPPY
+	controllers = new ControllerPool();
+	if (!controllers->isConnected()) {
+		std::cout << "Aborting." << std::endl;
+		cleanUpMemory();
+		return false;
+	}
 #endif
 
+#ifdef PLAY_SINE
+
+	std::cout << "Launching audio stream..." << std::endl;
+	stream = new Stream();
+	if (!stream->streamInitialized) {
+		std::cout << "Aborting." << std::endl;
+		cleanUpMemory();
+		return false;
+	}
+
+	std::cout << "Done." << std::endl;
+#endif
 
+	// wait for Arduino ready signal(s)...
 #ifdef PLAY_FLOPPY
-	if (serial->isConnected()) {
-		// tell each drive in turn to stop playing
-		// by writing a 0 frequency to it
-		for (uint32_t i = 0; i < freeDrive; ++i) {
-			serial->writeData(reinterpret_cast<void*>(&i), PACKET_SIZE_BYTES);
-		}
+	std::cout << std::endl << "Waiting for " << controllers->size() << " Arduino" << ((controllers->size() == 1) ? "" : "s") << " to signal READY..." << std::endl;
+	if (!controllers->waitForReady(isClosing, US_TO_WAIT_BETWEEN_ARDUINO_READINESS_CHECKS)) {
+		cleanUpAudio();
+		cleanUpMemory();
+		return false;
 	}
 
+	std::cout << "Arduino ready!" << std::endl << std::endl;
 #endif
 
+	// ...and a bit more for aesthetics (pause between calibration and music)
+	std::this_thread::sleep_for(std::chrono::milliseconds(MS_TO_WAIT_AFTER_CALIBRATION));
+	return true;
+}
+
+void MIDI::handOverOutputs(MIDI& next) {
+	next.controllers = controllers;
+	next.stream = stream;
+	controllers = nullptr;
+	stream = nullptr;
+}
+
+bool MIDI::hasOutputs() const {
+	return controllers || stream;
+}
+
+void MIDI::clearSong() {
+	rawMIDI.close();
+	chunks.clear();
+	timeline.clear();
+	analysis = SongAnalysis();
+	maxTotalChannels = 0;
+	compiled.clear();
+	hasCompiledSong = false;
+}
+
+void MIDI::cleanUpMemory() {
+	// events are flat PODs held by value in their tracks,
+	// so there is nothing to free one at a time
+
+	delete controllers;
+	controllers = nullptr;
+
+	delete stream;
+	stream = nullptr;
+}
+
+void MIDI::cleanUpAudio() {
+	stopOutputs();
+
 	// wait for drives and/or streams to stop
 	std::this_thread::sleep_for(std::chrono::milliseconds(MS_TO_WAIT_AFTER_PLAYING));
+}
+
+// silence every voice and drive this song used
+void MIDI::stopOutputs() {
+	if (stream) {
+		for (uint16_t i = 0; i < MAX_SIMUL; ++i)
+			stream->stopAudio(i);
+	}
 
+	if (controllers && controllers->isConnected()) {
+		// tell each drive in turn to stop playing
+		for (uint32_t i = 0; i < drives.drivesAssigned(); ++i) {
+			FloppyMessage msg = {};
+			msg.drive = static_cast<uint8_t>(i);
+			msg.type = FLOPPY_NOTE_OFF;
+			sendPacket(msg);
+		}
+		flushPackets(true);
+	}
 }
 
-void MidiEvent::loadEvent(MIDI& midi, TrackChunk& chunk, const uint8_t firstByte) {
+bool MIDI::loadMidiEvent(MTrkEvent& evt, TrackChunk& chunk, ByteReader& in, const uint8_t firstByte) {
 	// Tricky thing: "running status." If we get an invalid status byte (< 0x80),
 	// RE-USE the status of the previous byte, and jump right into data bytes 1 and/or 2.
 
@@ -939,126 +1850,125 @@ void MidiEvent::loadEvent(MIDI& midi, TrackChunk& chunk, const uint8_t firstByte
 	// The status byte determines this. See http://www.org/techspecs/midimessages.php.
 
 	if (firstByte < 0x80) {
-		status = chunk.runningStatus;
-		byte1 = firstByte;
+		evt.status = chunk.runningStatus;
+		evt.byte1 = firstByte;
 	}
 	else {
-		status = chunk.runningStatus = firstByte;
-		byte1 = (status >= 244) ? 0 : midi.readOneBinaryByte();
+		evt.status = chunk.runningStatus = firstByte;
+		evt.byte1 = (evt.status >= 244) ? 0 : in.readU8();
 	}
 
-	byte2 = ((status >= 192 && status <= 223) || status == 243) ? 0 : midi.readOneBinaryByte();
+	evt.byte2 = ((evt.status >= 192 && evt.status <= 223) || evt.status == 243) ? 0 : in.readU8();
+
+	// data bytes are 7 bits; playback indexes notes with them
+	return evt.byte1 < 0x80 && evt.byte2 < 0x80;
 }
 
-void MidiEvent::processEvent(MIDI& midi, std::ofstream& log) {
+void MIDI::processMidiEvent(const MTrkEvent& evt, std::ofstream& log) const {
+	const uint8_t status = evt.status;
+
 	log << "MIDI Event: ";
 
 	if (status >= 0x80 && status <= 0x8F) {
-		log << "Chan " << status - 0x7F << " Note OFF: " << midi.extractNote(status - 0x7F, *this, false) << std::endl;
+		log << "Chan " << status - 0x7F << " Note OFF: ";
+		extractNote(evt, log);
+		log << '\n';
 	}
 	else if (status >= 0x90 && status <= 0x9F) {
-		log << "Chan " << status - 0x8F << " Note ON: " << midi.extractNote(status - 0x8F, *this, true) << std::endl;
+		log << "Chan " << status - 0x8F << " Note ON: ";
+		extractNote(evt, log);
+		log << '\n';
 	}
 	else if (status >= 0xB0 && status <= 0xBF) {
-		log << "Chan " << status - 0xAF << " Control/Mode Change: " << extractModeChange(*this) << std::endl;
+		log << "Chan " << status - 0xAF << " Control/Mode Change: ";
+		extractModeChange(evt, log);
+		log << '\n';
 	}
 	else if (status >= 0xC0 && status <= 0xCF) {
-		log << "Chan " << status - 0xBF << " Program Change: Select Program (0-127): " << midi.extractProgramChange(status - 0xBF, *this) << std::endl;
+		log << "Chan " << status - 0xBF << " Program Change: Select Program (0-127): " << static_cast<unsigned>(evt.byte1) << '\n';
 	}
 	else if (status >= 0xE0 && status <= 0xEF) {
-		log << "Chan " << status - 0xDF << " Pitch Bend Change (0-16383): " << extractPitchBendChange(*this) << " (factor==" << pitchBendBytesToFactor(pitchBendBytes(*this)) << ')' << std::endl;
+		log << "Chan " << status - 0xDF << " Pitch Bend Change (0-16383): " << pitchBendBytes(evt) << " (factor==" << pitchBendBytesToFactor(pitchBendBytes(evt)) << ')' << '\n';
 	}
 	else {
-		log << "Unknown (Code 0x" << std::hex << status << std::dec << ")" << std::endl;
+		log << "Unknown (Code 0x" << std::hex << status << std::dec << ")" << '\n';
 	}
 }
 
-void MidiEvent::playEvent(MIDI& midi, const size_t track) {
+void MIDI::playMidiEvent(const MTrkEvent& evt) {
+	const uint8_t status = evt.status;
+
 	if (status >= 0x80 && status <= 0x8F) {
-		midi.noteOff(status - 0x7F, *this);
+		noteOff(status - 0x7F, evt);
 	}
 	// don't use 0x99 (channel 10) as it is an effects/percussion channel
 	else if (status >= 0x90 && status <= 0x9F && status != 0x99) {
-		midi.noteOn(status - 0x8F, *this);
+		noteOn(status - 0x8F, evt);
 	}
 	else if (status >= 0xC0 && status <= 0xCF) {
-		midi.channels[status - 0xC0].prog = byte1;
+		channels[status - 0xC0].prog = evt.byte1;
 	}
 	else if (status >= 0xB0 && status <= 0xBF) {
-		if (byte1 == 0x07) midi.setChannelVolume(status - 0xAF, *this);
-		if (byte1 == 0x0B) midi.setChannelExpression(status - 0xAF, *this);
+		if (evt.byte1 == 0x07) setChannelVolume(status - 0xAF, evt);
+		if (evt.byte1 == 0x0B) setChannelExpression(status - 0xAF, evt);
 	}
 	else if (status >= 0xE0 && status <= 0xEF) {
-		midi.setPitchBend(status - 0xDF, *this);
+		setPitchBend(status - 0xDF, evt);
 	}
 }
 
-void SysExEvent::loadEvent(MIDI& midi, TrackChunk& chunk, const uint8_t firstByte) {
-	length = midi.readVariableLengthQuantity();
-	bytes = midi.rawMIDI.substr(midi.pos, length);
-	midi.pos += length;
-}
-
-void SysExEvent::processEvent(MIDI& midi, std::ofstream& log) {
-	log << "SysEx Event: " << bytes.size() << " byte message: ";
-	generateVariableLengthMessage(bytes, log);
-}
-
-void MetaEvent::loadEvent(MIDI& midi, TrackChunk& chunk, const uint8_t firstByte) {
-	metaType = midi.readOneBinaryByte();
-	length = midi.readVariableLengthQuantity();
-	bytes = midi.rawMIDI.substr(midi.pos, length);
-	midi.pos += length;
-}
+void MIDI::processMetaEvent(const MTrkEvent& evt, std::ofstream& log) const {
+	const ByteView bytes = eventBytes(evt);
+	const char* text = reinterpret_cast<const char*>(bytes.data);
+	const int textLength = static_cast<int>(bytes.size());
 
-void MetaEvent::processEvent(MIDI& midi, std::ofstream& log) {
 	log << "Meta Event: ";
-	switch (metaType) {
+	switch (evt.status) {
 	case 0x01:
 	case 0x0A:
 	case 0x0B:
-		log << "Text: " << bytes.c_str() << std::endl;
+		log << "Text: "; log.write(text, textLength) << '\n';
 		break;
 	case 0x02:
-		log << "Copyright Notice: " << bytes.c_str() << std::endl;
+		log << "Copyright Notice: "; log.write(text, textLength) << '\n';
 		break;
 	case 0x03:
-		log << "Track Name: " << bytes.c_str() << std::endl;
+		log << "Track Name: "; log.write(text, textLength) << '\n';
 		break;
 	case 0x04:
-		log << "Instrument Name: " << bytes.c_str() << std::endl;
+		log << "Instrument Name: "; log.write(text, textLength) << '\n';
 		break;
 	case 0x05:
-		log << "Lyric: " << bytes.c_str() << std::endl;
+		log << "Lyric: "; log.write(text, textLength) << '\n';
 		break;
 	case 0x06:
-		log << "Marker: " << bytes.c_str() << std::endl;
+		log << "Marker: "; log.write(text, textLength) << '\n';
 		break;
 	case 0x07:
-		log << "Cue Point: " << bytes.c_str() << std::endl;
+		log << "Cue Point: "; log.write(text, textLength) << '\n';
 		break;
 	case 0x08:
-		log << "Program Name: " << bytes.c_str() << std::endl;
+		log << "Program Name: "; log.write(text, textLength) << '\n';
 		break;
 	case 0x09:
-		log << "Device Name: " << bytes.c_str() << std::endl;
+		log << "Device Name: "; log.write(text, textLength) << '\n';
 		break;
 	case 0x20:
-		log << "MIDI Channel: " << atoll(bytes.c_str()) << std::endl;
+		log << "MIDI Channel: " << atoll(std::string(text, textLength).c_str()) << '\n';
 		break;
 	case 0x21:
-		log << "MIDI Port: " << atoll(bytes.c_str()) << std::endl;
+		log << "MIDI Port: " << atoll(std::string(text, textLength).c_str()) << '\n';
 		break;
 	case 0x2F:
-		log << "End of Track" << std::endl;
+		log << "End of Track" << '\n';
 		break;
-	case 0x51:
-		midi.usecPerQtrNote = ThreeBinaryBytesDirectToInt(bytes);
-		log << "Set Tempo: " << midi.usecPerQtrNote << " microsec per quarter note" << std::endl;
+	case 0x51: {
+		const size_t usecPerQtrNote = ThreeBinaryBytesDirectToInt(bytes);
+		log << "Set Tempo: " << usecPerQtrNote << " microsec per quarter note" << '\n';
 		log << "New Division Decode: ";
-		midi.decodeDivision();
-		log << (midi.header.TicksPerQtrNoteMode ? "Ticks/QtrNote Method: " : "FPS Method: ") << ticksPerSecond << " delta-time ticks per second." << std::endl;
+		log << (header.TicksPerQtrNoteMode ? "Ticks/QtrNote Method: " : "FPS Method: ") << decodeDivision(usecPerQtrNote) << " delta-time ticks per second." << '\n';
 		break;
+	}
 	case 0x54:
 		log << "SMPTE Offset: ";
 		extractSMPTE(bytes, log);
@@ -1072,44 +1982,65 @@ void MetaEvent::processEvent(MIDI& midi, std::ofstream& log) {
 		extractKeySignature(bytes, log);
 		break;
 	case 0x7F:
-		log << "Sequencer Specific Data" << std::endl;
+		log << "Sequencer Specific Data" << '\n';
 		break;
 	default:
-		log << "Unknown (Code 0x" << std::hex << static_cast<uint16_t>(metaType) << std::dec << ")" << std::endl;
+		log << "Unknown (Code 0x" << std::hex << static_cast<uint16_t>(evt.status) << std::dec << ")" << '\n';
 	}
 }
 
-void MetaEvent::playEvent(MIDI& midi, const size_t track) {
-	switch (metaType) {
+void MIDI::playMetaEvent(const MTrkEvent& evt, const size_t track) {
+	switch (evt.status) {
 	case 0x01:
 	case 0x0A:
 	case 0x0B:
 #ifdef LOG_NOTES
-		printf("Text: %s\n", bytes.c_str());
+		playbackLog.text(PLAYBACK_TEXT, reinterpret_cast<const char*>(eventBytes(evt).data), evt.dataLength);
 #endif
 		break;
 	case 0x05:
 #ifdef LOG_NOTES
-		printf("Lyric: %s\n", bytes.c_str());
+		playbackLog.text(PLAYBACK_LYRIC, reinterpret_cast<const char*>(eventBytes(evt).data), evt.dataLength);
 #endif
 		break;
 	case 0x2F:
-		if (track == 0) {
-			ready = true;
-			cv.notify_one();
-		}
 #ifdef LOG_NOTES
-		printf("End of Track %llu\n", static_cast<unsigned long long>(track));
-		printf("Elapsed time: %g sec\n", midi.chunks[track].elapsedMS / MILLISECONDS_PER_SECOND);
+		playbackLog.endOfTrack(track, chunks[track].elapsedUsec);
 #endif
 		break;
 	case 0x51:
-		mtx.lock();
-		midi.usecPerQtrNote = ThreeBinaryBytesDirectToInt(bytes);
-		midi.decodeDivision();
-		mtx.unlock();
+		// already resolved into the tempo map
 #if defined(LOG_NOTES) && defined(VERBOSE_1)
-		printf("New Tempo: %g ticks per second\n", ticksPerSecond);
+		playbackLog.tempo(ThreeBinaryBytesDirectToInt(eventBytes(evt)));
 #endif
+		break;
+	}
+}
+// single switch on the type tag replaces per-class virtual dispatch
+void MIDI::processEvent(const MTrkEvent& evt, std::ofstream& log) const {
+	switch (evt.type) {
+	case MIDI_EVENT:
+		processMidiEvent(evt, log);
+		break;
+	case SYSEX_EVENT:
+		log << "SysEx Event: " << evt.dataLength << " byte message: ";
+		generateVariableLengthMessage(eventBytes(evt), log);
+		break;
+	case META_EVENT:
+		processMetaEvent(evt, log);
 	}
-}
\ No newline at end of file
+}
+
+void MIDI::playEvent(const MTrkEvent& evt, const size_t track) {
+	switch (evt.type) {
+	case MIDI_EVENT:
+		playMidiEvent(evt);
+		break;
+	case META_EVENT:
+		playMetaEvent(evt, track);
+		break;
+	default:
+		// SysEx is ignored during playback
+		break;
+	}
+}
@@ -22,13 +22,65 @@
 //#define VERBOSE_1
 //#define VERBOSE_2
 
+// write every parsed event to midi_log.txt? (on a
+// background thread, so playback doesn't wait for it)
+//#define LOG_MIDI_STRUCTURE
+#define MIDI_LOG_BUFFER_BYTES							(1 << 20)
+
 
 
 // assign drives by order of note appearance in time
 // during playback?
 #define ASSIGN_CHANNELS_TO_DRIVES_SEQUENTIALLY
 
-#define MAX_DRIVES										(15)
+// give each channel a pool of as many drives as it ever sounds
+// notes at once, so chords play instead of collapsing to the last
+// note? (otherwise every channel gets a single drive)
+#define POLYPHONIC_FLOPPY_CHANNELS
+
+// once every pool is big enough, hand out the rest of the drives
+// anyway, so that round-robin spreads notes (and stepper wear)
+// over every drive? (polyphonic channels only)
+#define SHARE_SPARE_DRIVES
+
+// if the song looks like more than the floppy link can carry,
+// drop the pitch bends and volume/expression changes that don't
+// change anything before playing? (see songAnalysis.h)
+#define ADAPT_TO_LINK_BANDWIDTH
+
+// thin dense pitch bend and volume/expression streams (i.e. from
+// DAW exports) to at most one event per THIN_CONTROL_MIN_INTERVAL_MS
+// per channel, skipping changes within the tolerances, before
+// playing? (see controlThinning.h)
+#define THIN_CONTROL_EVENTS
+#define THIN_CONTROL_MIN_INTERVAL_MS					(5)
+#define THIN_BEND_TOLERANCE_CENTS						(1.0)
+#define THIN_CONTROLLER_TOLERANCE						(0)
+
+// when playing live input (see midiInput.h), each channel's
+// pool as it first plays, until the drives run out
+// (polyphonic channels only; otherwise one drive each)
+#define LIVE_DRIVES_PER_CHANNEL							(4)
+
+// play all tracks from a single merged, pre-timed
+// timeline on one scheduler thread instead of
+// launching one thread per track?
+#define USE_MERGED_TIMELINE
+
+// which sounding sine voice to give up when all
+// MAX_SIMUL are busy and a new note arrives
+// (STEAL_NONE, STEAL_OLDEST, STEAL_QUIETEST, STEAL_SAME_NOTE)
+#define VOICE_STEAL_POLICY								(STEAL_OLDEST)
+
+// compile each song down to what playback actually sends,
+// cached next to the MIDI file, so later runs of the same
+// song skip parsing and start immediately?
+#define USE_COMPILED_SONG_CACHE
+#define COMPILED_SONG_EXTENSION							".sotfc"
+
+// drives in use at most. every controller in SERIAL_PORTS
+// adds DRIVES_PER_CONTROLLER more (up to 255 in total)
+#define MAX_DRIVES										(DRIVES_PER_CONTROLLER * NUM_CONTROLLERS)
 
 #define MIN_FLOPPY_NOTE									(25)
 #define MAX_FLOPPY_NOTE									(57)
@@ -37,6 +89,21 @@
 
 #define NOTE_DOWN_SHIFT_SEMITONES						(12)
 
+// refuse files larger than this by default (0 for no limit).
+// loading is memory-mapped so any size loads instantly; this is
+// just a sanity check against being handed something that isn't a MIDI
+#define MAX_MIDI_FILE_SIZE_IN_BYTES						(512 * 1024 * 1024)
+
+// track chunks parse in parallel, one thread per core at most
+// (or at most this many, if nonzero), and only for files with
+// at least this much track data per extra thread
+#define PARSE_MAX_THREADS								(0)
+#define PARSE_MIN_BYTES_PER_THREAD						(64 * 1024)
+
+// play this many times faster than written (i.e. 4 to
+// load-test the floppy path against a "mock" controller)
+#define PLAYBACK_SPEED									(1)
+
 #define MS_TO_WAIT_AFTER_CALIBRATION					(2000)
 #define MS_TO_WAIT_AFTER_PLAYING						(300)
 #define US_TO_WAIT_BETWEEN_ARDUINO_READINESS_CHECKS		(1000)
@@ -46,7 +113,6 @@
 
 
 // BELOW ARE NOT TO BE MODIFIED //
-#define CHANNEL_NOT_ASSIGNED							(255)
 #define DEFAULT_EXPRESSION								(127)
 #define DEFAULT_INSTRUMENT								(1)
 #define DEFAULT_VOLUME									(100)
@@ -54,10 +120,11 @@
 #define EFFECTS_CHANNEL									(10)
 #define FREQ_MULTIPLIER									(10000.0)
 #define LENGTH_FIELD_LENGTH								(4)
-#define MAX_MIDI_FILE_SIZE_IN_BYTES						(2000000)
 #define MAX_NOTES										(128)
 #define MICROSECONDS_PER_SECOND							(1000000.0)
 #define MIDI_STANDARD_DEFAULT_USEC_PER_QTR_NOTE			(500000)
+#define MTHD_TAG										MAKE_TAG('M', 'T', 'h', 'd')
+#define MTRK_TAG										MAKE_TAG('M', 'T', 'r', 'k')
 #define MILLISECONDS_PER_SECOND							(1000.0)
 #define MIN_FLOPPY_VOLUME								(1000.0f)
 #define NANOSECONDS_PER_MILLISECOND						(1000000.0)
@@ -69,27 +136,65 @@
 #define TAG_LENGTH										(4)
 #define VOLUME_NORM										(127.0)
 
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <condition_variable>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <mutex>
 #include <queue>
+#include <sstream>
 #include <string>
 #include <thread>
 #include <vector>
 
+#include "byteReader.h"
+#include "compiledSong.h"
+#include "controllerPool.h"
+#include "controlThinning.h"
+#include "driveAllocator.h"
+#include "eventLog.h"
+#include "latencyHistogram.h"
+#include "mappedFile.h"
+#include "midiInput.h"
 #include "myPortAudio.h"
-#include "serial.h"
+#include "precisionTimer.h"
+#include "seekIndex.h"
+#include "songAnalysis.h"
+#include "tempoMap.h"
+#include "tuning.h"
+#include "voiceAllocator.h"
+#include "wavWriter.h"
+
+// chunks are composed of a variable number of MTrkEvents
+// which consist of a delta-time and one of the three
+// types of events: MIDI, SysEx, or Meta
+enum MTrkEventType : uint8_t {
+	MIDI_EVENT,
+	SYSEX_EVENT,
+	META_EVENT
+};
 
-// endian swap a 4-byte unsigned int
-#define swapi4(i4) (((i4) >> 24) + (((i4) >> 8) & 65280) + (((i4) & 65280) << 8) + ((i4) << 24))
+// all three types share one flat, fixed-size POD record
+// so a track is a single contiguous array.
+// channel messages keep their data bytes inline;
+// SysEx and Meta payloads are just views (offset + length)
+// into the mapped rawMIDI, which must outlive the parsed events
+struct MTrkEvent {
+	uint32_t deltaTime;
+	MTrkEventType type;
 
-// endian swap a 2-byte unsigned int
-#define swapi2(i2) (((i2) >> 8) + ((i2) << 8))
+	// MIDI status byte, SysEx F0/F7 byte, or Meta type
+	uint8_t status;
+	uint8_t byte1;
+	uint8_t byte2;
 
-class BaseMTrkEvent;
+	uint32_t dataOffset;
+	uint32_t dataLength;
+};
 
 // base chunk, derived into either header or track chunk
 struct Chunk {
@@ -105,137 +210,237 @@ struct HeaderChunk : public Chunk {
 };
 
 struct TrackChunk : public Chunk {
-	double elapsedMS;
+	// absolute tick of the track's first delta time
+	// (nonzero only for format 2's back-to-back sequences)
+	uint64_t startTick;
+
+	// song time of the last event played
+	uint64_t elapsedUsec;
 
 	uint8_t runningStatus;
-	std::vector<BaseMTrkEvent*> mtrkEvents;
+	std::vector<MTrkEvent> mtrkEvents;
+};
+
+// one event of the merged timeline spanning all tracks,
+// with its absolute time from start of playback
+// already resolved through any tempo changes
+struct TimelineEvent {
+	uint64_t usec;
+	uint32_t track;
+	MTrkEvent evt;
 };
 
 // for each channel (16 total),
 // keep track of program (i.e. instrument),
-// pitch bend state, floppy drive mapping,
+// pitch bend state, sounding notes,
 // and whether the channel has been used
 // in the current midi
 struct Channel {
-	uint8_t prog, volume, chanToDrive, expression;
+	uint8_t prog, volume, expression;
+
+	// as sent (8192 is none), and as a frequency factor
+	uint16_t pitchBend;
 	double pitchBendFactor;
 	bool channelHasBeenUsed;
 
 	// one for each of 128 possible notes
 	uint16_t activeNotes[MAX_NOTES];
-	
+
+	// bit per note given a voice, until its note off, so
+	// updates only visit those (atomic, as track threads share
+	// channels)
+	std::atomic<uint64_t> voicedNotes[MAX_NOTES / 64];
+
 	// floppies can only play one note at a time (of course!)
-	// so we'll compromise by keeping track of it here
-	// instead of either not keeping track (we want to have it for
-	// in-place pitch bend modification)
-	// or having a full separate stream class like for sine audio
-	bool isPlayingOnFloppy;
-	double floppyFreq;
+	// so each sounding note gets a drive of its own out of the
+	// channel's pool, if there's one to spare
+	uint8_t activeDrives[MAX_NOTES];
 };
 
-void generateVariableLengthMessage(const std::string& bytes, std::ofstream& log);
+void generateVariableLengthMessage(const ByteView& bytes, std::ofstream& log);
+
+// percussion and sound effect programs, which aren't played
+bool invalidProg(uint8_t prog);
+
+// e.g. "C#4, Velocity (0 - 127): 100"
+void extractNote(const MTrkEvent& evt, std::ostream& out);
 
 // a midi file consists of a header chunk and a variable
 // number of track chunks
 class MIDI {
-	friend class MidiEvent;
-	friend class SysExEvent;
-	friend class MetaEvent;
 public:
-	std::string fileName, rawMIDI;
+	std::string fileName;
+	MappedFile rawMIDI;
+	size_t maxFileSize;
 	bool isClosing;
 
+	// leave the floppies and audio stream open after playing,
+	// to hand over to the next song (see daemon.h)
+	bool keepOutputsOpen;
+
+	// if set, renderToFile() writes the sine output here
+	std::string renderFileName;
+
+	// start playing this far in (see seekIndex.h) and, if
+	// loopToUsec is set, jump back there on reaching it, until
+	// closed. merged timeline playback only
+	uint64_t playFromUsec;
+	uint64_t loopToUsec;
+
+	// where loading, parsing, analyzing and compiling report.
+	// std::cout unless a batch worker buffers it (see batch.h)
+	std::ostream* console;
+
+	// most threads to parse one file's tracks on
+	// (0 means PARSE_MAX_THREADS)
+	size_t parseThreads;
+
+	MIDI();
+	~MIDI();
+
 	bool loadBinaryFile();
 	void playMusic();
-	void stepThroughCompletedMidiStructure();
+
+	// play MIDI as it arrives from a live input (see midiInput.h)
+	// until it goes away or isClosing. false if the input or the
+	// outputs can't be opened
+	bool playLive(const std::string& device);
+	bool renderToFile();
+	bool loadCompiledSong();
+	bool compileSong();
+
+	// default channel state and drive assignment, from the parsed
+	// events. must run after parsing and before playing or compiling
+	void analyzeMidiStructure();
+
+	// write midi_log.txt in the background; finishMidiLog()
+	// waits for it (the destructor does too)
+	void startMidiLog();
+	void finishMidiLog();
+
 	bool parseMIDIFile();
+
+	// events parsed, across all tracks
+	size_t numEvents() const;
+	size_t numTracks() const { return chunks.size(); }
+	size_t channelsUsed() const { return maxTotalChannels; }
+
+	// as of analyzeMidiStructure (zero if there was no timeline)
+	const SongAnalysis& songAnalysis() const { return analysis; }
+
+	// as of compileSong or loadCompiledSong
+	size_t compiledEvents() const { return compiled.size(); }
+
+	// dispatch the whole timeline as fast as possible, building
+	// every floppy packet but sending none (i.e. for benchmarks).
+	// returns events dispatched; packets counts packets built
+	uint64_t dispatchToNullSink(uint64_t& packets);
+
+	// the next song plays on this one's open floppies and audio
+	// stream, without reconnecting or recalibrating
+	void handOverOutputs(MIDI& next);
+	bool hasOutputs() const;
+
+	// forget the loaded song, to load another
+	void clearSong();
+
 	void cleanUpAudio();
 	void cleanUpMemory();
 
 private:
-	size_t pos, fileSize;
-	size_t usecPerQtrNote;
-	size_t ticksPerQtrNote;
-	size_t ticksPerFrame;
-	double FPS;
+	size_t fileSize;
+	TempoMap tempoMap;
 	HeaderChunk header;
 	std::vector<TrackChunk> chunks;
-	std::chrono::high_resolution_clock::time_point startTime;
+	std::vector<TimelineEvent> timeline;
+	bool playingTimeline;
+	PrecisionTimer::Clock::time_point startTime;
+
+	// waits for each tick of the single scheduler
+	PrecisionTimer timer;
 	Channel channels[NUM_CHANNELS];
 	size_t maxTotalChannels;
-	uint8_t freeDrive;
-#ifdef PLAY_FLOPPY
-	Serial* serial;
-#endif
-#ifdef PLAY_SINE
+	SongAnalysis analysis;
+	SeekIndex seekIndex;
+	VoiceAllocator voices;
+	DriveAllocator drives;
+
+	// nullptr when not playing on that output
+	ControllerPool* controllers;
 	Stream* stream;
-#endif
-
-
-	size_t readVariableLengthQuantity();
-	size_t readFourBinaryBytes();
-	uint16_t readTwoBinaryBytes();
-	uint8_t readOneBinaryByte();
-	bool parseBaseMTrkEvent(TrackChunk& chunk);
-	bool parseHeader();
-	bool parseChunk();
-	std::string extractNote(const size_t chan, const MidiEvent& evt, const bool logDrives);
-	std::string extractProgramChange(const uint8_t chan, const MidiEvent& evt);
-	void noteOff(const size_t chan, const MidiEvent& evt);
-	void sendNoteToFloppy(const size_t chan);
-	void noteOn(const size_t chan, const MidiEvent& evt);
-	void setChannelVolume(const size_t chan, const MidiEvent& evt);
-	void setChannelExpression(const size_t chan, const MidiEvent& evt);
+
+	CompiledSong compiled;
+	bool hasCompiledSong;
+
+	// floppy packets are being recorded into compiled
+	// rather than sent, stamped with compileUsec
+	bool compiling;
+	uint64_t compileUsec;
+
+	// floppy packets come pre-packed from compiled,
+	// so only the sine side dispatches channel events
+	bool playingCompiled;
+
+	// single-threaded schedulers batch each tick's packets
+	// per controller and flush them when the tick is done
+	bool batchingPackets;
+
+	// channels are dispatched straight from a live input,
+	// so drive pools are handed out as each first plays
+	bool playingLive;
+
+	// floppy packets are built, counted and dropped
+	bool nullSink;
+	uint64_t nullSinkPackets;
+
+	// writes midi_log.txt (see startMidiLog)
+	std::thread logWriter;
+
+	bool parseBaseMTrkEvent(TrackChunk& chunk, ByteReader& in);
+	bool parseHeader(ByteReader& in);
+	bool scanChunks(ByteReader& in, std::vector<ByteReader>& tracks);
+	bool parseChunk(ByteReader track, TrackChunk& chunk);
+	void parseChunks(const std::vector<ByteReader>& tracks, std::vector<uint8_t>& parsed);
+	void buildTempoMap();
+	void buildTimeline();
+	void reportAnalysis(const uint32_t drivesPlanned);
+	void noteOff(const size_t chan, const MTrkEvent& evt);
+	void sendNoteToFloppy(const size_t chan, const uint8_t drive, const uint8_t note, const FloppyMessageType type);
+	void noteOn(const size_t chan, const MTrkEvent& evt);
+	void setChannelVolume(const size_t chan, const MTrkEvent& evt);
+	void setChannelExpression(const size_t chan, const MTrkEvent& evt);
 	void updatePlayingNotes(const size_t chan);
-	void setPitchBend(const size_t chan, const MidiEvent& evt);
-	void decodeDivision();
+	uint16_t activeVoice(const size_t chan, const uint8_t note) const;
+	void setPitchBend(const size_t chan, const MTrkEvent& evt);
+	double decodeDivision(const size_t usecPerQtrNote) const;
+	PrecisionTimer::Clock::time_point dueTime(const uint64_t usec) const;
+	void recordDispatch(const uint64_t usec) const;
 	void playTrack(const size_t track);
-};
-
-// chunks are composed of a variable number of MTrkEvents
-// which consist of a delta-time and one of the three
-// types of events
-//
-// base class for all types of supported events
-// derived into Midi, SysEx, Meta
-class BaseMTrkEvent {
-public:
-	size_t deltaTime;
-	virtual void loadEvent(MIDI& midi, TrackChunk& chunk, const uint8_t firstByte) = 0;
-	virtual void processEvent(MIDI& midi, std::ofstream& log) = 0;
-	virtual void playEvent(MIDI& midi, const size_t track) = 0;
-};
-
-class MidiEvent : public BaseMTrkEvent {
-public:
-	uint8_t status;
-	uint8_t byte1;
-	uint8_t byte2;
-
-	void loadEvent(MIDI& midi, TrackChunk& chunk, const uint8_t firstByte);
-	void processEvent(MIDI& midi, std::ofstream& log);
-	void playEvent(MIDI& midi, const size_t track);
-};
-
-class SysExEvent : public BaseMTrkEvent {
-public:
-	size_t length;
-	std::string bytes;
-
-	void loadEvent(MIDI& midi, TrackChunk& chunk, const uint8_t firstByte);
-	void processEvent(MIDI& midi, std::ofstream& log);
-	void playEvent(MIDI& midi, const size_t track) {};
-};
-
-class MetaEvent : public BaseMTrkEvent {
-public:
-	uint8_t metaType;
-	size_t length;
-	std::string bytes;
-
-	void loadEvent(MIDI& midi, TrackChunk& chunk, const uint8_t firstByte);
-	void processEvent(MIDI& midi, std::ofstream& log);
-	void playEvent(MIDI& midi, const size_t track);
+	void playTimeline();
+	void playCompiled();
+	bool drivingFloppies() const;
+	bool openOutputs();
+	void stopOutputs();
+	uint8_t activeDrive(const size_t chan, const uint8_t note) const;
+	void sendPacket(const FloppyMessage& packet);
+	void flushPackets(const bool mustSend = false, const int64_t originNs = 0);
+	uint64_t settingsHash() const;
+	std::string compiledSongFileName() const;
+	void resetChannelDefaults();
+	void resetPlaybackState();
+	void allNotesOff();
+	size_t seekTo(const uint64_t usec);
+	void finishPlayback();
+	ByteView eventBytes(const MTrkEvent& evt) const;
+	// false if a data byte has its top bit set
+	bool loadMidiEvent(MTrkEvent& evt, TrackChunk& chunk, ByteReader& in, const uint8_t firstByte);
+	void writeMidiLog() const;
+	void processMidiEvent(const MTrkEvent& evt, std::ofstream& log) const;
+	void processMetaEvent(const MTrkEvent& evt, std::ofstream& log) const;
+	void processEvent(const MTrkEvent& evt, std::ofstream& log) const;
+	void playMidiEvent(const MTrkEvent& evt);
+	void playMetaEvent(const MTrkEvent& evt, const size_t track);
+	void playEvent(const MTrkEvent& evt, const size_t track);
 };
 
 #endif
\ No newline at end of file
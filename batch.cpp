@@ -0,0 +1,381 @@
+/*******************************************************************
+*   batch.cpp
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module checks a whole corpus of MIDI files at once: every
+// file under a directory (recursively), or every file named in a
+// list file, one path per line, is loaded, parsed, analyzed and
+// (with USE_COMPILED_SONG_CACHE) compiled to its cache file, on as
+// many threads as there are cores. Each worker keeps one MIDI object
+// for all its files, so buffers are reused rather than reallocated,
+// parses each file's tracks itself rather than fanning out again,
+// and keeps what it would print in a buffer of its own.
+// Files are dealt out biggest first, round robin, to a deque per
+// worker. A worker takes from the front of its own deque and, when
+// that runs dry, steals from the back of another's, so one huge
+// file doesn't leave the other cores idle at the end.
+// Every file gets a row in BATCH_REPORT_FILE: whether it parsed
+// (and if not, why), its first warning, and what analysis found.
+// Totals, and files/sec and MB/sec, are printed at the end.
+
+#include "batch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#include "daemon.h"
+#include "MIDI.h"
+
+// one per worker, for closeBatch()
+static std::unique_ptr<MIDI[]> songs;
+static size_t numSongs = 0;
+static std::atomic<bool> batchClosing(false);
+
+struct BatchFile {
+	std::string path;
+	uint64_t bytes;
+};
+
+struct BatchResult {
+	bool checked;
+	bool parsed;
+
+	// why not, or else the first warning
+	std::string reason;
+	unsigned warnings;
+
+	size_t tracks;
+	size_t events;
+	size_t channels;
+	SongAnalysis analysis;
+	size_t compiledEvents;
+	double ms;
+};
+
+// a worker's share of the files, stolen from when it runs dry
+struct BatchQueue {
+	std::mutex mtx;
+	std::deque<size_t> files;
+};
+
+// 0 if it can't be read
+static uint64_t fileSize(const std::string& path) {
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &attributes) || (attributes.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+		return 0;
+	return (static_cast<uint64_t>(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+#else
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+		return 0;
+	return static_cast<uint64_t>(st.st_size);
+#endif
+}
+
+static bool isDirectory(const std::string& path) {
+#ifdef _WIN32
+	const DWORD attributes = GetFileAttributesA(path.c_str());
+	return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+#endif
+}
+
+// every MIDI file under directory, however deep
+static void listDirectory(const std::string& directory, std::vector<BatchFile>& found) {
+#ifdef _WIN32
+	WIN32_FIND_DATAA entry;
+	HANDLE hFind = FindFirstFileA((directory + "\\*").c_str(), &entry);
+	if (hFind == INVALID_HANDLE_VALUE)
+		return;
+
+	do {
+		const std::string name(entry.cFileName);
+		if (name == "." || name == "..")
+			continue;
+
+		const std::string path = directory + "\\" + name;
+		if (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			listDirectory(path, found);
+		else if (isMidiFileName(name))
+			found.push_back({ path, (static_cast<uint64_t>(entry.nFileSizeHigh) << 32) | entry.nFileSizeLow });
+	} while (FindNextFileA(hFind, &entry));
+
+	FindClose(hFind);
+#else
+	DIR* dir = opendir(directory.c_str());
+	if (!dir)
+		return;
+
+	while (const dirent* entry = readdir(dir)) {
+		const std::string name(entry->d_name);
+		if (name == "." || name == "..")
+			continue;
+
+		const std::string path = directory + '/' + name;
+		struct stat st;
+		if (stat(path.c_str(), &st) != 0)
+			continue;
+
+		if (S_ISDIR(st.st_mode))
+			listDirectory(path, found);
+		else if (S_ISREG(st.st_mode) && isMidiFileName(name))
+			found.push_back({ path, static_cast<uint64_t>(st.st_size) });
+	}
+
+	closedir(dir);
+#endif
+}
+
+// one path per line, whatever the extension. blank lines and
+// lines starting with # are skipped
+static bool readFileList(const std::string& listName, std::vector<BatchFile>& found) {
+	std::ifstream in(listName);
+	if (!in)
+		return false;
+
+	std::string line;
+	while (std::getline(in, line)) {
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		found.push_back({ line, fileSize(line) });
+	}
+	return true;
+}
+
+// own deque from the front (biggest first), others' from the back
+static bool takeFile(std::vector<BatchQueue>& queues, const size_t self, size_t& file) {
+	for (size_t k = 0; k < queues.size(); ++k) {
+		BatchQueue& q = queues[(self + k) % queues.size()];
+		std::lock_guard<std::mutex> lock(q.mtx);
+		if (q.files.empty())
+			continue;
+
+		if (k == 0) {
+			file = q.files.front();
+			q.files.pop_front();
+		}
+		else {
+			file = q.files.back();
+			q.files.pop_back();
+		}
+		return true;
+	}
+	return false;
+}
+
+// what the daemon does to prepare a song, reporting
+// into the result instead of the console
+static void checkFile(MIDI& midi, const std::string& path, BatchResult& r) {
+	const auto start = std::chrono::high_resolution_clock::now();
+
+	std::ostringstream console;
+	midi.console = &console;
+	midi.clearSong();
+	midi.fileName = path;
+
+	r.parsed = midi.loadBinaryFile() && midi.parseMIDIFile();
+	if (r.parsed) {
+		midi.analyzeMidiStructure();
+#ifdef USE_COMPILED_SONG_CACHE
+		r.parsed = midi.compileSong();
+#endif
+	}
+
+	r.tracks = midi.numTracks();
+	r.events = midi.numEvents();
+	r.channels = r.parsed ? midi.channelsUsed() : 0;
+	r.analysis = midi.songAnalysis();
+	r.compiledEvents = midi.compiledEvents();
+
+	// unmap now rather than when the worker's next file comes
+	midi.clearSong();
+	midi.console = &std::cout;
+
+	r.warnings = 0;
+	std::istringstream lines(console.str());
+	std::string line;
+	while (std::getline(lines, line)) {
+		const bool warning = line.compare(0, 8, "Warning:") == 0;
+		if (warning)
+			++r.warnings;
+
+		// the first failure is the most specific
+		if ((!r.parsed || warning) && r.reason.empty())
+			r.reason = line;
+	}
+	if (!r.parsed && r.reason.empty())
+		r.reason = "Interrupted.";
+
+	r.ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	r.checked = true;
+}
+
+// quoted, for paths and messages with commas in them
+static std::string csvField(const std::string& s) {
+	std::string out = "\"";
+	for (const char c : s) {
+		if (c == '"')
+			out += '"';
+		out += c;
+	}
+	return out + '"';
+}
+
+static bool writeReport(const std::vector<BatchFile>& files, const std::vector<BatchResult>& results) {
+	std::ofstream out(BATCH_REPORT_FILE, std::ios::out | std::ios::trunc);
+	if (!out)
+		return false;
+
+	out << "path,result,reason,warnings,bytes,tracks,events,duration_sec,peak_notes,channels,peak_events_per_sec,peak_floppy_bytes_per_sec,compiled_events,ms" << std::endl;
+	for (size_t i = 0; i < files.size(); ++i) {
+		const BatchResult& r = results[i];
+		if (!r.checked)
+			continue;
+
+		out << csvField(files[i].path) << ',' << (r.parsed ? "ok" : "failed") << ',' << csvField(r.reason) << ',' << r.warnings << ','
+			<< files[i].bytes << ',' << r.tracks << ',' << r.events << ',' << static_cast<double>(r.analysis.durationUsec) / MICROSECONDS_PER_SECOND << ','
+			<< r.analysis.peakTotalNotes << ',' << r.channels << ',' << r.analysis.peakEventsPerSec << ',' << r.analysis.peakFloppyBytesPerSec << ','
+			<< r.compiledEvents << ',' << r.ms << '\n';
+	}
+
+	out.close();
+	return !out.fail();
+}
+
+int runBatch(const std::string& directoryOrList) {
+#if !defined(USE_MERGED_TIMELINE) && !defined(USE_COMPILED_SONG_CACHE)
+	// analysis runs on the timeline
+	std::cout << "Batch mode needs USE_MERGED_TIMELINE or USE_COMPILED_SONG_CACHE." << std::endl;
+	return EXIT_FAILURE;
+#else
+	std::vector<BatchFile> files;
+	if (isDirectory(directoryOrList)) {
+		listDirectory(directoryOrList, files);
+	}
+	else if (!readFileList(directoryOrList, files)) {
+		std::cout << "Failed to open " << directoryOrList << " as a directory or a list of files." << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	if (files.empty()) {
+		std::cout << "No MIDI files in " << directoryOrList << "." << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	// the report goes in path order...
+	std::sort(files.begin(), files.end(), [](const BatchFile& a, const BatchFile& b) { return a.path < b.path; });
+
+	// ...but the work biggest first
+	std::vector<size_t> order(files.size());
+	for (size_t i = 0; i < files.size(); ++i)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&files](const size_t a, const size_t b) { return files[a].bytes > files[b].bytes; });
+
+	size_t numThreads = BATCH_THREADS ? BATCH_THREADS : std::thread::hardware_concurrency();
+	numThreads = std::min(numThreads, files.size());
+	if (numThreads == 0)
+		numThreads = 1;
+
+	std::cout << "Checking " << files.size() << " MIDI files from " << directoryOrList << " on " << numThreads << " thread" << ((numThreads == 1) ? "" : "s") << "..." << std::endl;
+
+	std::vector<BatchQueue> queues(numThreads);
+	for (size_t i = 0; i < order.size(); ++i)
+		queues[i % numThreads].files.push_back(order[i]);
+
+	songs.reset(new MIDI[numThreads]);
+	numSongs = numThreads;
+	for (size_t i = 0; i < numThreads; ++i) {
+		// files are the parallelism here
+		songs[i].parseThreads = 1;
+		songs[i].isClosing = batchClosing;
+	}
+
+	std::vector<BatchResult> results(files.size(), BatchResult());
+	const auto start = std::chrono::high_resolution_clock::now();
+
+	auto worker = [&](const size_t self) {
+		size_t file;
+		while (!batchClosing && takeFile(queues, self, file))
+			checkFile(songs[self], files[file].path, results[file]);
+	};
+
+	// this thread is one of the workers
+	std::vector<std::thread> pool;
+	for (size_t i = 1; i < numThreads; ++i)
+		pool.push_back(std::thread(worker, i));
+	worker(0);
+	for (auto it = pool.begin(), end = pool.end(); it != end; ++it)
+		it->join();
+
+	const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	size_t checked = 0, failed = 0, warned = 0;
+	uint64_t bytes = 0, events = 0;
+	for (size_t i = 0; i < files.size(); ++i) {
+		const BatchResult& r = results[i];
+		if (!r.checked)
+			continue;
+
+		++checked;
+		bytes += files[i].bytes;
+		events += r.events;
+		if (!r.parsed) {
+			++failed;
+			std::cout << "Failed: " << files[i].path << ": " << r.reason << std::endl;
+		}
+		else if (r.warnings) {
+			++warned;
+		}
+	}
+
+	std::cout << "Checked " << checked << " of " << files.size() << " files in " << seconds << " sec: " << checked - failed << " ok ("
+		<< warned << " with warnings), " << failed << " failed." << std::endl;
+	std::cout << static_cast<double>(checked) / seconds << " files/sec, " << static_cast<double>(bytes) / 1000000.0 / seconds << " MB/sec, "
+		<< static_cast<double>(events) / seconds << " events/sec." << std::endl;
+
+	const bool reported = writeReport(files, results);
+	if (reported)
+		std::cout << "Wrote " << BATCH_REPORT_FILE << "." << std::endl;
+	else
+		std::cout << "Could not write " << BATCH_REPORT_FILE << "." << std::endl;
+
+	numSongs = 0;
+	songs.reset();
+
+	return (reported && !failed && checked == files.size()) ? EXIT_SUCCESS : EXIT_FAILURE;
+#endif
+}
+
+void closeBatch() {
+	batchClosing = true;
+	for (size_t i = 0; i < numSongs; ++i)
+		songs[i].isClosing = true;
+}
@@ -0,0 +1,43 @@
+/*******************************************************************
+*   batch.h
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module checks a whole corpus of MIDI files at once: every
+// file under a directory (recursively), or every file named in a
+// list file, one path per line, is loaded, parsed, analyzed and
+// (with USE_COMPILED_SONG_CACHE) compiled to its cache file, on as
+// many threads as there are cores. Each worker keeps one MIDI object
+// for all its files, so buffers are reused rather than reallocated,
+// parses each file's tracks itself rather than fanning out again,
+// and keeps what it would print in a buffer of its own.
+// Files are dealt out biggest first, round robin, to a deque per
+// worker. A worker takes from the front of its own deque and, when
+// that runs dry, steals from the back of another's, so one huge
+// file doesn't leave the other cores idle at the end.
+// Every file gets a row in BATCH_REPORT_FILE: whether it parsed
+// (and if not, why), its first warning, and what analysis found.
+// Totals, and files/sec and MB/sec, are printed at the end.
+
+#ifndef BATCH_H
+#define BATCH_H
+
+// worker threads (0 means one per core)
+#define BATCH_THREADS					(0)
+
+#define BATCH_REPORT_FILE				"batch_report.csv"
+
+#include <string>
+
+// check every MIDI file under a directory, or listed in a file.
+// returns EXIT_SUCCESS if all of them parsed, else EXIT_FAILURE
+int runBatch(const std::string& directoryOrList);
+
+// from the close handler: finish the files being checked and stop
+void closeBatch();
+
+#endif
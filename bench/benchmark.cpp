@@ -0,0 +1,433 @@
+/*******************************************************************
+*   benchmark.cpp
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// SongOfTheFloppiesBench times the hot paths of SongOfTheFloppies
+// against real and synthetic MIDI files:
+//  - parse: parseMIDIFile() throughput (MB/s and events/s), which
+//    includes building the tempo map and merged timeline
+//  - mix: the audio callback's render() at 1/16/64/200 sounding voices
+//  - encode: the floppy wire encoder, protocols v1 and v2
+//  - dispatch: the scheduler's per-event work with a null sink (every
+//    floppy packet built, none sent, no waiting), plus the fixed cost
+//    of a scheduler wait that is already due
+// Every result is printed and also written, one JSON object per line,
+// to benchmark_results.json (or the file given with -o) for tracking
+// across releases.
+//
+// Usage: SongOfTheFloppiesBench [-o results.json] [file.mid ...]
+// With no files, only the synthetic songs are used. Dispatch replays
+// each song through the same code as playback, so LOG_NOTES and
+// friends in MIDI.h cost what they cost there; build with them off
+// to time the dispatch alone. Each song is analyzed first, as on a
+// normal run, to plan and assign its drives.
+//
+// Linux, from the repository root:
+// g++ -std=c++14 -O2 -pthread -I. bench/benchmark.cpp $(ls *.cpp | grep -v main.cpp) -lportaudio -o sotf_bench
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../floppyProtocol.h"
+#include "../MIDI.h"
+#include "../myPortAudio.h"
+#include "../precisionTimer.h"
+
+// keep repeating each measurement for at least this long...
+#define BENCH_MIN_SECONDS				(0.5)
+
+// ...and at least this many times, then report the median
+#define BENCH_MIN_RUNS					(5)
+
+#define BENCH_DEFAULT_OUTPUT			"benchmark_results.json"
+#define BENCH_SYNTHETIC_PREFIX			"bench_synthetic_"
+
+#define BENCH_ENCODER_MESSAGES			(1 << 20)
+#define BENCH_TIMER_WAITS				(1 << 20)
+
+typedef std::chrono::steady_clock BenchClock;
+
+static double secondsSince(const BenchClock::time_point start) {
+	return std::chrono::duration<double>(BenchClock::now() - start).count();
+}
+
+// one result, printed and appended to the JSON lines
+class Results {
+private:
+	std::ofstream out;
+
+public:
+	bool open(const std::string& name) {
+		out.open(name);
+		if (!out) {
+			std::cout << "Failed to open " << name << " for writing." << std::endl;
+			return false;
+		}
+
+		// byte and event counts must survive exactly
+		out.precision(15);
+		return true;
+	}
+
+	void add(const std::string& benchmark, const std::string& input, const std::vector<std::pair<std::string, double>>& metrics) {
+		std::cout << benchmark << " [" << input << "]";
+		out << "{\"benchmark\":\"" << benchmark << "\",\"input\":\"" << input << "\"";
+		for (auto&& m : metrics) {
+			std::cout << "  " << m.first << "=" << m.second;
+			out << ",\"" << m.first << "\":" << m.second;
+		}
+		std::cout << std::endl;
+		out << "}" << std::endl;
+	}
+};
+
+// run fn (which returns the seconds it took) until both limits
+// are met, and return the median
+template <typename Fn>
+static double medianSeconds(Fn fn) {
+	std::vector<double> runs;
+	const BenchClock::time_point start = BenchClock::now();
+	while (runs.size() < BENCH_MIN_RUNS || secondsSince(start) < BENCH_MIN_SECONDS)
+		runs.push_back(fn());
+
+	std::sort(runs.begin(), runs.end());
+	return runs[runs.size() / 2];
+}
+
+// file name without its directory, made safe for a JSON string
+static std::string baseName(const std::string& path) {
+	const size_t slash = path.find_last_of("/\\");
+	std::string name;
+	for (const char c : (slash == std::string::npos) ? path : path.substr(slash + 1))
+		name += (c == '"' || c < ' ') ? '_' : c;
+	return name;
+}
+
+static void putU16(std::string& s, const uint32_t v) {
+	s += static_cast<char>(v >> 8);
+	s += static_cast<char>(v);
+}
+
+static void putU32(std::string& s, const uint32_t v) {
+	putU16(s, v >> 16);
+	putU16(s, v);
+}
+
+static void putVLQ(std::string& s, uint32_t v) {
+	char bytes[5];
+	int n = 0;
+	bytes[n++] = static_cast<char>(v & 0x7F);
+	while (v >>= 7)
+		bytes[n++] = static_cast<char>((v & 0x7F) | 0x80);
+	while (n)
+		s += bytes[--n];
+}
+
+// a format 1 song: a tempo track with changes every few beats, then
+// numTracks tracks of numNotes notes each (chords, note offs as
+// zero-velocity note ons, occasional pitch bends and volume
+// changes), like a dense real file
+static bool writeSyntheticSong(const std::string& name, const uint32_t numTracks, const uint32_t numNotes) {
+	std::mt19937 rng(numTracks * 7919 + numNotes);
+	const uint16_t division = 480;
+
+	std::string file = "MThd";
+	putU32(file, 6);
+	putU16(file, 1);
+	putU16(file, numTracks + 1);
+	putU16(file, division);
+
+	std::string tempo;
+	for (uint32_t i = 0; i < numNotes / 16 + 1; ++i) {
+		putVLQ(tempo, i ? division * 4 : 0);
+		const uint32_t usecPerQtrNote = 400000 + rng() % 200000;
+		tempo += "\xFF\x51\x03";
+		tempo += static_cast<char>(usecPerQtrNote >> 16);
+		tempo += static_cast<char>(usecPerQtrNote >> 8);
+		tempo += static_cast<char>(usecPerQtrNote);
+	}
+	tempo += std::string("\x00\xFF\x2F\x00", 4);
+	file += "MTrk";
+	putU32(file, static_cast<uint32_t>(tempo.size()));
+	file += tempo;
+
+	for (uint32_t t = 0; t < numTracks; ++t) {
+		const uint8_t chan = static_cast<uint8_t>(t % 9);
+		std::string track;
+
+		putVLQ(track, 0);
+		track += static_cast<char>(0xC0 | chan);
+		track += static_cast<char>(rng() % 32);
+
+		for (uint32_t i = 0; i < numNotes; ++i) {
+			const uint8_t note = static_cast<uint8_t>(36 + rng() % 48);
+
+			if (i % 8 == 0) {
+				putVLQ(track, 0);
+				track += static_cast<char>(0xB0 | chan);
+				track += static_cast<char>(7);
+				track += static_cast<char>(64 + rng() % 64);
+			}
+
+			putVLQ(track, (i % 4) ? 0 : division / 4);
+			track += static_cast<char>(0x90 | chan);
+			track += static_cast<char>(note);
+			track += static_cast<char>(40 + rng() % 87);
+
+			if (i % 5 == 0) {
+				putVLQ(track, division / 16);
+				track += static_cast<char>(0xE0 | chan);
+				const uint16_t bend = static_cast<uint16_t>(8192 + static_cast<int>(rng() % 2048) - 1024);
+				track += static_cast<char>(bend & 0x7F);
+				track += static_cast<char>(bend >> 7);
+			}
+
+			// note off as a note on with velocity 0
+			putVLQ(track, division / 8);
+			track += static_cast<char>(0x90 | chan);
+			track += static_cast<char>(note);
+			track += static_cast<char>(0);
+		}
+
+		track += std::string("\x00\xFF\x2F\x00", 4);
+		file += "MTrk";
+		putU32(file, static_cast<uint32_t>(track.size()));
+		file += track;
+	}
+
+	std::ofstream out(name, std::ios::binary);
+	out.write(file.data(), file.size());
+	return static_cast<bool>(out);
+}
+
+static bool benchParse(Results& results, const std::string& name) {
+	size_t bytes = 0, events = 0;
+
+	MIDI* check = new MIDI();
+	check->fileName = name;
+	const bool ok = check->loadBinaryFile() && check->parseMIDIFile();
+	delete check;
+	if (!ok) {
+		std::cout << "Could not parse " << name << "; skipping it." << std::endl;
+		return false;
+	}
+
+	const double seconds = medianSeconds([&]() {
+		// a fresh parser every run, as on a fresh launch
+		MIDI* midi = new MIDI();
+		midi->fileName = name;
+		midi->loadBinaryFile();
+
+		const BenchClock::time_point start = BenchClock::now();
+		midi->parseMIDIFile();
+		const double s = secondsSince(start);
+
+		bytes = midi->rawMIDI.size();
+		events = midi->numEvents();
+		delete midi;
+		return s;
+	});
+
+	results.add("parse", baseName(name), {
+		{ "bytes", static_cast<double>(bytes) },
+		{ "events", static_cast<double>(events) },
+		{ "seconds", seconds },
+		{ "mb_per_s", static_cast<double>(bytes) / seconds / (1024.0 * 1024.0) },
+		{ "events_per_s", static_cast<double>(events) / seconds } });
+	return true;
+}
+
+static void benchDispatch(Results& results, const std::string& name) {
+	MIDI* midi = new MIDI();
+	midi->fileName = name;
+	if (!midi->loadBinaryFile() || !midi->parseMIDIFile()) {
+		delete midi;
+		return;
+	}
+
+	// assigns drives, exactly as before any playback
+	midi->analyzeMidiStructure();
+
+	uint64_t events = 0, packets = 0;
+	const double seconds = medianSeconds([&]() {
+		const BenchClock::time_point start = BenchClock::now();
+		events = midi->dispatchToNullSink(packets);
+		return secondsSince(start);
+	});
+	delete midi;
+
+	results.add("dispatch", baseName(name), {
+		{ "events", static_cast<double>(events) },
+		{ "packets", static_cast<double>(packets) },
+		{ "seconds", seconds },
+		{ "ns_per_event", seconds * 1e9 / static_cast<double>(events ? events : 1) },
+		{ "events_per_s", static_cast<double>(events) / seconds } });
+}
+
+// the floor under every scheduler tick: a wait that is already due
+static void benchTimer(Results& results) {
+	PrecisionTimer timer;
+	const double seconds = medianSeconds([&]() {
+		const BenchClock::time_point start = BenchClock::now();
+		const PrecisionTimer::Clock::time_point due = PrecisionTimer::Clock::now();
+		for (size_t i = 0; i < BENCH_TIMER_WAITS; ++i)
+			timer.waitUntil(due);
+		return secondsSince(start);
+	});
+
+	results.add("dispatch", "due_wait", {
+		{ "waits", static_cast<double>(BENCH_TIMER_WAITS) },
+		{ "ns_per_wait", seconds * 1e9 / BENCH_TIMER_WAITS } });
+}
+
+static void benchMix(Results& results) {
+	static const uint16_t voiceCounts[] = { 1, 16, 64, 200 };
+
+	float block[2 * MIX_BLOCK_FRAMES];
+	for (const uint16_t requested : voiceCounts) {
+		const uint16_t numVoices = (requested < MAX_SIMUL) ? requested : MAX_SIMUL;
+
+		// offline: commands apply immediately, no device needed
+		Stream* stream = new Stream(true);
+		for (uint16_t i = 0; i < numVoices; ++i) {
+			stream->setFreqs(i, 110.0 * (1.0 + 0.01 * i), 1.0);
+			stream->setVels(i, 127, 100, 100);
+			stream->startAudio(i);
+		}
+
+		// let every envelope reach full level first
+		for (int i = 0; i < 200; ++i)
+			stream->render(block, MIX_BLOCK_FRAMES);
+
+		const size_t blocksPerRun = 1000;
+		const double seconds = medianSeconds([&]() {
+			const BenchClock::time_point start = BenchClock::now();
+			for (size_t i = 0; i < blocksPerRun; ++i)
+				stream->render(block, MIX_BLOCK_FRAMES);
+			return secondsSince(start);
+		});
+		delete stream;
+
+		const double frames = static_cast<double>(blocksPerRun * MIX_BLOCK_FRAMES);
+		results.add("mix", std::to_string(numVoices) + "_voices", {
+			{ "voices", static_cast<double>(numVoices) },
+			{ "ns_per_block", seconds * 1e9 / blocksPerRun },
+			{ "ns_per_frame", seconds * 1e9 / frames },
+			{ "realtime_factor", frames / SAMPLE_RATE / seconds } });
+	}
+}
+
+// a plausible update stream for one controller: note ons, bend
+// refreshes of sounding notes, and note offs across all its drives
+static std::vector<FloppyMessage> makeMessages() {
+	std::mt19937 rng(36);
+	std::vector<FloppyMessage> msgs(BENCH_ENCODER_MESSAGES);
+	bool playing[DRIVES_PER_CONTROLLER] = {};
+	uint8_t notes[DRIVES_PER_CONTROLLER] = {};
+
+	for (FloppyMessage& msg : msgs) {
+		msg = FloppyMessage();
+		msg.drive = static_cast<uint8_t>(rng() % DRIVES_PER_CONTROLLER);
+		const uint32_t r = rng() % 10;
+		if (!playing[msg.drive] || r < 3) {
+			msg.type = FLOPPY_NOTE_ON;
+			notes[msg.drive] = static_cast<uint8_t>(MIN_FLOPPY_NOTE + rng() % (MAX_FLOPPY_NOTE - MIN_FLOPPY_NOTE + 1));
+			playing[msg.drive] = true;
+		}
+		else if (r < 5) {
+			msg.type = FLOPPY_NOTE_OFF;
+			playing[msg.drive] = false;
+			continue;
+		}
+		else {
+			msg.type = FLOPPY_UPDATE;
+		}
+		msg.note = notes[msg.drive];
+		msg.bendCents = static_cast<int16_t>(static_cast<int>(rng() % 400) - 200);
+		msg.freq = static_cast<uint32_t>(440.0 * pow(2.0, (msg.note - 69 + msg.bendCents / 100.0) / 12.0) * FREQ_MULTIPLIER);
+	}
+	return msgs;
+}
+
+static void benchEncode(Results& results) {
+	const std::vector<FloppyMessage> msgs = makeMessages();
+	std::vector<uint8_t> out(msgs.size() * FLOPPY_MAX_MESSAGE_BYTES);
+
+	for (uint8_t version = FLOPPY_PROTOCOL_V1; version <= FLOPPY_PROTOCOL_MAX_VERSION; ++version) {
+		size_t bytes = 0;
+		const double seconds = medianSeconds([&]() {
+			FloppyEncoder encoder;
+			encoder.reset(version);
+			bytes = 0;
+
+			const BenchClock::time_point start = BenchClock::now();
+			for (const FloppyMessage& msg : msgs)
+				bytes += encoder.encode(msg, out.data() + bytes);
+			return secondsSince(start);
+		});
+
+		results.add("encode", "v" + std::to_string(version), {
+			{ "messages", static_cast<double>(msgs.size()) },
+			{ "bytes_per_message", static_cast<double>(bytes) / static_cast<double>(msgs.size()) },
+			{ "ns_per_message", seconds * 1e9 / static_cast<double>(msgs.size()) },
+			{ "mb_per_s", static_cast<double>(bytes) / seconds / (1024.0 * 1024.0) } });
+	}
+}
+
+int main(int argc, char* argv[]) {
+	std::string outputName = BENCH_DEFAULT_OUTPUT;
+	std::vector<std::string> songs;
+
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg = argv[i];
+		if (arg == "-o" && i + 1 < argc)
+			outputName = argv[++i];
+		else
+			songs.push_back(arg);
+	}
+
+	Results results;
+	if (!results.open(outputName))
+		return EXIT_FAILURE;
+
+	// small, medium and dense synthetic songs, always present
+	struct Synthetic { uint32_t tracks, notes; };
+	static const Synthetic synthetic[] = { { 1, 2000 }, { 8, 5000 }, { 16, 20000 } };
+	std::vector<std::string> generated;
+	for (const Synthetic& s : synthetic) {
+		std::ostringstream name;
+		name << BENCH_SYNTHETIC_PREFIX << s.tracks << "x" << s.notes << ".mid";
+		if (writeSyntheticSong(name.str(), s.tracks, s.notes)) {
+			generated.push_back(name.str());
+			songs.push_back(name.str());
+		}
+	}
+
+	for (const std::string& song : songs) {
+		if (benchParse(results, song))
+			benchDispatch(results, song);
+	}
+	benchTimer(results);
+	benchMix(results);
+	benchEncode(results);
+
+	for (const std::string& name : generated)
+		std::remove(name.c_str());
+
+	std::cout << "Results written to " << outputName << "." << std::endl;
+	return EXIT_SUCCESS;
+}
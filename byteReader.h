@@ -0,0 +1,128 @@
+/*******************************************************************
+*   byteReader.h
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module provides a zero-copy, bounds-checked cursor over
+// raw big-endian binary data (i.e. a loaded MIDI file).
+// Reads never allocate and never run past the end of the data:
+// an overrun returns 0 and latches a failure flag that the
+// parser checks once per event instead of once per byte.
+
+#ifndef BYTEREADER_H
+#define BYTEREADER_H
+
+#include <cstddef>
+#include <cstdint>
+
+// build a 4-byte chunk tag (e.g. "MThd") as the
+// big-endian integer it reads back as
+#define MAKE_TAG(a, b, c, d) ((static_cast<uint32_t>(a) << 24) | (static_cast<uint32_t>(b) << 16) | (static_cast<uint32_t>(c) << 8) | static_cast<uint32_t>(d))
+
+// non-owning view of a run of bytes (e.g. a SysEx or Meta payload)
+struct ByteView {
+	const uint8_t* data;
+	size_t length;
+
+	uint8_t operator[](const size_t i) const { return data[i]; }
+	size_t size() const { return length; }
+};
+
+class ByteReader {
+private:
+	const uint8_t* begin;
+	const uint8_t* cur;
+	const uint8_t* end;
+	bool overrun;
+
+	// make sure n more bytes exist, else latch failure
+	bool have(const size_t n) {
+		if (static_cast<size_t>(end - cur) < n) {
+			overrun = true;
+			cur = end;
+			return false;
+		}
+		return true;
+	}
+
+public:
+	ByteReader() : begin(nullptr), cur(nullptr), end(nullptr), overrun(false) {}
+	ByteReader(const uint8_t* const data, const size_t size) : begin(data), cur(data), end(data + size), overrun(false) {}
+
+	// true if any read so far ran past the end
+	bool failed() const { return overrun; }
+
+	size_t position() const { return static_cast<size_t>(cur - begin); }
+	size_t remaining() const { return static_cast<size_t>(end - cur); }
+	bool atEnd() const { return cur >= end; }
+	const uint8_t* data() const { return begin; }
+
+	void seek(const size_t pos) {
+		if (pos > static_cast<size_t>(end - begin)) {
+			overrun = true;
+			cur = end;
+		}
+		else {
+			cur = begin + pos;
+		}
+	}
+
+	void skip(const size_t n) {
+		if (have(n)) cur += n;
+	}
+
+	// a view of the next n bytes, which are then skipped
+	ByteView view(const size_t n) {
+		ByteView v = { cur, have(n) ? n : 0 };
+		cur += v.length;
+		return v;
+	}
+
+	// a new reader over the next n bytes, which are then skipped
+	ByteReader subReader(const size_t n) {
+		ByteReader sub(cur, have(n) ? n : 0);
+		cur += sub.remaining();
+		return sub;
+	}
+
+	uint8_t readU8() {
+		return have(1) ? *cur++ : 0;
+	}
+
+	uint16_t readU16() {
+		if (!have(2)) return 0;
+		uint16_t v = static_cast<uint16_t>((cur[0] << 8) | cur[1]);
+		cur += 2;
+		return v;
+	}
+
+	uint32_t readU32() {
+		if (!have(4)) return 0;
+		uint32_t v = MAKE_TAG(cur[0], cur[1], cur[2], cur[3]);
+		cur += 4;
+		return v;
+	}
+
+	// MIDIs contain some quantities stored as
+	// 'variable-length quantities', where 7 bits
+	// per byte are used for storage and the 8th bit
+	// is used as a flag - 1 means there are more
+	// bytes, 0 means this is the last byte
+	// (see the MIDI standard)
+	uint32_t readVariableLengthQuantity() {
+		uint32_t value = 0;
+		uint8_t c;
+		do {
+			if (!have(1)) return 0;
+			c = *cur++;
+			value = (value << 7) + (c & 0x7f);
+		} while (c & 0x80);
+		return value;
+	}
+};
+
+#endif
@@ -0,0 +1,101 @@
+/*******************************************************************
+*   compiledSong.cpp
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module stores a song "compiled" down to exactly what playback
+// sends: floppy drive updates (protocol-independent, encoded per
+// controller at send time) and the channel events the
+// sine voices need, each stamped with its absolute time, plus the
+// channel and drive state at the top of the song. It is written once
+// next to the MIDI file and memory-mapped on later runs, so a cached
+// song starts without parsing, logging, tempo resolution or drive
+// assignment. A content hash of the MIDI file (and of the settings
+// that shape the output) throws out stale entries.
+
+#include "compiledSong.h"
+
+#define FNV_PRIME						(1099511628211ULL)
+
+// events must stay 8-byte aligned in the mapping
+static_assert(sizeof(CompiledSongHeader) % 8 == 0, "CompiledSongHeader must be a multiple of 8 bytes");
+static_assert(sizeof(CompiledEvent) == 24, "CompiledEvent must be 24 bytes");
+
+uint64_t fnv1a64(const uint8_t* data, const size_t size, uint64_t hash) {
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= data[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+CompiledSong::CompiledSong() : mappedEvents(nullptr), numMappedEvents(0) {
+	header = CompiledSongHeader();
+}
+
+void CompiledSong::clear() {
+	file.close();
+	mappedEvents = nullptr;
+	numMappedEvents = 0;
+	built.clear();
+}
+
+bool CompiledSong::load(const std::string& name, const uint64_t sourceHash, const uint64_t settingsHash, const uint64_t sourceSize, std::ostream& console) {
+	clear();
+
+	// no cache yet is the normal case, not an error
+	{
+		std::ifstream probe(name, std::ios::in | std::ios::binary);
+		if (!probe)
+			return false;
+	}
+
+	if (!file.open(name, 0, console))
+		return false;
+
+	if (file.size() < sizeof(CompiledSongHeader)) {
+		file.close();
+		return false;
+	}
+
+	const CompiledSongHeader* h = reinterpret_cast<const CompiledSongHeader*>(file.data());
+	if (h->magic != COMPILED_SONG_MAGIC || h->version != COMPILED_SONG_VERSION
+		|| h->sourceHash != sourceHash || h->settingsHash != settingsHash || h->sourceSize != sourceSize
+		|| h->numEvents != (file.size() - sizeof(CompiledSongHeader)) / sizeof(CompiledEvent)
+		|| (file.size() - sizeof(CompiledSongHeader)) % sizeof(CompiledEvent) != 0) {
+		console << "Compiled song " << name << " is stale. Recompiling." << std::endl;
+		file.close();
+		return false;
+	}
+
+	header = *h;
+	mappedEvents = reinterpret_cast<const CompiledEvent*>(file.data() + sizeof(CompiledSongHeader));
+	numMappedEvents = static_cast<size_t>(h->numEvents);
+	return true;
+}
+
+bool CompiledSong::save(const std::string& name, std::ostream& console) {
+	header.magic = COMPILED_SONG_MAGIC;
+	header.version = COMPILED_SONG_VERSION;
+	header.numEvents = built.size();
+
+	std::ofstream out(name, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!out) {
+		console << "Could not write compiled song " << name << "." << std::endl;
+		return false;
+	}
+
+	out.write(reinterpret_cast<const char*>(&header), sizeof header);
+	out.write(reinterpret_cast<const char*>(built.data()), built.size() * sizeof(CompiledEvent));
+	out.close();
+
+	if (!out) {
+		console << "Error writing compiled song " << name << "." << std::endl;
+		return false;
+	}
+	return true;
+}
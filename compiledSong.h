@@ -0,0 +1,116 @@
+/*******************************************************************
+*   compiledSong.h
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module stores a song "compiled" down to exactly what playback
+// sends: floppy drive updates (protocol-independent, encoded per
+// controller at send time) and the channel events the
+// sine voices need, each stamped with its absolute time, plus the
+// channel and drive state at the top of the song. It is written once
+// next to the MIDI file and memory-mapped on later runs, so a cached
+// song starts without parsing, logging, tempo resolution or drive
+// assignment. A content hash of the MIDI file (and of the settings
+// that shape the output) throws out stale entries.
+
+#ifndef COMPILEDSONG_H
+#define COMPILEDSONG_H
+
+#define COMPILED_SONG_VERSION			(5)
+#define COMPILED_SONG_CHANNELS			(16)
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "byteReader.h"
+#include "floppyProtocol.h"
+#include "mappedFile.h"
+
+#define COMPILED_SONG_MAGIC				MAKE_TAG('S', 'O', 'T', 'F')
+
+enum CompiledEventType : uint8_t {
+	// floppy is a drive update, with its global drive
+	COMPILED_PACKET,
+
+	// channelEvent is status | byte1 << 8 | byte2 << 16
+	// of a channel event, for the sine voices
+	COMPILED_CHANNEL_EVENT
+};
+
+// written and mapped in native byte order;
+// a cache is only ever read back on the machine that wrote it
+struct CompiledEvent {
+	uint64_t usec;
+	union {
+		FloppyMessage floppy;
+		uint32_t channelEvent;
+	};
+	CompiledEventType type;
+	uint8_t pad[3];
+};
+
+struct CompiledChannel {
+	uint8_t prog, volume, expression;
+
+	// the channel's pool of drives
+	uint8_t firstDrive, numDrives;
+	uint8_t pad[3];
+};
+
+struct CompiledSongHeader {
+	uint32_t magic;
+	uint32_t version;
+
+	// FNV-1a of the MIDI file, and of the settings
+	// that shaped the packets
+	uint64_t sourceHash;
+	uint64_t settingsHash;
+	uint64_t sourceSize;
+
+	uint64_t numEvents;
+
+	// drives in use by the end of the song
+	uint8_t numDrives;
+	uint8_t pad[7];
+
+	CompiledChannel channels[COMPILED_SONG_CHANNELS];
+};
+
+uint64_t fnv1a64(const uint8_t* data, const size_t size, uint64_t hash = 14695981039346656037ULL);
+
+class CompiledSong {
+private:
+	MappedFile file;
+	const CompiledEvent* mappedEvents;
+	size_t numMappedEvents;
+
+public:
+	CompiledSongHeader header;
+
+	// filled while compiling, before save()
+	std::vector<CompiledEvent> built;
+
+	CompiledSong();
+
+	// map a cache file, rejecting it unless it was compiled
+	// from this exact source with these exact settings
+	bool load(const std::string& name, const uint64_t sourceHash, const uint64_t settingsHash, const uint64_t sourceSize, std::ostream& console = std::cout);
+
+	// write header + built events
+	bool save(const std::string& name, std::ostream& console = std::cout);
+
+	void clear();
+
+	const CompiledEvent* events() const { return mappedEvents ? mappedEvents : built.data(); }
+	size_t size() const { return mappedEvents ? numMappedEvents : built.size(); }
+};
+
+#endif
@@ -0,0 +1,163 @@
+/*******************************************************************
+*   controlThinning.cpp
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module thins the pitch bend, volume (CC 7) and expression
+// (CC 11) streams of the merged timeline before it is played.
+// Every one of those events re-sends each of the channel's sounding
+// notes, to the mixer and down the serial link, and DAW exports
+// often write them a millisecond apart. Each channel's stream of
+// each is cut, in one pass, to at most one event per min interval:
+// - an event setting what the channel already has goes
+// - so does one within tolerance of the last event kept
+// - one arriving sooner than the interval after the last event
+//   kept is held back, and dropped if a newer one replaces it in
+//   time. if the stream pauses instead (or a note starts on the
+//   channel), it is kept after all, so every held note settles on
+//   the value the song ends the burst at
+// Notes, program changes and everything else are left as they are.
+
+#include "controlThinning.h"
+
+#include "MIDI.h"
+
+#define CONTROL_STREAMS_PER_CHANNEL		(3)
+#define NO_PENDING_EVENT				(SIZE_MAX)
+
+ControlThinning configuredThinning() {
+	ControlThinning settings = {};
+#ifdef THIN_CONTROL_EVENTS
+	settings.minIntervalUsec = static_cast<uint64_t>(THIN_CONTROL_MIN_INTERVAL_MS) * 1000;
+
+	// a bend unit is MAX_PITCH_BEND_SEMITONES / 8192 semitones
+	settings.bendTolerance = static_cast<unsigned>(THIN_BEND_TOLERANCE_CENTS * 8192.0 / (MAX_PITCH_BEND_SEMITONES * 100.0));
+	settings.controllerTolerance = THIN_CONTROLLER_TOLERANCE;
+#endif
+	return settings;
+}
+
+ControlThinning exactThinning() {
+	return ControlThinning();
+}
+
+// which of the channel's streams evt belongs to, or -1
+static int controlStream(const MTrkEvent& evt) {
+	if (evt.type != MIDI_EVENT)
+		return -1;
+	if (evt.status >= 0xE0 && evt.status <= 0xEF)
+		return 0;
+	if (evt.status >= 0xB0 && evt.status <= 0xBF) {
+		if (evt.byte1 == 0x07)
+			return 1;
+		if (evt.byte1 == 0x0B)
+			return 2;
+	}
+	return -1;
+}
+
+static unsigned controlValue(const MTrkEvent& evt, const int stream) {
+	return (stream == 0) ? (static_cast<unsigned>(evt.byte2) << 7) + evt.byte1 : evt.byte2;
+}
+
+struct ControlStream {
+	// what the last event kept set, and when the next may be
+	unsigned value;
+	uint64_t nextUsec;
+
+	// timeline index of an event held back, or NO_PENDING_EVENT
+	size_t pending;
+};
+
+size_t thinControlEvents(std::vector<TimelineEvent>& timeline, const Channel* startChannels, const ControlThinning& settings, size_t& considered) {
+	ControlStream streams[NUM_CHANNELS][CONTROL_STREAMS_PER_CHANNEL];
+	for (size_t i = 0; i < NUM_CHANNELS; ++i) {
+		// playback starts every channel unbent
+		streams[i][0].value = 8192;
+		streams[i][1].value = startChannels[i].volume;
+		streams[i][2].value = startChannels[i].expression;
+		for (auto&& s : streams[i]) {
+			s.nextUsec = 0;
+			s.pending = NO_PENDING_EVENT;
+		}
+	}
+
+	considered = 0;
+	std::vector<uint8_t> keep(timeline.size(), 1);
+
+	// a held-back event was the last of its burst after all
+	auto settle = [&](ControlStream& s, const int stream) {
+		if (s.pending == NO_PENDING_EVENT)
+			return;
+		keep[s.pending] = 1;
+		s.value = controlValue(timeline[s.pending].evt, stream);
+		s.nextUsec = timeline[s.pending].usec + settings.minIntervalUsec;
+		s.pending = NO_PENDING_EVENT;
+	};
+
+	for (size_t i = 0; i < timeline.size(); ++i) {
+		const MTrkEvent& evt = timeline[i].evt;
+		const uint64_t usec = timeline[i].usec;
+		const size_t chan = evt.status & 0x0F;
+
+		// a note should start from the channel's latest state
+		if (evt.type == MIDI_EVENT && evt.status >= 0x90 && evt.status <= 0x9F && evt.byte2 > 1) {
+			for (int k = 0; k < CONTROL_STREAMS_PER_CHANNEL; ++k)
+				settle(streams[chan][k], k);
+			continue;
+		}
+
+		const int stream = controlStream(evt);
+		if (stream < 0)
+			continue;
+
+		++considered;
+		ControlStream& s = streams[chan][stream];
+		const unsigned tolerance = (stream == 0) ? settings.bendTolerance : settings.controllerTolerance;
+
+		if (s.pending != NO_PENDING_EVENT && usec - timeline[s.pending].usec >= settings.minIntervalUsec)
+			settle(s, stream);
+
+		const unsigned value = controlValue(evt, stream);
+		const unsigned change = (value > s.value) ? value - s.value : s.value - value;
+
+		keep[i] = 0;
+		if (change <= tolerance) {
+			// the channel is (close enough to) here already, so
+			// anything held back is superseded
+			s.pending = NO_PENDING_EVENT;
+		}
+		else if (usec >= s.nextUsec) {
+			keep[i] = 1;
+			s.value = value;
+			s.nextUsec = usec + settings.minIntervalUsec;
+			s.pending = NO_PENDING_EVENT;
+		}
+		else {
+			s.pending = i;
+		}
+	}
+
+	// whatever is still held back is where each stream ends
+	for (size_t c = 0; c < NUM_CHANNELS; ++c) {
+		for (int k = 0; k < CONTROL_STREAMS_PER_CHANNEL; ++k)
+			settle(streams[c][k], k);
+	}
+
+	size_t kept = 0;
+	for (size_t i = 0; i < timeline.size(); ++i) {
+		if (!keep[i])
+			continue;
+		if (kept != i)
+			timeline[kept] = timeline[i];
+		++kept;
+	}
+
+	const size_t removed = timeline.size() - kept;
+	timeline.resize(kept);
+	return removed;
+}
@@ -0,0 +1,54 @@
+/*******************************************************************
+*   controlThinning.h
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module thins the pitch bend, volume (CC 7) and expression
+// (CC 11) streams of the merged timeline before it is played.
+// Every one of those events re-sends each of the channel's sounding
+// notes, to the mixer and down the serial link, and DAW exports
+// often write them a millisecond apart. Each channel's stream of
+// each is cut, in one pass, to at most one event per min interval:
+// - an event setting what the channel already has goes
+// - so does one within tolerance of the last event kept
+// - one arriving sooner than the interval after the last event
+//   kept is held back, and dropped if a newer one replaces it in
+//   time. if the stream pauses instead (or a note starts on the
+//   channel), it is kept after all, so every held note settles on
+//   the value the song ends the burst at
+// Notes, program changes and everything else are left as they are.
+
+#ifndef CONTROLTHINNING_H
+#define CONTROLTHINNING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct Channel;
+struct TimelineEvent;
+
+struct ControlThinning {
+	uint64_t minIntervalUsec;
+
+	// in pitch bend units (of 16384) and controller steps (of 128)
+	unsigned bendTolerance;
+	unsigned controllerTolerance;
+};
+
+// settings from MIDI.h (THIN_CONTROL_EVENTS and friends)
+ControlThinning configuredThinning();
+
+// only exactly redundant events are dropped
+ControlThinning exactThinning();
+
+// thin the timeline, starting from each channel's state as
+// playback starts it. returns how many events went; considered
+// gets how many bends and controller changes there were
+size_t thinControlEvents(std::vector<TimelineEvent>& timeline, const Channel* startChannels, const ControlThinning& settings, size_t& considered);
+
+#endif
@@ -0,0 +1,171 @@
+/*******************************************************************
+*   controllerPool.cpp
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module spreads floppy drives across several Arduino controllers,
+// one per entry in SERIAL_PORTS. Drives are numbered globally
+// (controller * DRIVES_PER_CONTROLLER + local drive). Updates are built
+// with the global drive, then routed here: the drive is rewritten to the
+// local one, and the update is batched for its own controller and encoded
+// in the protocol that controller negotiated. Each controller has its own
+// link, writer thread and per-tick batch, so throughput grows with the
+// number of links.
+
+#include "controllerPool.h"
+
+// after READY, wait this long for the rest of
+// a (possibly split-up) v2 announcement
+#define READY_ANNOUNCEMENT_TIMEOUT_MS	(50)
+
+// a whole batch goes out as one send
+static_assert(DRIVES_PER_CONTROLLER * FLOPPY_MAX_MESSAGE_BYTES <= SERIAL_CHUNK_BYTES, "a full packet batch must fit in one serial send");
+static_assert(DRIVES_PER_CONTROLLER <= FLOPPY_V2_MAX_DRIVES, "protocol v2 addresses at most 63 drives per controller");
+
+ControllerPool::ControllerPool() : batches(NUM_CONTROLLERS), encoders(NUM_CONTROLLERS), encoderLocks(NUM_CONTROLLERS), connected(true) {
+	for (size_t i = 0; i < NUM_CONTROLLERS; ++i) {
+		controllers.push_back(new Serial(serialPorts[i]));
+		if (!controllers.back()->isConnected()) {
+			std::cout << "Controller " << i << " failed to connect." << std::endl;
+			connected = false;
+		}
+	}
+}
+
+ControllerPool::~ControllerPool() {
+	// each destructor drains its own link
+	for (size_t i = 0; i < controllers.size(); ++i)
+		delete controllers[i];
+}
+
+bool ControllerPool::isConnected() const {
+	return connected;
+}
+
+bool ControllerPool::waitForReady(const volatile bool& isClosing, const unsigned long usBetweenChecks) {
+	const size_t n = controllers.size();
+	std::vector<uint8_t> announcement(n * FLOPPY_READY_BYTES);
+	std::vector<size_t> received(n, 0);
+	std::vector<std::chrono::steady_clock::time_point> firstByteAt(n);
+	std::vector<bool> ready(n, false);
+	size_t numReady = 0;
+
+	// reads are non-blocking, so one pass polls every
+	// controller and they all calibrate concurrently
+	while (numReady < n) {
+		for (size_t i = 0; i < n; ++i) {
+			if (ready[i])
+				continue;
+
+			uint8_t* const buf = &announcement[i * FLOPPY_READY_BYTES];
+			if (received[i] < FLOPPY_READY_BYTES) {
+				const long long got = controllers[i]->readData(buf + received[i], static_cast<unsigned long>(FLOPPY_READY_BYTES - received[i]));
+				if (got > 0) {
+					if (received[i] == 0)
+						firstByteAt[i] = std::chrono::steady_clock::now();
+					received[i] += static_cast<size_t>(got);
+				}
+			}
+
+			// any READY counts (as v1), but give a v2
+			// announcement the chance to arrive in full
+			if (received[i] == FLOPPY_READY_BYTES || (received[i] > 0 && std::chrono::steady_clock::now() - firstByteAt[i] > std::chrono::milliseconds(READY_ANNOUNCEMENT_TIMEOUT_MS))) {
+				const uint8_t offered = parseFloppyReady(buf, received[i]);
+				uint8_t version = FLOPPY_PROTOCOL_V1;
+				if (offered >= FLOPPY_PROTOCOL_V2) {
+					version = (offered < FLOPPY_PROTOCOL_MAX_VERSION) ? offered : FLOPPY_PROTOCOL_MAX_VERSION;
+					uint8_t select[FLOPPY_MAX_MESSAGE_BYTES];
+					controllers[i]->writeData(select, static_cast<unsigned long>(encodeFloppyVersionSelect(version, select)));
+				}
+				encoders[i].reset(version);
+
+				ready[i] = true;
+				++numReady;
+				std::cout << "Controller " << i << " ready (protocol v" << static_cast<unsigned>(version) << ")." << std::endl;
+			}
+		}
+
+		if (isClosing)
+			return false;
+
+		if (numReady < n)
+			std::this_thread::sleep_for(std::chrono::microseconds(usBetweenChecks));
+	}
+	return true;
+}
+
+FloppyMessage ControllerPool::route(const FloppyMessage& packet, size_t& controller) const {
+	FloppyMessage local = packet;
+	controller = packet.drive / DRIVES_PER_CONTROLLER;
+	local.drive = static_cast<uint8_t>(packet.drive % DRIVES_PER_CONTROLLER);
+	return local;
+}
+
+void ControllerPool::queuePacket(const FloppyMessage& packet) {
+	size_t controller;
+	const FloppyMessage local = route(packet, controller);
+	if (controller < batches.size())
+		batches[controller].add(local);
+}
+
+void ControllerPool::sendPacket(const FloppyMessage& packet) {
+	size_t controller;
+	const FloppyMessage local = route(packet, controller);
+	if (controller < controllers.size()) {
+		std::lock_guard<std::mutex> lock(encoderLocks[controller]);
+		uint8_t bytes[FLOPPY_MAX_MESSAGE_BYTES];
+		const size_t numBytes = encoders[controller].encode(local, bytes);
+		if (numBytes)
+			controllers[controller]->writeData(bytes, static_cast<unsigned long>(numBytes));
+	}
+}
+
+void ControllerPool::flush(const bool mustSend, const int64_t originNs) {
+	for (size_t i = 0; i < controllers.size(); ++i) {
+		PacketBatch& batch = batches[i];
+		if (batch.empty())
+			continue;
+
+		std::lock_guard<std::mutex> lock(encoderLocks[i]);
+
+		// encode against a scratch copy, so a refused send
+		// leaves the encoder in step with the sketch
+		FloppyEncoder encoder = encoders[i];
+		uint8_t bytes[DRIVES_PER_CONTROLLER * FLOPPY_MAX_MESSAGE_BYTES];
+		size_t numBytes = 0;
+		for (size_t j = 0; j < batch.size(); ++j)
+			numBytes += encoder.encode(batch.data()[j], bytes + numBytes);
+
+		if (numBytes) {
+			if (mustSend)
+				controllers[i]->writeData(bytes, static_cast<unsigned long>(numBytes), originNs);
+			else if (!controllers[i]->sendAsync(bytes, static_cast<unsigned long>(numBytes), originNs))
+				continue;
+		}
+
+		encoders[i] = encoder;
+		batch.clear();
+	}
+}
+
+void ControllerPool::resetStats() {
+	for (size_t i = 0; i < controllers.size(); ++i) {
+		controllers[i]->resetStats();
+		batches[i].resetStats();
+	}
+}
+
+void ControllerPool::printStats() const {
+	for (size_t i = 0; i < controllers.size(); ++i) {
+		const SerialStats s = controllers[i]->stats();
+		const PacketBatch& b = batches[i];
+		std::cout << "Controller " << i << " (v" << static_cast<unsigned>(encoders[i].protocolVersion()) << "): " << b.added() << " packets in " << b.flushes() << " batches, " << b.collapsed() << " collapsed; "
+			<< s.bytesWritten << " of " << s.bytesQueued << " bytes written in " << s.writes << " writes, "
+			<< s.rejectedSends << " sends refused (queue full), max queue depth " << s.maxQueueDepth << ", "
+			<< s.wireStalls << " wire stalls, " << s.writeErrors << " errors." << std::endl;
+	}
+}
@@ -0,0 +1,85 @@
+/*******************************************************************
+*   controllerPool.h
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module spreads floppy drives across several Arduino controllers,
+// one per entry in SERIAL_PORTS. Drives are numbered globally
+// (controller * DRIVES_PER_CONTROLLER + local drive). Updates are built
+// with the global drive, then routed here: the drive is rewritten to the
+// local one, and the update is batched for its own controller and encoded
+// in the protocol that controller negotiated. Each controller has its own
+// link, writer thread and per-tick batch, so throughput grows with the
+// number of links.
+
+#ifndef CONTROLLERPOOL_H
+#define CONTROLLERPOOL_H
+
+// drives wired to each Arduino (limited by the firmware)
+#define DRIVES_PER_CONTROLLER			(15)
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "floppyProtocol.h"
+#include "packetBatch.h"
+#include "serial.h"
+
+static const SerialPortName serialPorts[] = SERIAL_PORTS;
+
+#define NUM_CONTROLLERS					(sizeof(serialPorts) / sizeof(serialPorts[0]))
+
+class ControllerPool {
+private:
+	std::vector<Serial*> controllers;
+	std::vector<PacketBatch> batches;
+	std::vector<FloppyEncoder> encoders;
+
+	// per-track threads send to the same controller at once;
+	// each encode and its write must go out together, in order
+	std::vector<std::mutex> encoderLocks;
+	bool connected;
+
+	FloppyMessage route(const FloppyMessage& packet, size_t& controller) const;
+
+public:
+	// connects to every port in SERIAL_PORTS
+	ControllerPool();
+	~ControllerPool();
+
+	// true only if every controller connected
+	bool isConnected() const;
+	size_t size() const { return controllers.size(); }
+
+	// wait for every controller's READY signal at once, and agree on
+	// a protocol version with each. false if isClosing was set first
+	bool waitForReady(const volatile bool& isClosing, const unsigned long usBetweenChecks);
+
+	// add to this tick's batch for the drive's controller
+	void queuePacket(const FloppyMessage& packet);
+
+	// send the drive's controller this update right away
+	void sendPacket(const FloppyMessage& packet);
+
+	// one send per controller with anything queued. unless mustSend,
+	// a controller whose link is backed up keeps its batch for next
+	// tick (latest state per drive still wins). originNs as in
+	// Serial::sendAsync
+	void flush(const bool mustSend, const int64_t originNs = 0);
+
+	void printStats() const;
+
+	// per link and batch, as Serial::resetStats
+	void resetStats();
+};
+
+#endif
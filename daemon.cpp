@@ -0,0 +1,227 @@
+/*******************************************************************
+*   daemon.cpp
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module keeps SongOfTheFloppies running as a player for a
+// watched directory (i.e. for a playlist installation). The floppies
+// are connected and calibrated, and the audio stream is started,
+// once; every MIDI file that shows up in the directory is then
+// played on them in name order, each one as soon as the previous
+// ends. While one song plays, the next is loaded, parsed, analyzed
+// and compiled in the background on a second MIDI object, which is
+// handed the open outputs when its turn comes, so there is no dead
+// air between songs. A file plays again if it is modified.
+// LOG_MIDI_STRUCTURE is ignored here, as songs would overlap in
+// midi_log.txt.
+
+#include "daemon.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <set>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#include "MIDI.h"
+
+// one plays while the other is prepared
+static MIDI songs[2];
+static volatile bool daemonClosing = false;
+
+struct SongFile {
+	std::string path;
+
+	// path, modification time and size: a new key is a new song
+	std::string key;
+};
+
+bool isMidiFileName(const std::string& name) {
+	const size_t dot = name.find_last_of('.');
+	if (dot == std::string::npos)
+		return false;
+
+	std::string ext = name.substr(dot + 1);
+	std::transform(ext.begin(), ext.end(), ext.begin(), [](const unsigned char c) { return static_cast<char>(tolower(c)); });
+	return ext == "mid" || ext == "midi";
+}
+
+// the directory's MIDI files, in name order
+static std::vector<SongFile> listSongs(const std::string& directory) {
+	std::vector<SongFile> found;
+
+#ifdef _WIN32
+	WIN32_FIND_DATAA entry;
+	HANDLE hFind = FindFirstFileA((directory + "\\*").c_str(), &entry);
+	if (hFind == INVALID_HANDLE_VALUE)
+		return found;
+
+	do {
+		if ((entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) || !isMidiFileName(entry.cFileName))
+			continue;
+
+		const std::string path = directory + "\\" + entry.cFileName;
+		const uint64_t modified = (static_cast<uint64_t>(entry.ftLastWriteTime.dwHighDateTime) << 32) | entry.ftLastWriteTime.dwLowDateTime;
+		const uint64_t size = (static_cast<uint64_t>(entry.nFileSizeHigh) << 32) | entry.nFileSizeLow;
+		found.push_back({ path, path + '|' + std::to_string(modified) + '|' + std::to_string(size) });
+	} while (FindNextFileA(hFind, &entry));
+
+	FindClose(hFind);
+#else
+	DIR* dir = opendir(directory.c_str());
+	if (!dir)
+		return found;
+
+	while (const dirent* entry = readdir(dir)) {
+		if (!isMidiFileName(entry->d_name))
+			continue;
+
+		const std::string path = directory + '/' + entry->d_name;
+		struct stat st;
+		if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+			continue;
+
+		found.push_back({ path, path + '|' + std::to_string(static_cast<long long>(st.st_mtime)) + '|' + std::to_string(static_cast<long long>(st.st_size)) });
+	}
+
+	closedir(dir);
+#endif
+
+	std::sort(found.begin(), found.end(), [](const SongFile& a, const SongFile& b) { return a.path < b.path; });
+	return found;
+}
+
+// first song not yet played (or tried)
+static bool nextSong(const std::string& directory, const std::set<std::string>& done, SongFile& song) {
+	for (const SongFile& f : listSongs(directory)) {
+		if (!done.count(f.key)) {
+			song = f;
+			return true;
+		}
+	}
+	return false;
+}
+
+// what main does before playing, minus the MIDI log. runs
+// on the preparing thread, alongside the song playing
+static bool prepareSong(MIDI& midi, const std::string& path) {
+	midi.clearSong();
+	midi.fileName = path;
+
+	if (!midi.loadBinaryFile())
+		return false;
+
+#ifdef USE_COMPILED_SONG_CACHE
+	if (midi.loadCompiledSong())
+		return true;
+#endif
+
+	if (!midi.parseMIDIFile())
+		return false;
+
+	midi.analyzeMidiStructure();
+
+#ifdef USE_COMPILED_SONG_CACHE
+	return midi.compileSong();
+#else
+	return true;
+#endif
+}
+
+int runDaemon(const std::string& directory) {
+	std::cout << "Playing MIDI files from " << directory << " as they appear (Ctrl+C to stop)." << std::endl;
+
+	for (auto&& song : songs)
+		song.keepOutputsOpen = true;
+
+	std::set<std::string> done;
+
+	// holds the open outputs once any song has played
+	MIDI* playing = nullptr;
+
+	// songs[slot] is the one being prepared, from next
+	size_t slot = 0;
+	SongFile next;
+	std::thread preparer;
+	bool preparing = false;
+	bool prepared = false;
+
+	auto startPreparing = [&]() {
+		preparing = nextSong(directory, done, next);
+		if (preparing) {
+			// a broken (or half-copied) file isn't retried until it changes
+			done.insert(next.key);
+			preparer = std::thread([&prepared, &next, slot]() { prepared = prepareSong(songs[slot], next.path); });
+		}
+	};
+
+	int result = EXIT_SUCCESS;
+	while (!daemonClosing) {
+		if (!preparing) {
+			startPreparing();
+			if (!preparing) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(DAEMON_POLL_MS));
+				continue;
+			}
+		}
+
+		preparer.join();
+		preparing = false;
+		if (daemonClosing)
+			break;
+
+		if (!prepared) {
+			std::cout << "Skipping " << next.path << "." << std::endl;
+			continue;
+		}
+
+		MIDI& song = songs[slot];
+		if (playing)
+			playing->handOverOutputs(song);
+		slot ^= 1;
+
+		std::cout << std::endl << "Now playing " << next.path << "." << std::endl;
+
+		// the next song gets ready while this one plays
+		startPreparing();
+
+		song.playMusic();
+		playing = &song;
+
+		if (!song.hasOutputs()) {
+			std::cout << "Failed to open the floppies or audio stream." << std::endl;
+			closeDaemon();
+			result = EXIT_FAILURE;
+		}
+	}
+
+	if (preparing)
+		preparer.join();
+
+	if (playing) {
+		playing->cleanUpAudio();
+		playing->cleanUpMemory();
+	}
+
+	return result;
+}
+
+void closeDaemon() {
+	daemonClosing = true;
+	for (auto&& song : songs)
+		song.isClosing = true;
+}
@@ -0,0 +1,41 @@
+/*******************************************************************
+*   daemon.h
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module keeps SongOfTheFloppies running as a player for a
+// watched directory (i.e. for a playlist installation). The floppies
+// are connected and calibrated, and the audio stream is started,
+// once; every MIDI file that shows up in the directory is then
+// played on them in name order, each one as soon as the previous
+// ends. While one song plays, the next is loaded, parsed, analyzed
+// and compiled in the background on a second MIDI object, which is
+// handed the open outputs when its turn comes, so there is no dead
+// air between songs. A file plays again if it is modified.
+// LOG_MIDI_STRUCTURE is ignored here, as songs would overlap in
+// midi_log.txt.
+
+#ifndef DAEMON_H
+#define DAEMON_H
+
+// how often to look for new songs while idle
+#define DAEMON_POLL_MS					(250)
+
+#include <string>
+
+// play songs from directory until asked to close. returns
+// EXIT_SUCCESS, or EXIT_FAILURE if the outputs can't be opened
+int runDaemon(const std::string& directory);
+
+// from the close handler: stop the song playing (or being
+// prepared) and shut down
+void closeDaemon();
+
+// .mid or .midi, in any case (batch.cpp looks for songs with it too)
+bool isMidiFileName(const std::string& name);
+
+#endif
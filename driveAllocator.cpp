@@ -0,0 +1,249 @@
+/*******************************************************************
+*   driveAllocator.cpp
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module hands out floppy drives to sounding notes, as
+// VoiceAllocator does sine voices. Each channel owns a pool: a
+// contiguous run of drives, sized from the channel's peak polyphony
+// when the song is analyzed and handed out from a shared atomic
+// counter (at the channel's first note, if drives are assigned
+// sequentially). Which drives are sounding is one busy bitmask over
+// all drives, claimed and freed with atomic fetch_or/fetch_and, and
+// each drive records which channel/note owns it in an atomic, so
+// playback threads never need a lock. Within a pool, drives are
+// taken round-robin from just past the last one used, to spread the
+// wear across the stepper motors; when every drive in the pool is
+// sounding, the oldest note gives its drive up to the new one (with
+// a pool of one drive, exactly the old single-drive-per-channel
+// behavior).
+
+#include "driveAllocator.h"
+
+static inline uint64_t driveBit(const uint8_t drive) {
+	return 1ULL << (drive & 63);
+}
+
+DriveAllocator::DriveAllocator() {
+	reset(0);
+}
+
+void DriveAllocator::reset(const uint32_t totalDrives) {
+	maxDrives = (totalDrives < DRIVE_ALLOCATOR_MAX_DRIVES) ? totalDrives : DRIVE_ALLOCATOR_MAX_DRIVES;
+	for (size_t i = 0; i < DRIVE_POOLS; ++i)
+		planned[i] = 0;
+
+	clearPools();
+	releaseAll();
+}
+
+void DriveAllocator::plan(const uint8_t peak[DRIVE_POOLS], const uint8_t* order, const size_t numOrdered, const bool shareSpares) {
+	for (size_t i = 0; i < DRIVE_POOLS; ++i)
+		planned[i] = 0;
+
+	uint32_t left = maxDrives;
+	for (size_t k = 0; k < numOrdered && left; ++k) {
+		planned[order[k]] = 1;
+		--left;
+	}
+
+	// then one more each, in turn, up to each channel's polyphony
+	bool grew = true;
+	while (left && grew) {
+		grew = false;
+		for (size_t k = 0; k < numOrdered && left; ++k) {
+			const uint8_t c = order[k];
+			if (planned[c] && planned[c] < peak[c]) {
+				++planned[c];
+				--left;
+				grew = true;
+			}
+		}
+	}
+
+	// whatever is still left only spreads the wear
+	grew = shareSpares;
+	while (left && grew) {
+		grew = false;
+		for (size_t k = 0; k < numOrdered && left; ++k) {
+			const uint8_t c = order[k];
+			if (planned[c] && planned[c] < DRIVE_ALLOCATOR_MAX_DRIVES) {
+				++planned[c];
+				--left;
+				grew = true;
+			}
+		}
+	}
+}
+
+void DriveAllocator::planEvenly(const uint8_t drivesPerPool) {
+	for (size_t i = 0; i < DRIVE_POOLS; ++i)
+		planned[i] = drivesPerPool;
+}
+
+bool DriveAllocator::assignPool(const size_t chan) {
+	const size_t pool = chan - 1;
+	if (size[pool].load(std::memory_order_relaxed))
+		return true;
+
+	// a channel the plan left out still gets a drive if one is left
+	const uint32_t want = planned[pool] ? planned[pool] : 1;
+
+	uint32_t start = assigned.load(std::memory_order_relaxed);
+	uint32_t n;
+	do {
+		n = (maxDrives - start < want) ? maxDrives - start : want;
+		if (n == 0)
+			return false;
+	} while (!assigned.compare_exchange_weak(start, start + n, std::memory_order_acq_rel, std::memory_order_relaxed));
+
+	first[pool].store(static_cast<uint8_t>(start), std::memory_order_relaxed);
+	cursor[pool].store(0, std::memory_order_relaxed);
+	size[pool].store(static_cast<uint8_t>(n), std::memory_order_release);
+	return true;
+}
+
+void DriveAllocator::restorePool(const size_t chan, const uint8_t firstDrive, const uint8_t numDrives) {
+	const size_t pool = chan - 1;
+	first[pool].store(firstDrive, std::memory_order_relaxed);
+	cursor[pool].store(0, std::memory_order_relaxed);
+	size[pool].store(numDrives, std::memory_order_release);
+
+	const uint32_t end = static_cast<uint32_t>(firstDrive) + numDrives;
+	if (numDrives && end > assigned.load(std::memory_order_relaxed))
+		assigned.store(end, std::memory_order_release);
+}
+
+void DriveAllocator::clearPools() {
+	for (size_t i = 0; i < DRIVE_POOLS; ++i) {
+		first[i].store(0, std::memory_order_relaxed);
+		size[i].store(0, std::memory_order_relaxed);
+		cursor[i].store(0, std::memory_order_relaxed);
+	}
+	assigned.store(0, std::memory_order_release);
+}
+
+void DriveAllocator::releaseAll() {
+	for (size_t i = 0; i < DRIVE_ALLOCATOR_MAX_DRIVES; ++i) {
+		owner[i].store(VOICE_FREE, std::memory_order_relaxed);
+		startedAt[i].store(0, std::memory_order_relaxed);
+	}
+	for (size_t i = 0; i < DRIVE_POOLS; ++i)
+		cursor[i].store(0, std::memory_order_relaxed);
+
+	sequence.store(0, std::memory_order_relaxed);
+	numAllocations.store(0, std::memory_order_relaxed);
+	numSteals.store(0, std::memory_order_relaxed);
+	numDrops.store(0, std::memory_order_relaxed);
+	for (size_t w = 0; w < DRIVE_MASK_WORDS; ++w)
+		busy[w].store(0, std::memory_order_release);
+}
+
+// true if this call set the drive's busy bit
+bool DriveAllocator::tryClaim(const uint8_t drive) {
+	return (busy[drive >> 6].fetch_or(driveBit(drive), std::memory_order_acq_rel) & driveBit(drive)) == 0;
+}
+
+void DriveAllocator::claim(const uint8_t drive) {
+	startedAt[drive].store(sequence.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+	numAllocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+// first idle drive at or after the cursor, wrapping around the pool,
+// a word of the busy mask at a time
+uint8_t DriveAllocator::findFree(const size_t pool) const {
+	const uint32_t lo = first[pool].load(std::memory_order_relaxed);
+	const uint32_t hi = lo + size[pool].load(std::memory_order_relaxed);
+	const uint32_t from = lo + cursor[pool].load(std::memory_order_relaxed);
+
+	const uint32_t ranges[2][2] = { { from, hi }, { lo, from } };
+	for (const auto& r : ranges) {
+		for (uint32_t base = r[0] & ~63u; base < r[1]; base += 64) {
+			uint64_t idle = ~busy[base >> 6].load(std::memory_order_acquire);
+			if (r[0] > base)
+				idle &= ~0ULL << (r[0] - base);
+			if (r[1] - base < 64)
+				idle &= (1ULL << (r[1] - base)) - 1;
+			if (idle)
+				return static_cast<uint8_t>(base + lowestBit(idle));
+		}
+	}
+	return NO_DRIVE;
+}
+
+// the pool's longest-sounding note (last note wins, as one drive
+// per channel always behaved)
+uint8_t DriveAllocator::chooseVictim(const size_t pool) const {
+	const uint32_t lo = first[pool].load(std::memory_order_relaxed);
+	const uint32_t hi = lo + size[pool].load(std::memory_order_relaxed);
+
+	uint8_t best = NO_DRIVE;
+	uint64_t oldest = UINT64_MAX;
+	for (uint32_t d = lo; d < hi; ++d) {
+		if (owner[d].load(std::memory_order_relaxed) == VOICE_FREE)
+			continue;
+		const uint64_t t = startedAt[d].load(std::memory_order_relaxed);
+		if (t < oldest) {
+			oldest = t;
+			best = static_cast<uint8_t>(d);
+		}
+	}
+	return best;
+}
+
+uint8_t DriveAllocator::allocate(const size_t chan, const uint32_t newOwner, uint32_t& stolenFrom) {
+	stolenFrom = VOICE_FREE;
+
+	const size_t pool = chan - 1;
+	const uint8_t n = size[pool].load(std::memory_order_acquire);
+	if (n == 0)
+		return NO_DRIVE;
+
+	// another thread can only get in the way at the edges
+	// (i.e. while a drive is half released), so retry a few times
+	for (int attempt = 0; attempt < 4; ++attempt) {
+		uint8_t drive = findFree(pool);
+		if (drive != NO_DRIVE) {
+			if (!tryClaim(drive))
+				continue;
+			owner[drive].store(newOwner, std::memory_order_release);
+		}
+		else {
+			drive = chooseVictim(pool);
+			if (drive == NO_DRIVE)
+				continue;
+
+			uint32_t victim = owner[drive].load(std::memory_order_acquire);
+			if (victim == VOICE_FREE || !owner[drive].compare_exchange_strong(victim, newOwner, std::memory_order_acq_rel))
+				continue;
+			stolenFrom = victim;
+			numSteals.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		claim(drive);
+
+		// next note starts looking just past this drive
+		const uint8_t next = static_cast<uint8_t>(drive - first[pool].load(std::memory_order_relaxed) + 1);
+		cursor[pool].store((next < n) ? next : 0, std::memory_order_relaxed);
+		return drive;
+	}
+
+	numDrops.fetch_add(1, std::memory_order_relaxed);
+	return NO_DRIVE;
+}
+
+bool DriveAllocator::release(const uint8_t drive, const uint32_t currentOwner) {
+	if (drive >= DRIVE_ALLOCATOR_MAX_DRIVES)
+		return false;
+
+	uint32_t expected = currentOwner;
+	if (!owner[drive].compare_exchange_strong(expected, VOICE_FREE, std::memory_order_acq_rel))
+		return false;
+
+	busy[drive >> 6].fetch_and(~driveBit(drive), std::memory_order_release);
+	return true;
+}
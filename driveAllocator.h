@@ -0,0 +1,144 @@
+/*******************************************************************
+*   driveAllocator.h
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module hands out floppy drives to sounding notes, as
+// VoiceAllocator does sine voices. Each channel owns a pool: a
+// contiguous run of drives, sized from the channel's peak polyphony
+// when the song is analyzed and handed out from a shared atomic
+// counter (at the channel's first note, if drives are assigned
+// sequentially). Which drives are sounding is one busy bitmask over
+// all drives, claimed and freed with atomic fetch_or/fetch_and, and
+// each drive records which channel/note owns it in an atomic, so
+// playback threads never need a lock. Within a pool, drives are
+// taken round-robin from just past the last one used, to spread the
+// wear across the stepper motors; when every drive in the pool is
+// sounding, the oldest note gives its drive up to the new one (with
+// a pool of one drive, exactly the old single-drive-per-channel
+// behavior).
+
+#ifndef DRIVEALLOCATOR_H
+#define DRIVEALLOCATOR_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "voiceAllocator.h"
+
+// drive numbers are a byte, and NO_DRIVE is never a drive
+#define DRIVE_ALLOCATOR_MAX_DRIVES		(255)
+#define DRIVE_MASK_WORDS				((DRIVE_ALLOCATOR_MAX_DRIVES + 63) / 64)
+
+// one pool per MIDI channel
+#define DRIVE_POOLS						(16)
+
+#define NO_DRIVE						(255)
+
+// index of the lowest set bit. v must be nonzero
+inline unsigned lowestBit(const uint64_t v) {
+#ifdef _MSC_VER
+	unsigned long idx;
+	_BitScanForward64(&idx, v);
+	return static_cast<unsigned>(idx);
+#else
+	return static_cast<unsigned>(__builtin_ctzll(v));
+#endif
+}
+
+class DriveAllocator {
+private:
+	std::atomic<uint64_t> busy[DRIVE_MASK_WORDS];
+
+	// voiceOwner() tag of each drive's note, or VOICE_FREE
+	std::atomic<uint32_t> owner[DRIVE_ALLOCATOR_MAX_DRIVES];
+	std::atomic<uint64_t> startedAt[DRIVE_ALLOCATOR_MAX_DRIVES];
+
+	// pools (channels are 1-based; pool i is channel i + 1)
+	uint8_t planned[DRIVE_POOLS];
+	std::atomic<uint8_t> first[DRIVE_POOLS];
+	std::atomic<uint8_t> size[DRIVE_POOLS];
+
+	// offset in the pool to start looking from
+	std::atomic<uint8_t> cursor[DRIVE_POOLS];
+
+	std::atomic<uint32_t> assigned;
+	uint32_t maxDrives;
+
+	std::atomic<uint64_t> sequence;
+	std::atomic<uint64_t> numAllocations, numSteals, numDrops;
+
+	bool tryClaim(const uint8_t drive);
+	void claim(const uint8_t drive);
+	uint8_t findFree(const size_t pool) const;
+	uint8_t chooseVictim(const size_t pool) const;
+
+public:
+	DriveAllocator();
+
+	// no pools and no plan, totalDrives drives to hand out.
+	// not safe while others are allocating
+	void reset(const uint32_t totalDrives);
+
+	// size each pool before assigning any. peak[i] is the most notes
+	// channel i + 1 ever sounds at once (0 if it never plays), order
+	// the channels in the order pools should be handed out. every
+	// playing channel gets one drive while there are enough; spare
+	// drives then go round-robin to the channels that can use them
+	// (and, with shareSpares, to every pool)
+	void plan(const uint8_t peak[DRIVE_POOLS], const uint8_t* order, const size_t numOrdered, const bool shareSpares);
+
+	// every pool the same size, for channels that aren't known
+	// until they play (i.e. live input)
+	void planEvenly(const uint8_t drivesPerPool);
+
+	// give chan its planned pool out of the drives not yet assigned
+	// (fewer if not enough are left). false if it got none
+	bool assignPool(const size_t chan);
+
+	// put back a pool as it was (i.e. from a compiled song)
+	void restorePool(const size_t chan, const uint8_t firstDrive, const uint8_t numDrives);
+
+	// drop every pool, keeping the plan
+	void clearPools();
+
+	// every drive silent. pools are kept
+	void releaseAll();
+
+	// drive for newOwner out of chan's pool, or NO_DRIVE if chan
+	// has no pool. if a sounding drive had to be taken over,
+	// stolenFrom gets its previous owner, else VOICE_FREE
+	uint8_t allocate(const size_t chan, const uint32_t newOwner, uint32_t& stolenFrom);
+
+	// false if the drive no longer belongs to currentOwner
+	// (the pool took it for a newer note in the meantime)
+	bool release(const uint8_t drive, const uint32_t currentOwner);
+
+	bool owns(const uint8_t drive, const uint32_t currentOwner) const {
+		return drive < DRIVE_ALLOCATOR_MAX_DRIVES && owner[drive].load(std::memory_order_acquire) == currentOwner;
+	}
+
+	uint32_t ownerOf(const uint8_t drive) const { return owner[drive].load(std::memory_order_acquire); }
+
+	uint8_t poolFirst(const size_t chan) const { return first[chan - 1].load(std::memory_order_relaxed); }
+	uint8_t poolSize(const size_t chan) const { return size[chan - 1].load(std::memory_order_relaxed); }
+	uint8_t plannedSize(const size_t chan) const { return planned[chan - 1]; }
+
+	// drives handed to pools so far
+	uint32_t drivesAssigned() const { return assigned.load(std::memory_order_acquire); }
+
+	uint64_t allocations() const { return numAllocations.load(std::memory_order_relaxed); }
+	uint64_t steals() const { return numSteals.load(std::memory_order_relaxed); }
+	uint64_t drops() const { return numDrops.load(std::memory_order_relaxed); }
+};
+
+#endif
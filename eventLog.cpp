@@ -0,0 +1,219 @@
+/*******************************************************************
+*   eventLog.cpp
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module keeps LOG_NOTES output off the playback path. The
+// scheduler (or track threads) push fixed-size binary records
+// (timestamp, kind, channel, note, value, drive, voice) into a
+// lock-free ring: no formatting, allocation, locks or console I/O.
+// A background thread pops them, formats each as the line that
+// used to be printed directly, prefixed with its time since
+// playback launched, and writes it out. If the writer ever falls
+// a whole ring behind, records are dropped (and counted) rather
+// than ever making playback wait.
+
+#include "eventLog.h"
+
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "MIDI.h"
+
+EventLog playbackLog;
+
+EventLog::EventLog() : running(false), dropped(0), originNs(0) {}
+
+EventLog::~EventLog() {
+	stop();
+}
+
+void EventLog::start() {
+	if (writer.joinable())
+		return;
+
+	originNs = latencyClockNs();
+	dropped.store(0, std::memory_order_relaxed);
+	running.store(true, std::memory_order_release);
+	writer = std::thread(&EventLog::drain, this);
+}
+
+void EventLog::stop() {
+	if (!writer.joinable())
+		return;
+
+	running.store(false, std::memory_order_release);
+	writer.join();
+
+	const uint64_t lost = dropped.load(std::memory_order_relaxed);
+	if (lost)
+		std::cout << "Event log: " << lost << " records dropped (ring full)." << std::endl;
+}
+
+// outside start()/stop() (i.e. while compiling a song) records are discarded
+void EventLog::push(PlaybackEvent& evt) {
+	if (!running.load(std::memory_order_relaxed))
+		return;
+
+	evt.timeNs = latencyClockNs();
+	if (!ring.push(evt))
+		dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+void EventLog::drain() {
+	std::ostringstream line;
+	PlaybackEvent evt;
+
+	for (;;) {
+		// read the flag first so nothing pushed before stop() is missed
+		const bool stopping = !running.load(std::memory_order_acquire);
+
+		bool wrote = false;
+		while (ring.pop(evt)) {
+			line.str(std::string());
+			write(evt, line);
+			const std::string& s = line.str();
+			fwrite(s.data(), 1, s.size(), stdout);
+			wrote = true;
+		}
+
+		if (wrote)
+			fflush(stdout);
+		if (stopping)
+			return;
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(EVENT_LOG_IDLE_MS));
+	}
+}
+
+void EventLog::write(const PlaybackEvent& evt, std::ostream& out) const {
+	out << '[' << std::fixed << std::setprecision(6) << static_cast<double>(evt.timeNs - originNs) / 1e9 << "] " << std::defaultfloat;
+
+	const unsigned channel = evt.channel;
+	switch (evt.kind) {
+	case PLAYBACK_NOTE_ON:
+	case PLAYBACK_NOTE_OFF: {
+		MTrkEvent note = {};
+		note.byte1 = evt.note;
+		note.byte2 = evt.value;
+		out << "Channel " << channel << ((evt.kind == PLAYBACK_NOTE_ON) ? " Note ON: " : " Note OFF: ");
+		extractNote(note, out);
+		if (evt.drive != EVENT_LOG_NO_DRIVE)
+			out << ", Drive " << static_cast<unsigned>(evt.drive);
+		break;
+	}
+	case PLAYBACK_VOICE_STOLEN:
+		out << "Voice " << evt.voice << " stolen from channel " << channel << " note " << static_cast<unsigned>(evt.note);
+		break;
+	case PLAYBACK_EXPRESSION:
+		out << "Channel " << channel << " Expression Change: " << static_cast<unsigned>(evt.value);
+		break;
+	case PLAYBACK_VOLUME:
+		out << "Channel " << channel << " Master Volume: " << static_cast<unsigned>(evt.value);
+		break;
+	case PLAYBACK_PITCH_BEND:
+		out << "Channel " << channel << " Pitch BEND! x" << evt.bendFactor;
+		break;
+	case PLAYBACK_TEXT:
+	case PLAYBACK_LYRIC:
+		out << ((evt.kind == PLAYBACK_TEXT) ? "Text: " : "Lyric: ");
+		out.write(evt.text, static_cast<std::streamsize>(evt.number));
+		break;
+	case PLAYBACK_TEMPO:
+		out << "New Tempo: " << evt.number << " microsec per quarter note";
+		break;
+	case PLAYBACK_END_OF_TRACK:
+		out << "End of Track " << evt.voice << ", elapsed time: " << static_cast<double>(evt.number) / MICROSECONDS_PER_SECOND << " sec";
+		break;
+	case PLAYBACK_FLOPPY:
+		out << "Drive " << static_cast<unsigned>(evt.drive);
+		if (evt.value == FLOPPY_NOTE_OFF)
+			out << " Note OFF";
+		else
+			out << ((evt.value == FLOPPY_NOTE_ON) ? " Note ON: " : " Update: ") << static_cast<unsigned>(evt.note) << ", " << evt.bendCents << " cents";
+		break;
+	}
+	out << '\n';
+}
+
+void EventLog::note(const PlaybackEventKind kind, const size_t channel, const uint8_t note, const uint8_t velocity, const uint8_t drive) {
+	PlaybackEvent evt = {};
+	evt.kind = kind;
+	evt.channel = static_cast<uint8_t>(channel);
+	evt.note = note;
+	evt.value = velocity;
+	evt.drive = drive;
+	push(evt);
+}
+
+void EventLog::voiceStolen(const uint16_t voice, const uint32_t fromChannel, const uint8_t fromNote) {
+	PlaybackEvent evt = {};
+	evt.kind = PLAYBACK_VOICE_STOLEN;
+	evt.voice = voice;
+	evt.channel = static_cast<uint8_t>(fromChannel);
+	evt.note = fromNote;
+	evt.drive = EVENT_LOG_NO_DRIVE;
+	push(evt);
+}
+
+void EventLog::controller(const PlaybackEventKind kind, const size_t channel, const uint8_t value) {
+	PlaybackEvent evt = {};
+	evt.kind = kind;
+	evt.channel = static_cast<uint8_t>(channel);
+	evt.value = value;
+	evt.drive = EVENT_LOG_NO_DRIVE;
+	push(evt);
+}
+
+void EventLog::pitchBend(const size_t channel, const double bendFactor) {
+	PlaybackEvent evt = {};
+	evt.kind = PLAYBACK_PITCH_BEND;
+	evt.channel = static_cast<uint8_t>(channel);
+	evt.bendFactor = bendFactor;
+	evt.drive = EVENT_LOG_NO_DRIVE;
+	push(evt);
+}
+
+void EventLog::text(const PlaybackEventKind kind, const char* text, const size_t length) {
+	PlaybackEvent evt = {};
+	evt.kind = kind;
+	evt.text = text;
+	evt.number = length;
+	evt.drive = EVENT_LOG_NO_DRIVE;
+	push(evt);
+}
+
+void EventLog::tempo(const uint64_t usecPerQtrNote) {
+	PlaybackEvent evt = {};
+	evt.kind = PLAYBACK_TEMPO;
+	evt.number = usecPerQtrNote;
+	evt.drive = EVENT_LOG_NO_DRIVE;
+	push(evt);
+}
+
+void EventLog::endOfTrack(const size_t track, const uint64_t elapsedUsec) {
+	PlaybackEvent evt = {};
+	evt.kind = PLAYBACK_END_OF_TRACK;
+	evt.voice = static_cast<uint16_t>(track);
+	evt.number = elapsedUsec;
+	evt.drive = EVENT_LOG_NO_DRIVE;
+	push(evt);
+}
+
+void EventLog::floppy(const FloppyMessage& msg) {
+	PlaybackEvent evt = {};
+	evt.kind = PLAYBACK_FLOPPY;
+	evt.value = msg.type;
+	evt.note = msg.note;
+	evt.drive = msg.drive;
+	evt.bendCents = msg.bendCents;
+	push(evt);
+}
@@ -0,0 +1,126 @@
+/*******************************************************************
+*   eventLog.h
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module keeps LOG_NOTES output off the playback path. The
+// scheduler (or track threads) push fixed-size binary records
+// (timestamp, kind, channel, note, value, drive, voice) into a
+// lock-free ring: no formatting, allocation, locks or console I/O.
+// A background thread pops them, formats each as the line that
+// used to be printed directly, prefixed with its time since
+// playback launched, and writes it out. If the writer ever falls
+// a whole ring behind, records are dropped (and counted) rather
+// than ever making playback wait.
+
+#ifndef EVENTLOG_H
+#define EVENTLOG_H
+
+// records in flight. must be a power of 2
+#define EVENT_LOG_QUEUE_SIZE			(8192)
+
+// writer's sleep when the ring is empty
+#define EVENT_LOG_IDLE_MS				(10)
+
+// drive field of a record with no floppy
+#define EVENT_LOG_NO_DRIVE				(255)
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <thread>
+
+#include "floppyProtocol.h"
+#include "latencyHistogram.h"
+#include "lockFreeQueue.h"
+
+enum PlaybackEventKind : uint8_t {
+	PLAYBACK_NOTE_ON,
+	PLAYBACK_NOTE_OFF,
+	PLAYBACK_VOICE_STOLEN,
+	PLAYBACK_EXPRESSION,
+	PLAYBACK_VOLUME,
+	PLAYBACK_PITCH_BEND,
+	PLAYBACK_TEXT,
+	PLAYBACK_LYRIC,
+	PLAYBACK_TEMPO,
+	PLAYBACK_END_OF_TRACK,
+
+	// a compiled song's packet (it has no channel events to log)
+	PLAYBACK_FLOPPY
+};
+
+struct PlaybackEvent {
+	// latencyClockNs() when pushed
+	int64_t timeNs;
+
+	// text and lyrics point into the song, which outlives the log
+	const char* text;
+
+	union {
+		double bendFactor;
+		int64_t bendCents;
+
+		// text length, usec per quarter note, or track elapsed usec
+		uint64_t number;
+	};
+
+	// voice (or track, for end of track)
+	uint16_t voice;
+	PlaybackEventKind kind;
+	uint8_t channel;
+	uint8_t note;
+
+	// velocity, expression, volume or FloppyMessageType
+	uint8_t value;
+	uint8_t drive;
+};
+
+class EventLog {
+private:
+	LockFreeQueue<PlaybackEvent, EVENT_LOG_QUEUE_SIZE> ring;
+
+	std::thread writer;
+	std::atomic<bool> running;
+	std::atomic<uint64_t> dropped;
+	int64_t originNs;
+
+	void push(PlaybackEvent& evt);
+
+	// writer thread only
+	void drain();
+	void write(const PlaybackEvent& evt, std::ostream& out) const;
+
+public:
+	EventLog();
+	~EventLog();
+
+	EventLog(const EventLog&) = delete;
+	EventLog& operator=(const EventLog&) = delete;
+
+	// launch the writer. times are printed relative to this
+	void start();
+
+	// write out everything pushed so far, then stop the writer
+	void stop();
+
+	// any thread. never blocks
+	void note(const PlaybackEventKind kind, const size_t channel, const uint8_t note, const uint8_t velocity, const uint8_t drive);
+	void voiceStolen(const uint16_t voice, const uint32_t fromChannel, const uint8_t fromNote);
+	void controller(const PlaybackEventKind kind, const size_t channel, const uint8_t value);
+	void pitchBend(const size_t channel, const double bendFactor);
+	void text(const PlaybackEventKind kind, const char* text, const size_t length);
+	void tempo(const uint64_t usecPerQtrNote);
+	void endOfTrack(const size_t track, const uint64_t elapsedUsec);
+	void floppy(const FloppyMessage& msg);
+};
+
+// the LOG_NOTES log for playback and offline renders
+extern EventLog playbackLog;
+
+#endif
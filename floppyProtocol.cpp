@@ -0,0 +1,125 @@
+/*******************************************************************
+*   floppyProtocol.cpp
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module turns floppy drive updates into bytes on the wire.
+// Updates are kept in a version-independent form (FloppyMessage) all
+// the way through batching and the compiled song cache, and are only
+// encoded per controller at send time, in whichever protocol that
+// controller negotiated during the READY handshake.
+// (see floppyProtocol.h for the wire formats)
+
+#include "floppyProtocol.h"
+
+static_assert(sizeof(FloppyMessage) == 12, "FloppyMessage must be 12 bytes");
+
+FloppyEncoder::FloppyEncoder() {
+	reset(FLOPPY_PROTOCOL_V1);
+}
+
+// everything stopped, unbent (as after a sketch reset)
+void FloppyEncoder::reset(const uint8_t newVersion) {
+	version = newVersion;
+	for (size_t i = 0; i < FLOPPY_ENCODER_DRIVES; ++i) {
+		bendCents[i] = 0;
+		note[i] = 0;
+		playing[i] = false;
+	}
+}
+
+size_t FloppyEncoder::encodeBend(const uint8_t drive, const int16_t cents, uint8_t* out) {
+	const int delta = static_cast<int>(cents) - static_cast<int>(bendCents[drive]);
+	bendCents[drive] = cents;
+
+	if (delta == 0)
+		return 0;
+
+	if (delta >= -128 && delta <= 127) {
+		out[0] = FLOPPY_V2_OP_BEND_DELTA | drive;
+		out[1] = static_cast<uint8_t>(static_cast<int8_t>(delta));
+		return 2;
+	}
+
+	const uint16_t abs = static_cast<uint16_t>(cents);
+	out[0] = FLOPPY_V2_OP_EXTENDED | drive;
+	out[1] = FLOPPY_V2_SUB_BEND_ABSOLUTE;
+	out[2] = static_cast<uint8_t>(abs & 0xFF);
+	out[3] = static_cast<uint8_t>(abs >> 8);
+	return 4;
+}
+
+size_t FloppyEncoder::encode(const FloppyMessage& msg, uint8_t* out) {
+	if (version < FLOPPY_PROTOCOL_V2) {
+		// native little-endian uint32, as always
+		const uint32_t packet = static_cast<uint32_t>(msg.drive) + ((msg.type == FLOPPY_NOTE_OFF) ? 0 : (msg.freq << 8));
+		out[0] = static_cast<uint8_t>(packet);
+		out[1] = static_cast<uint8_t>(packet >> 8);
+		out[2] = static_cast<uint8_t>(packet >> 16);
+		out[3] = static_cast<uint8_t>(packet >> 24);
+		return 4;
+	}
+
+	const uint8_t drive = msg.drive;
+	if (drive >= FLOPPY_V2_MAX_DRIVES)
+		return 0;
+
+	if (msg.type == FLOPPY_NOTE_OFF) {
+		playing[drive] = false;
+		out[0] = FLOPPY_V2_OP_NOTE_OFF | drive;
+		return 1;
+	}
+
+	// bend first so the note starts at the right pitch
+	size_t n = encodeBend(drive, msg.bendCents, out);
+
+	if (msg.type == FLOPPY_NOTE_ON || !playing[drive] || note[drive] != msg.note) {
+		playing[drive] = true;
+		note[drive] = msg.note;
+		out[n++] = FLOPPY_V2_OP_NOTE_ON | drive;
+		out[n++] = msg.note;
+	}
+
+	return n;
+}
+
+uint8_t parseFloppyReady(const uint8_t* bytes, const size_t numBytes) {
+	if (numBytes == FLOPPY_READY_BYTES && bytes[0] == 'S' && bytes[1] == 'F' && bytes[2] == 'P' && bytes[3] >= FLOPPY_PROTOCOL_V2)
+		return bytes[3];
+	return FLOPPY_PROTOCOL_V1;
+}
+
+size_t encodeFloppyVersionSelect(const uint8_t version, uint8_t* out) {
+	out[0] = FLOPPY_V2_OP_EXTENDED | FLOPPY_V2_CONTROL_DRIVE;
+	out[1] = FLOPPY_V2_SUB_SELECT_VERSION;
+	out[2] = version;
+	return 3;
+}
+
+size_t floppyMessageLength(const uint8_t version, const uint8_t* bytes, const size_t numBytes) {
+	if (version < FLOPPY_PROTOCOL_V2)
+		return 4;
+
+	switch (bytes[0] & FLOPPY_V2_OP_EXTENDED) {
+	case FLOPPY_V2_OP_NOTE_OFF:
+		return 1;
+	case FLOPPY_V2_OP_NOTE_ON:
+	case FLOPPY_V2_OP_BEND_DELTA:
+		return 2;
+	default:
+		if (numBytes < 2)
+			return 0;
+
+		// an unknown sub can't be skipped exactly; take
+		// just the 2 bytes so the stream can resync
+		if (bytes[1] == FLOPPY_V2_SUB_SELECT_VERSION)
+			return 3;
+		if (bytes[1] == FLOPPY_V2_SUB_BEND_ABSOLUTE)
+			return 4;
+		return 2;
+	}
+}
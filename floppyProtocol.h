@@ -0,0 +1,125 @@
+/*******************************************************************
+*   floppyProtocol.h
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module turns floppy drive updates into bytes on the wire.
+// Updates are kept in a version-independent form (FloppyMessage) all
+// the way through batching and the compiled song cache, and are only
+// encoded per controller at send time, in whichever protocol that
+// controller negotiated during the READY handshake:
+//
+// v1 (any sketch): 4 bytes per update, drive id in the low byte and
+// (frequency * FREQ_MULTIPLIER) in the upper 24 bits. 0 = stop.
+//
+// v2 (sketch announces it): the first byte carries an opcode in its
+// top 2 bits and the local drive (0-62) in its low 6 bits:
+//   00 dddddd                  note off (1 byte)
+//   01 dddddd  nnnnnnnn        note on, by (already octave-clamped)
+//                              MIDI note number (2 bytes)
+//   10 dddddd  cccccccc        pitch bend by a signed 8-bit number of
+//                              cents relative to the drive's current
+//                              bend (2 bytes)
+//   11 dddddd  ssssssss ...    extended:
+//                              sub 0x01: absolute bend, int16 cents,
+//                              little-endian (4 bytes)
+// The drive keeps its bend across notes, as a MIDI channel does, and
+// plays noteFreq(note) * 2^(bend / 1200). Since only changes are sent,
+// a refresh that doesn't change the pitch costs nothing.
+//
+// Handshake: a v1 sketch sends anything as READY. A v2+ sketch sends
+// the 4 bytes 'S' 'F' 'P' <highest version it speaks>, then waits for
+// the host's choice: 11 111111, sub 0x00, <version> (3 bytes).
+
+#ifndef FLOPPYPROTOCOL_H
+#define FLOPPYPROTOCOL_H
+
+// highest protocol to offer a sketch that supports more than v1
+#define FLOPPY_PROTOCOL_MAX_VERSION		(2)
+
+#define FLOPPY_PROTOCOL_V1				(1)
+#define FLOPPY_PROTOCOL_V2				(2)
+
+#define FLOPPY_V2_OP_NOTE_OFF			(0x00)
+#define FLOPPY_V2_OP_NOTE_ON			(0x40)
+#define FLOPPY_V2_OP_BEND_DELTA			(0x80)
+#define FLOPPY_V2_OP_EXTENDED			(0xC0)
+#define FLOPPY_V2_SUB_SELECT_VERSION	(0x00)
+#define FLOPPY_V2_SUB_BEND_ABSOLUTE		(0x01)
+#define FLOPPY_V2_CONTROL_DRIVE			(0x3F)
+#define FLOPPY_V2_MAX_DRIVES			(63)
+
+// most bytes a single update can encode to (bend + note on)
+#define FLOPPY_MAX_MESSAGE_BYTES		(6)
+
+// local drives a controller can have
+#define FLOPPY_ENCODER_DRIVES			(64)
+
+#define FLOPPY_READY_BYTES				(4)
+
+#include <cstddef>
+#include <cstdint>
+
+enum FloppyMessageType : uint8_t {
+	FLOPPY_NOTE_OFF,
+
+	// a new note (re-articulated even if the pitch is unchanged)
+	FLOPPY_NOTE_ON,
+
+	// same note, pitch may have changed (i.e. bend or volume refresh)
+	FLOPPY_UPDATE
+};
+
+struct FloppyMessage {
+	// v1 fixed-point frequency, computed exactly as before
+	uint32_t freq;
+
+	int16_t bendCents;
+	uint8_t note;
+
+	// global drive until routed to a controller, local after
+	uint8_t drive;
+
+	FloppyMessageType type;
+	uint8_t pad[3];
+};
+
+class FloppyEncoder {
+private:
+	uint8_t version;
+
+	// what the sketch currently has, per local drive
+	// (v2 only: deltas are taken against it)
+	int16_t bendCents[FLOPPY_ENCODER_DRIVES];
+	uint8_t note[FLOPPY_ENCODER_DRIVES];
+	bool playing[FLOPPY_ENCODER_DRIVES];
+
+	size_t encodeBend(const uint8_t drive, const int16_t cents, uint8_t* out);
+
+public:
+	FloppyEncoder();
+
+	void reset(const uint8_t newVersion);
+	uint8_t protocolVersion() const { return version; }
+
+	// append msg's bytes to out (at least FLOPPY_MAX_MESSAGE_BYTES free).
+	// returns bytes written, possibly 0 if nothing changed
+	size_t encode(const FloppyMessage& msg, uint8_t* out);
+};
+
+// versions a READY announcement offers (FLOPPY_PROTOCOL_V1 unless
+// it is a full 'S' 'F' 'P' <version> announcement)
+uint8_t parseFloppyReady(const uint8_t* bytes, const size_t numBytes);
+
+// host's reply to a v2+ announcement. returns bytes written
+size_t encodeFloppyVersionSelect(const uint8_t version, uint8_t* out);
+
+// receiver side: length of the message starting at bytes, or 0
+// if more of it must arrive (numBytes > 0) before that is known
+size_t floppyMessageLength(const uint8_t version, const uint8_t* bytes, const size_t numBytes);
+
+#endif
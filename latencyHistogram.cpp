@@ -0,0 +1,155 @@
+/*******************************************************************
+*   latencyHistogram.cpp
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module records playback latencies (in ns) in lock-free,
+// HDR-style log-linear histograms: every power of 2 is split into
+// 32 equal sub-buckets, so any value is stored to within ~3% from
+// 1 ns to ~18 minutes in a fixed 9 KB, with a single relaxed atomic
+// add per sample. Any thread (i.e. the scheduler, the serial writers
+// and the audio callback) may record at any time without locks.
+// Three histograms are kept for the whole run: how late each event
+// was dispatched versus its scheduled time, how long each serial
+// send waited from enqueue until written to the port, and how long
+// each audio callback took; playing live input adds a fourth, from
+// each input's arrival until its packets were written. They are
+// printed as p50/p99/p99.9/max at the end of playback, or on
+// request (SIGUSR1 on Linux, Ctrl+Break on Windows) while playing.
+
+#include "latencyHistogram.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+LatencyHistogram dispatchLatency("Event dispatch lateness");
+LatencyHistogram serialWriteLatency("Serial enqueue to write");
+LatencyHistogram audioCallbackDuration("Audio callback duration");
+LatencyHistogram liveInputLatency("Live input to serial write");
+
+static std::atomic<bool> dumpRequested(false);
+static_assert(ATOMIC_BOOL_LOCK_FREE == 2, "latency dump requests are made from signal handlers");
+
+// index of the highest set bit. v must be nonzero
+static unsigned highestBit(const uint64_t v) {
+#ifdef _MSC_VER
+	unsigned long idx;
+	_BitScanReverse64(&idx, v);
+	return static_cast<unsigned>(idx);
+#else
+	return 63 - static_cast<unsigned>(__builtin_clzll(v));
+#endif
+}
+
+LatencyHistogram::LatencyHistogram(const char* name) : name(name), maxNs(0) {
+	for (size_t i = 0; i < LATENCY_NUM_BUCKETS; ++i)
+		counts[i].store(0, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::reset() {
+	for (size_t i = 0; i < LATENCY_NUM_BUCKETS; ++i)
+		counts[i].store(0, std::memory_order_relaxed);
+	maxNs.store(0, std::memory_order_relaxed);
+}
+
+// values below LATENCY_SUB_BUCKETS get a bucket each; above that,
+// each power of 2 gets LATENCY_SUB_BUCKETS buckets
+size_t LatencyHistogram::bucketOf(uint64_t ns) {
+	if (ns < LATENCY_SUB_BUCKETS)
+		return static_cast<size_t>(ns);
+
+	if (ns >= (static_cast<uint64_t>(1) << LATENCY_MAX_MAGNITUDE))
+		return LATENCY_NUM_BUCKETS - 1;
+
+	const unsigned shift = highestBit(ns) - LATENCY_SUB_BUCKET_BITS;
+	return (shift + 1) * LATENCY_SUB_BUCKETS + static_cast<size_t>((ns >> shift) - LATENCY_SUB_BUCKETS);
+}
+
+uint64_t LatencyHistogram::bucketTop(const size_t bucket) {
+	if (bucket < LATENCY_SUB_BUCKETS)
+		return bucket;
+
+	const unsigned shift = static_cast<unsigned>(bucket / LATENCY_SUB_BUCKETS - 1);
+	const uint64_t sub = bucket % LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKETS;
+	return ((sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(const int64_t ns) {
+	const uint64_t v = (ns > 0) ? static_cast<uint64_t>(ns) : 0;
+	counts[bucketOf(v)].fetch_add(1, std::memory_order_relaxed);
+
+	uint64_t seen = maxNs.load(std::memory_order_relaxed);
+	while (v > seen && !maxNs.compare_exchange_weak(seen, v, std::memory_order_relaxed));
+}
+
+uint64_t LatencyHistogram::count() const {
+	uint64_t total = 0;
+	for (size_t i = 0; i < LATENCY_NUM_BUCKETS; ++i)
+		total += counts[i].load(std::memory_order_relaxed);
+	return total;
+}
+
+uint64_t LatencyHistogram::percentile(const double p) const {
+	const uint64_t total = count();
+	if (total == 0)
+		return 0;
+
+	// smallest bucket at or below which at least p of samples lie
+	uint64_t target = static_cast<uint64_t>(p * static_cast<double>(total) + 0.5);
+	if (target < 1)
+		target = 1;
+
+	uint64_t seen = 0;
+	for (size_t i = 0; i < LATENCY_NUM_BUCKETS; ++i) {
+		seen += counts[i].load(std::memory_order_relaxed);
+		if (seen >= target) {
+			// a bucket's top can overstate the true max
+			const uint64_t top = bucketTop(i);
+			return (top < max()) ? top : max();
+		}
+	}
+	return max();
+}
+
+void LatencyHistogram::print() const {
+	const uint64_t n = count();
+	std::cout << name << ": " << n << " samples";
+	if (n) {
+		std::cout << ", p50 " << static_cast<double>(percentile(0.5)) / 1000.0
+			<< " us, p99 " << static_cast<double>(percentile(0.99)) / 1000.0
+			<< " us, p99.9 " << static_cast<double>(percentile(0.999)) / 1000.0
+			<< " us, max " << static_cast<double>(max()) / 1000.0 << " us";
+	}
+	std::cout << "." << std::endl;
+}
+
+void printLatencyHistograms() {
+	dispatchLatency.print();
+	serialWriteLatency.print();
+	audioCallbackDuration.print();
+
+	// only playing live records it
+	if (liveInputLatency.count())
+		liveInputLatency.print();
+}
+
+void resetLatencyHistograms() {
+	dispatchLatency.reset();
+	serialWriteLatency.reset();
+	audioCallbackDuration.reset();
+	liveInputLatency.reset();
+}
+
+void requestLatencyDump() {
+	dumpRequested.store(true, std::memory_order_relaxed);
+}
+
+void serviceLatencyDump() {
+	if (dumpRequested.load(std::memory_order_relaxed) && dumpRequested.exchange(false, std::memory_order_relaxed))
+		printLatencyHistograms();
+}
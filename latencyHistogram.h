@@ -0,0 +1,101 @@
+/*******************************************************************
+*   latencyHistogram.h
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module records playback latencies (in ns) in lock-free,
+// HDR-style log-linear histograms: every power of 2 is split into
+// 32 equal sub-buckets, so any value is stored to within ~3% from
+// 1 ns to ~18 minutes in a fixed 9 KB, with a single relaxed atomic
+// add per sample. Any thread (i.e. the scheduler, the serial writers
+// and the audio callback) may record at any time without locks.
+// Three histograms are kept for the whole run: how late each event
+// was dispatched versus its scheduled time, how long each serial
+// send waited from enqueue until written to the port, and how long
+// each audio callback took; playing live input adds a fourth, from
+// each input's arrival until its packets were written. They are
+// printed as p50/p99/p99.9/max at the end of playback, or on
+// request (SIGUSR1 on Linux, Ctrl+Break on Windows) while playing.
+
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+// sub-buckets per power of 2 = 2^this
+#define LATENCY_SUB_BUCKET_BITS			(5)
+
+// values from 2^this ns up land in the top bucket
+#define LATENCY_MAX_MAGNITUDE			(40)
+
+#define LATENCY_SUB_BUCKETS				(1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_NUM_BUCKETS				((LATENCY_MAX_MAGNITUDE - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+
+class LatencyHistogram {
+private:
+	const char* name;
+	std::atomic<uint64_t> counts[LATENCY_NUM_BUCKETS];
+	std::atomic<uint64_t> maxNs;
+
+	static size_t bucketOf(uint64_t ns);
+
+	// largest value a bucket holds, which is what percentiles report
+	static uint64_t bucketTop(const size_t bucket);
+
+public:
+	explicit LatencyHistogram(const char* name);
+
+	LatencyHistogram(const LatencyHistogram&) = delete;
+	LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+	// negative (i.e. early) samples count as 0
+	void record(const int64_t ns);
+
+	uint64_t count() const;
+	uint64_t max() const { return maxNs.load(std::memory_order_relaxed); }
+
+	// p in [0, 1]. approximate while others are recording
+	uint64_t percentile(const double p) const;
+
+	void print() const;
+
+	// approximate while others are recording
+	void reset();
+};
+
+// event dispatch time minus scheduled time
+extern LatencyHistogram dispatchLatency;
+
+// serial send, enqueue to written to the port
+extern LatencyHistogram serialWriteLatency;
+
+// time spent inside each audio callback
+extern LatencyHistogram audioCallbackDuration;
+
+// live input arrival to its floppy packets written to the port
+extern LatencyHistogram liveInputLatency;
+
+inline int64_t latencyClockNs() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void printLatencyHistograms();
+
+// i.e. before each song of several played on the same outputs
+void resetLatencyHistograms();
+
+// safe to call from a signal handler
+void requestLatencyDump();
+
+// print if requested since the last call. cheap enough for every tick
+void serviceLatencyDump();
+
+#endif
@@ -0,0 +1,116 @@
+/*******************************************************************
+*   lockFreeQueue.h
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module provides a bounded, lock-free multi-producer queue
+// (after Dmitry Vyukov's bounded MPMC queue) for handing small
+// fixed-size records to a real-time consumer (i.e. the audio
+// callback) without mutexes, allocation, or system calls.
+// With a single producer and consumer no operation ever retries.
+
+#ifndef LOCKFREEQUEUE_H
+#define LOCKFREEQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// big enough that producer and consumer indices
+// don't share a cache line
+#define CACHE_LINE_SIZE					(64)
+
+// CAPACITY must be a power of 2
+template <typename T, size_t CAPACITY>
+class LockFreeQueue {
+private:
+	static_assert(CAPACITY >= 2 && (CAPACITY & (CAPACITY - 1)) == 0, "LockFreeQueue capacity must be a power of 2");
+
+	struct Cell {
+		std::atomic<size_t> sequence;
+		T data;
+	};
+
+	Cell cells[CAPACITY];
+
+	char pad0[CACHE_LINE_SIZE];
+	std::atomic<size_t> enqueuePos;
+	char pad1[CACHE_LINE_SIZE];
+	std::atomic<size_t> dequeuePos;
+	char pad2[CACHE_LINE_SIZE];
+
+public:
+	LockFreeQueue() {
+		for (size_t i = 0; i < CAPACITY; ++i)
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+		enqueuePos.store(0, std::memory_order_relaxed);
+		dequeuePos.store(0, std::memory_order_relaxed);
+	}
+
+	// false if full
+	bool push(const T& v) {
+		Cell* cell;
+		size_t pos = enqueuePos.load(std::memory_order_relaxed);
+		for (;;) {
+			cell = &cells[pos & (CAPACITY - 1)];
+			const size_t seq = cell->sequence.load(std::memory_order_acquire);
+			const intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+			if (dif == 0) {
+				if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (dif < 0) {
+				return false;
+			}
+			else {
+				pos = enqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+
+		cell->data = v;
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	// false if empty
+	bool pop(T& v) {
+		Cell* cell;
+		size_t pos = dequeuePos.load(std::memory_order_relaxed);
+		for (;;) {
+			cell = &cells[pos & (CAPACITY - 1)];
+			const size_t seq = cell->sequence.load(std::memory_order_acquire);
+			const intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+			if (dif == 0) {
+				if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (dif < 0) {
+				return false;
+			}
+			else {
+				pos = dequeuePos.load(std::memory_order_relaxed);
+			}
+		}
+
+		v = cell->data;
+		cell->sequence.store(pos + CAPACITY, std::memory_order_release);
+		return true;
+	}
+
+	// approximate while producers/consumer are active
+	size_t size() const {
+		const size_t e = enqueuePos.load(std::memory_order_relaxed);
+		const size_t d = dequeuePos.load(std::memory_order_relaxed);
+		return (e > d) ? e - d : 0;
+	}
+
+	size_t capacity() const {
+		return CAPACITY;
+	}
+};
+
+#endif
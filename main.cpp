@@ -8,10 +8,19 @@
 *******************************************************************/
 
 // SongOfTheFloppies parses any MIDI file into an internal structure
-// and a text-readable log file called midi_log.txt. It then plays the
+// (and, if LOG_MIDI_STRUCTURE is defined in MIDI.h, a text-readable
+// log file called midi_log.txt). It then plays the
 // MIDI simplistically using sine waves, if PLAY_SINE is defined in MIDI.h
 // and/or plays it on floppy drive stepper motors if PLAY_FLOPPY is defined
 // in MIDI.h.
+// Given a second argument, it instead renders the sine output
+// offline, as fast as possible, to that WAV file.
+// Run as "SongOfTheFloppies --daemon <directory>", it stays running
+// and plays every MIDI file that appears in the directory, back to
+// back, on floppies and audio opened only once (see daemon.h).
+// Run as "SongOfTheFloppies --batch <directory or list file>", it
+// instead parses, analyzes and compiles every MIDI file there, in
+// parallel, and reports on each (see batch.h).
 
 // mem leak checker
 #ifdef _DEBUG
@@ -29,6 +38,7 @@
 
 #endif // _DEBUG
 
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
 #include <string>
@@ -44,13 +54,23 @@
 #include <unistd.h>
 #endif
 
+#include "batch.h"
+#include "daemon.h"
 #include "MIDI.h"
 
 MIDI midi;
 
 #ifdef _WIN32
 BOOL CtrlHandler(DWORD fdwCtrlType) {
+	// Ctrl+Break prints latency stats and keeps playing
+	if (fdwCtrlType == CTRL_BREAK_EVENT) {
+		requestLatencyDump();
+		return true;
+	}
+
 	midi.isClosing = true;
+	closeDaemon();
+	closeBatch();
 
 	// don't let the system kill the process.
 	// asynchronous handler will exit()
@@ -66,9 +86,39 @@ void CtrlHandler(int s) {
 	// as long as you've registered the handler,
 	// it won't kill the process
 	midi.isClosing = true;
+	closeDaemon();
+	closeBatch();
+}
+
+// print latency stats and keep playing
+void LatencyDumpHandler(int) {
+	requestLatencyDump();
 }
 #endif
 
+// a non-negative number of seconds
+static bool parseSeconds(const char* arg, uint64_t& usec) {
+	char* end;
+	const double seconds = strtod(arg, &end);
+	if (end == arg || *end || !(seconds >= 0.0))
+		return false;
+
+	usec = static_cast<uint64_t>(seconds * MICROSECONDS_PER_SECOND);
+	return true;
+}
+
+// "--from <seconds>" or "--loop <from> <to>"
+static bool parseSeekOptions(const int argc, char* argv[]) {
+	const std::string option(argv[0]);
+	if (option == "--from" && argc == 2)
+		return parseSeconds(argv[1], midi.playFromUsec);
+
+	if (option == "--loop" && argc == 3)
+		return parseSeconds(argv[1], midi.playFromUsec) && parseSeconds(argv[2], midi.loopToUsec) && midi.loopToUsec > midi.playFromUsec;
+
+	return false;
+}
+
 int main(int argc, char* argv[]) {
 	// for memory leak testing
 #ifdef _DEBUG
@@ -76,6 +126,7 @@ int main(int argc, char* argv[]) {
 #endif
 
 	midi.isClosing = false;
+	midi.maxFileSize = MAX_MIDI_FILE_SIZE_IN_BYTES;
 
 	// for graceful cleanup if user terminates process early
 	// examples: stop drives from getting stuck on notes,
@@ -93,6 +144,14 @@ int main(int argc, char* argv[]) {
 	sigaction(SIGTERM, &sigIntHandler, NULL);
 	sigaction(SIGHUP, &sigIntHandler, NULL);
 
+	struct sigaction sigUsr1Handler;
+
+	sigUsr1Handler.sa_handler = LatencyDumpHandler;
+	sigemptyset(&sigUsr1Handler.sa_mask);
+	sigUsr1Handler.sa_flags = SA_RESTART;
+
+	sigaction(SIGUSR1, &sigUsr1Handler, NULL);
+
 #endif
 
 	if (argc == 1) {
@@ -101,13 +160,38 @@ int main(int argc, char* argv[]) {
 		return EXIT_FAILURE;
 	}
 
-	if (argc > 2) {
+	const bool seeking = argc >= 3 && std::string(argv[2]).compare(0, 2, "--") == 0;
+
+	if (argc > 3 && !seeking) {
 		std::cout << "Please specify only a single input MIDI file" << std::endl
-			<< "or drag-and-drop one onto this program." << std::endl << std::endl;
+			<< "(and optionally a WAV file to render it to)" << std::endl
+			<< "or drag-and-drop one onto this program" << std::endl
+			<< "(or --daemon and a directory to play from," << std::endl
+			<< "or --live and a MIDI input to play," << std::endl
+			<< "or --batch and a directory or list of files to check)." << std::endl << std::endl;
 		return EXIT_FAILURE;
 	}
 
+	if (argc == 3 && std::string(argv[1]) == "--daemon")
+		return runDaemon(std::string(argv[2]));
+
+	if (argc == 3 && std::string(argv[1]) == "--batch")
+		return runBatch(std::string(argv[2]));
+
+	if (argc == 3 && std::string(argv[1]) == "--live")
+		return midi.playLive(std::string(argv[2])) ? EXIT_SUCCESS : EXIT_FAILURE;
+
 	midi.fileName = std::string(argv[1]);
+	if (seeking) {
+		if (!parseSeekOptions(argc - 2, argv + 2)) {
+			std::cout << "Expected --from <seconds> or --loop <from seconds> <to seconds>" << std::endl
+				<< "(with to after from) after the MIDI file." << std::endl << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+	else if (argc == 3) {
+		midi.renderFileName = std::string(argv[2]);
+	}
 
 	if (!midi.loadBinaryFile()) {
 		std::cout << "Failed to load MIDI file." << std::endl;
@@ -116,6 +200,20 @@ int main(int argc, char* argv[]) {
 
 	if (midi.isClosing)
 		return EXIT_FAILURE;
+
+#ifdef USE_COMPILED_SONG_CACHE
+	// already compiled? skip straight to playback
+	// (compiled songs only play from the top)
+	if (midi.renderFileName.empty() && !seeking && midi.loadCompiledSong()) {
+		std::cout << "Loaded compiled song from cache." << std::endl;
+		std::cout << "Playing compiled MIDI..." << std::endl;
+#if defined(PLAY_SINE) || defined(PLAY_FLOPPY)
+		midi.playMusic();
+#endif
+		std::cout << "Done!" << std::endl;
+		return EXIT_SUCCESS;
+	}
+#endif
  
 	std::cout << "Parsing MIDI file..." << std::endl;
 
@@ -124,29 +222,56 @@ int main(int argc, char* argv[]) {
 			return EXIT_FAILURE;
 
 		std::cout << "Error parsing MIDI file." << std::endl;
-		midi.stepThroughCompletedMidiStructure();
+#ifdef LOG_MIDI_STRUCTURE
+		// log whatever did parse
+		midi.startMidiLog();
+		midi.finishMidiLog();
+#endif
 		return EXIT_FAILURE;
 	}
 
 	std::cout << "MIDI file parsed successfully." << std::endl;
-	midi.rawMIDI.clear();
 
 	if (midi.isClosing)
 		return EXIT_FAILURE;
 
-	std::cout << "Logging parsed MIDI structure to midi_log.txt..." << std::endl;
-	midi.stepThroughCompletedMidiStructure();
-	std::cout << "Done." << std::endl << std::endl;
+	midi.analyzeMidiStructure();
+
+#ifdef LOG_MIDI_STRUCTURE
+	std::cout << "Logging parsed MIDI structure to midi_log.txt in the background." << std::endl;
+	midi.startMidiLog();
+#endif
+	std::cout << std::endl;
 
 	if (midi.isClosing)
 		return EXIT_FAILURE;
 
+	if (!midi.renderFileName.empty()) {
+		if (!midi.renderToFile()) {
+			std::cout << "Failed to render " << midi.renderFileName << "." << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		midi.finishMidiLog();
+		std::cout << "Done!" << std::endl;
+		return EXIT_SUCCESS;
+	}
+
+#ifdef USE_COMPILED_SONG_CACHE
+	if (!seeking) {
+		std::cout << "Compiling MIDI..." << std::endl;
+		if (!midi.compileSong())
+			return EXIT_FAILURE;
+	}
+#endif
+
 	std::cout << "Playing parsed MIDI..." << std::endl;
 
 #if defined(PLAY_SINE) || defined(PLAY_FLOPPY)
 	midi.playMusic();
 #endif
 
+	midi.finishMidiLog();
 	std::cout << "Done!" << std::endl;
 
 	return EXIT_SUCCESS;
@@ -0,0 +1,152 @@
+/*******************************************************************
+*   mappedFile.cpp
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module provides a Windows- and Linux-compatible read-only
+// memory-mapped file. The parser reads straight out of the mapping,
+// so loading is constant-time regardless of file size and there is
+// never a second in-RAM copy of the file.
+// Falls back to a plain buffered read if the file can't be mapped
+// (i.e. it's a pipe or some other special file).
+
+#include "mappedFile.h"
+
+#include <fstream>
+
+MappedFile::MappedFile() : view(nullptr), length(0), mapped(false) {
+#ifdef _WIN32
+	hFile = INVALID_HANDLE_VALUE;
+	hMapping = NULL;
+#else
+	fd = -1;
+#endif
+}
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+bool MappedFile::readFallback(const std::string& fileName) {
+	std::ifstream in(fileName.c_str(), std::ios::binary);
+	if (!in)
+		return false;
+
+	// read in blocks, since special files can't report their size
+	char block[65536];
+	while (in.read(block, sizeof block) || in.gcount() > 0)
+		fallback.insert(fallback.end(), block, block + in.gcount());
+
+	view = fallback.data();
+	length = fallback.size();
+	return true;
+}
+
+bool MappedFile::open(const std::string& fileName, const size_t maxSize, std::ostream& console) {
+	close();
+
+#ifdef _WIN32
+	hFile = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE) {
+		console << "Failed to open file. Is the file name correct?" << std::endl;
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(hFile, &fileSize) || fileSize.QuadPart == 0) {
+		CloseHandle(hFile);
+		hFile = INVALID_HANDLE_VALUE;
+		if (!readFallback(fileName)) {
+			console << "Failed to read file." << std::endl;
+			return false;
+		}
+	}
+	else {
+		length = static_cast<size_t>(fileSize.QuadPart);
+		hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (hMapping != NULL)
+			view = reinterpret_cast<const uint8_t*>(MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0));
+
+		if (view == nullptr) {
+			close();
+			if (!readFallback(fileName)) {
+				console << "Failed to read file." << std::endl;
+				return false;
+			}
+		}
+		else {
+			mapped = true;
+		}
+	}
+#else
+	if ((fd = ::open(fileName.c_str(), O_RDONLY)) < 0) {
+		console << "Failed to open file. Is the file name correct?" << std::endl;
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+		::close(fd);
+		fd = -1;
+		if (!readFallback(fileName)) {
+			console << "Failed to read file." << std::endl;
+			return false;
+		}
+	}
+	else {
+		length = static_cast<size_t>(st.st_size);
+		void* p = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED) {
+			close();
+			if (!readFallback(fileName)) {
+				console << "Failed to read file." << std::endl;
+				return false;
+			}
+		}
+		else {
+			// parser reads front to back exactly once
+			madvise(p, length, MADV_SEQUENTIAL);
+			view = reinterpret_cast<const uint8_t*>(p);
+			mapped = true;
+		}
+	}
+#endif
+
+	// applies to mapped and fallback reads alike
+	if (maxSize && length > maxSize) {
+		console << "File is too large! Are you sure that's a MIDI?" << std::endl;
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+void MappedFile::close() {
+#ifdef _WIN32
+	if (mapped)
+		UnmapViewOfFile(view);
+	if (hMapping != NULL)
+		CloseHandle(hMapping);
+	if (hFile != INVALID_HANDLE_VALUE)
+		CloseHandle(hFile);
+	hMapping = NULL;
+	hFile = INVALID_HANDLE_VALUE;
+#else
+	if (mapped)
+		munmap(const_cast<uint8_t*>(view), length);
+	if (fd >= 0)
+		::close(fd);
+	fd = -1;
+#endif
+
+	fallback.clear();
+	fallback.shrink_to_fit();
+	view = nullptr;
+	length = 0;
+	mapped = false;
+}
@@ -0,0 +1,67 @@
+/*******************************************************************
+*   mappedFile.h
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module provides a Windows- and Linux-compatible read-only
+// memory-mapped file. The parser reads straight out of the mapping,
+// so loading is constant-time regardless of file size and there is
+// never a second in-RAM copy of the file.
+// Falls back to a plain buffered read if the file can't be mapped
+// (i.e. it's a pipe or some other special file).
+
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+class MappedFile {
+private:
+	const uint8_t* view;
+	size_t length;
+	bool mapped;
+
+	// only used if mapping isn't possible
+	std::vector<uint8_t> fallback;
+
+#ifdef _WIN32
+	HANDLE hFile;
+	HANDLE hMapping;
+#else
+	int fd;
+#endif
+
+	bool readFallback(const std::string& fileName);
+
+public:
+	MappedFile();
+	~MappedFile();
+
+	// map file read-only. fails, saying why on console, if larger
+	// than maxSize bytes (0 means no limit)
+	bool open(const std::string& fileName, const size_t maxSize, std::ostream& console = std::cout);
+	void close();
+
+	const uint8_t* data() const { return view; }
+	size_t size() const { return length; }
+	bool isMapped() const { return mapped; }
+};
+
+#endif
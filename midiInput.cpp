@@ -0,0 +1,228 @@
+/*******************************************************************
+*   midiInput.cpp
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module reads MIDI from a live input (i.e. a keyboard, or a
+// DAW through a virtual port) for MIDI::playLive. On Linux it reads
+// an ALSA raw MIDI device (/dev/snd/midiC<card>D<device>; snd-virmidi
+// provides ones a DAW can play into) directly with poll() and read(),
+// so no ALSA library is needed, and any other byte stream (i.e. a
+// FIFO) works too. On Windows it opens a WinMM input, by number or
+// by name, whose callback pushes each message into a lock-free
+// queue. Input is stamped with latencyClockNs() as it arrives, to
+// time it all the way to the serial write.
+// MidiInputParser turns the byte stream back into channel messages:
+// running status is followed, realtime bytes (clock, active sensing)
+// are skipped wherever they appear, and SysEx and system common
+// messages are dropped.
+
+#include "midiInput.h"
+
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include "latencyHistogram.h"
+
+// data bytes following a channel message's status byte
+static uint8_t dataBytesFor(const uint8_t status) {
+	return (status >= 0xC0 && status <= 0xDF) ? 1 : 2;
+}
+
+MidiInputParser::MidiInputParser() : runningStatus(0), numData(0) {}
+
+bool MidiInputParser::feed(const uint8_t byte, MidiChannelMessage& msg) {
+	// realtime can land anywhere, even mid-message, and changes nothing
+	if (byte >= 0xF8)
+		return false;
+
+	if (byte & 0x80) {
+		numData = 0;
+
+		// SysEx and system common cancel running status, so their
+		// data is dropped until the next channel status byte
+		runningStatus = (byte < 0xF0) ? byte : 0;
+		return false;
+	}
+
+	if (!runningStatus)
+		return false;
+
+	data[numData++] = byte;
+	if (numData < dataBytesFor(runningStatus))
+		return false;
+
+	msg.status = runningStatus;
+	msg.byte1 = data[0];
+	msg.byte2 = (numData == 2) ? data[1] : 0;
+	numData = 0;
+	return true;
+}
+
+#ifdef _WIN32
+
+MidiInput::MidiInput() : opened(false), handle(nullptr), arrived(nullptr) {}
+
+MidiInput::~MidiInput() {
+	close();
+}
+
+void CALLBACK MidiInput::inputCallback(HMIDIIN in, UINT msg, DWORD_PTR instance, DWORD_PTR param1, DWORD_PTR param2) {
+	if (msg != MIM_DATA)
+		return;
+
+	MidiInput* const input = reinterpret_cast<MidiInput*>(instance);
+
+	// a short message, packed little-endian
+	MidiInputPacket packet;
+	packet.receivedNs = latencyClockNs();
+	packet.bytes[0] = static_cast<uint8_t>(param1 & 0xFF);
+	packet.bytes[1] = static_cast<uint8_t>((param1 >> 8) & 0xFF);
+	packet.bytes[2] = static_cast<uint8_t>((param1 >> 16) & 0xFF);
+	packet.length = (packet.bytes[0] < 0xF0) ? 1 + dataBytesFor(packet.bytes[0]) : 1;
+
+	// a full queue means the reader is long gone; drop it
+	if (input->packets.push(packet))
+		SetEvent(input->arrived);
+}
+
+bool MidiInput::open(const std::string& device) {
+	const UINT numDevices = midiInGetNumDevs();
+
+	// a number, or else the first device whose name contains it
+	UINT id = numDevices;
+	if (!device.empty() && std::all_of(device.begin(), device.end(), [](const unsigned char c) { return isdigit(c) != 0; })) {
+		id = static_cast<UINT>(std::stoul(device));
+	}
+	else {
+		for (UINT i = 0; i < numDevices && id == numDevices; ++i) {
+			MIDIINCAPSA caps;
+			if (midiInGetDevCapsA(i, &caps, sizeof caps) == MMSYSERR_NOERROR && std::string(caps.szPname).find(device) != std::string::npos)
+				id = i;
+		}
+	}
+
+	if (id >= numDevices) {
+		std::cout << "No MIDI input " << device << ". Inputs are:" << std::endl;
+		for (UINT i = 0; i < numDevices; ++i) {
+			MIDIINCAPSA caps;
+			if (midiInGetDevCapsA(i, &caps, sizeof caps) == MMSYSERR_NOERROR)
+				std::cout << "  " << i << ": " << caps.szPname << std::endl;
+		}
+		return false;
+	}
+
+	arrived = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+	const MMRESULT result = midiInOpen(&handle, id, reinterpret_cast<DWORD_PTR>(&MidiInput::inputCallback), reinterpret_cast<DWORD_PTR>(this), CALLBACK_FUNCTION);
+	if (result != MMSYSERR_NOERROR) {
+		std::cout << "Could not open MIDI input " << device << " (error " << result << ")." << std::endl;
+		CloseHandle(arrived);
+		arrived = nullptr;
+		return false;
+	}
+
+	midiInStart(handle);
+	opened = true;
+	return true;
+}
+
+void MidiInput::close() {
+	if (opened) {
+		midiInStop(handle);
+		midiInReset(handle);
+		midiInClose(handle);
+		opened = false;
+	}
+
+	if (arrived) {
+		CloseHandle(arrived);
+		arrived = nullptr;
+	}
+}
+
+bool MidiInput::isOpen() const {
+	return opened;
+}
+
+size_t MidiInput::read(uint8_t* const buffer, const size_t capacity, int64_t& receivedNs) {
+	WaitForSingleObject(arrived, MIDI_INPUT_POLL_MS);
+
+	size_t n = 0;
+	MidiInputPacket packet;
+	while (n + 3 <= capacity && packets.pop(packet)) {
+		if (!n)
+			receivedNs = packet.receivedNs;
+		for (uint8_t i = 0; i < packet.length; ++i)
+			buffer[n++] = packet.bytes[i];
+	}
+
+	// more left than fit: come straight back for it
+	if (packets.size())
+		SetEvent(arrived);
+	return n;
+}
+
+#else
+
+MidiInput::MidiInput() : opened(false), fd(-1) {}
+
+MidiInput::~MidiInput() {
+	close();
+}
+
+bool MidiInput::open(const std::string& device) {
+	fd = ::open(device.c_str(), O_RDONLY | O_NONBLOCK | O_NOCTTY);
+	if (fd < 0) {
+		std::cout << "Could not open MIDI input " << device << " (" << strerror(errno) << ")." << std::endl
+			<< "Raw MIDI devices are /dev/snd/midiC<card>D<device> (see amidi -l)." << std::endl;
+		return false;
+	}
+
+	opened = true;
+	return true;
+}
+
+void MidiInput::close() {
+	if (fd >= 0) {
+		::close(fd);
+		fd = -1;
+	}
+	opened = false;
+}
+
+bool MidiInput::isOpen() const {
+	return opened;
+}
+
+size_t MidiInput::read(uint8_t* const buffer, const size_t capacity, int64_t& receivedNs) {
+	pollfd pfd = { fd, POLLIN, 0 };
+
+	// timed out, or interrupted (i.e. by Ctrl+C)
+	if (poll(&pfd, 1, MIDI_INPUT_POLL_MS) <= 0)
+		return 0;
+
+	receivedNs = latencyClockNs();
+	const ssize_t n = ::read(fd, buffer, capacity);
+	if (n > 0)
+		return static_cast<size_t>(n);
+
+	// end of file, or the device was unplugged
+	if (n == 0 || (errno != EAGAIN && errno != EINTR))
+		opened = false;
+	return 0;
+}
+
+#endif
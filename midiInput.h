@@ -0,0 +1,115 @@
+/*******************************************************************
+*   midiInput.h
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module reads MIDI from a live input (i.e. a keyboard, or a
+// DAW through a virtual port) for MIDI::playLive. On Linux it reads
+// an ALSA raw MIDI device (/dev/snd/midiC<card>D<device>; snd-virmidi
+// provides ones a DAW can play into) directly with poll() and read(),
+// so no ALSA library is needed, and any other byte stream (i.e. a
+// FIFO) works too. On Windows it opens a WinMM input, by number or
+// by name, whose callback pushes each message into a lock-free
+// queue. Input is stamped with latencyClockNs() as it arrives, to
+// time it all the way to the serial write.
+// MidiInputParser turns the byte stream back into channel messages:
+// running status is followed, realtime bytes (clock, active sensing)
+// are skipped wherever they appear, and SysEx and system common
+// messages are dropped.
+
+#ifndef MIDIINPUT_H
+#define MIDIINPUT_H
+
+// longest a read waits for input before returning
+// empty-handed, so the caller can check for shutdown
+#define MIDI_INPUT_POLL_MS				(10)
+
+// most bytes taken from the input per read (and so per send)
+#define MIDI_INPUT_READ_BYTES			(256)
+
+// messages in flight from the WinMM callback. must be a power of 2
+#define MIDI_INPUT_QUEUE_SIZE			(1024)
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <mmsystem.h>
+
+#include "lockFreeQueue.h"
+#endif
+
+struct MidiChannelMessage {
+	uint8_t status;
+	uint8_t byte1;
+
+	// 0 for program change and channel pressure
+	uint8_t byte2;
+};
+
+class MidiInputParser {
+private:
+	// 0 while there is none (i.e. inside SysEx)
+	uint8_t runningStatus;
+	uint8_t data[2];
+	uint8_t numData;
+
+public:
+	MidiInputParser();
+
+	// true if byte completes a channel message, now in msg
+	bool feed(const uint8_t byte, MidiChannelMessage& msg);
+};
+
+#ifdef _WIN32
+struct MidiInputPacket {
+	// latencyClockNs() in the callback
+	int64_t receivedNs;
+	uint8_t length;
+	uint8_t bytes[3];
+};
+#endif
+
+class MidiInput {
+private:
+	bool opened;
+
+#ifdef _WIN32
+	HMIDIIN handle;
+	HANDLE arrived;
+	LockFreeQueue<MidiInputPacket, MIDI_INPUT_QUEUE_SIZE> packets;
+
+	static void CALLBACK inputCallback(HMIDIIN in, UINT msg, DWORD_PTR instance, DWORD_PTR param1, DWORD_PTR param2);
+#else
+	int fd;
+#endif
+
+public:
+	MidiInput();
+	~MidiInput();
+
+	MidiInput(const MidiInput&) = delete;
+	MidiInput& operator=(const MidiInput&) = delete;
+
+	// a device path on Linux; a device number, or (part of) a
+	// device name, on Windows. false (with the reason printed)
+	// if it can't be opened
+	bool open(const std::string& device);
+	void close();
+
+	// false once the device has gone away
+	bool isOpen() const;
+
+	// wait up to MIDI_INPUT_POLL_MS for input and copy out what
+	// has arrived (capacity at least 3). returns bytes copied;
+	// receivedNs is when the first of them arrived
+	size_t read(uint8_t* const buffer, const size_t capacity, int64_t& receivedNs);
+};
+
+#endif
@@ -0,0 +1,333 @@
+/*******************************************************************
+*   mixer.cpp
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module mixes all sounding oscillator voices into the output
+// buffer. Rather than visiting every one of MAX_SIMUL voices for every
+// frame, it compacts the voices that are actually sounding into a list
+// once per block and then runs each voice across the whole block at
+// once, with the envelope, gain, phase increment and interpolated
+// wavetable lookup (see wavetable.h) done in SIMD (SSE2 or AVX2 on
+// x86, NEON on ARM) and clamped branchlessly.
+// The widest instruction set the CPU supports is picked at runtime.
+
+#include "mixer.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MIXER_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#define MIXER_ARM_NEON
+#include <arm_neon.h>
+#endif
+
+// GCC and Clang need per-function permission to emit
+// instructions wider than the build's baseline; MSVC doesn't
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_ISA(isa) __attribute__((target(isa)))
+#else
+#define TARGET_ISA(isa)
+#endif
+
+// mixes one voice over a run of frames, accumulating into mix.
+//
+// per frame, exactly as the original per-sample loop did:
+// the envelope is multiplied by its growth/shrink factor and capped
+// at MAX_DECAY_STATE, scaled by the voice's gain and the table value
+// at its phase, and the phase then advances.
+// the table value is interpolated between the two entries either
+// side of the phase (the guard entry covers the last one), and the
+// phase wraps by overflowing.
+// a voice that decays to MIN_DECAY_STATE mid-run goes silent
+// and is dropped from the active list on the next block.
+typedef void(*VoiceKernel)(const float* const wave, float* const mix, const unsigned long frames,
+	float& decay, const float decayFactor, const float gain, uint32_t& phase, const uint32_t inc);
+
+static const float FRACTION_SCALE = 1.0f / static_cast<float>(1u << WAVETABLE_FRACTION_BITS);
+
+static inline float sampleWave(const float* const wave, const uint32_t phase) {
+	const uint32_t i = phase >> WAVETABLE_FRACTION_BITS;
+	const float frac = static_cast<float>(phase & WAVETABLE_FRACTION_MASK) * FRACTION_SCALE;
+	return wave[i] + frac * (wave[i + 1] - wave[i]);
+}
+
+// finishes (or does all of) a run one frame at a time
+static inline void mixVoiceTail(const float* const wave, float* const mix, unsigned long k, const unsigned long frames,
+	float& decay, const float decayFactor, const float gain, uint32_t& phase, const uint32_t inc) {
+
+	float d = decay;
+	uint32_t p = phase;
+	for (; k < frames; ++k) {
+		const float on = (d > MIN_DECAY_STATE) ? 1.0f : 0.0f;
+		d = std::min(d * decayFactor, MAX_DECAY_STATE);
+		mix[k] += on * d * gain * sampleWave(wave, p);
+		p += inc;
+	}
+	decay = d;
+	phase = p;
+}
+
+static void mixVoiceScalar(const float* const wave, float* const mix, const unsigned long frames,
+	float& decay, const float decayFactor, const float gain, uint32_t& phase, const uint32_t inc) {
+	mixVoiceTail(wave, mix, 0, frames, decay, decayFactor, gain, phase, inc);
+}
+
+// lanes hold consecutive frames. the envelope of lane i is
+// decay * factor^(i+1), so each step multiplies by factor^width;
+// capping after each step gives the same result as capping per
+// frame (monotonic in both growth and decay). a frame sounds if the
+// envelope BEFORE its multiply exceeded MIN_DECAY_STATE, i.e. if
+// the envelope after it exceeds MIN_DECAY_STATE * factor.
+// phases step by width * inc and wrap on their own. the fraction
+// (WAVETABLE_FRACTION_BITS) converts to float exactly.
+
+#ifdef MIXER_X86
+TARGET_ISA("sse2")
+static void mixVoiceSSE2(const float* const wave, float* const mix, const unsigned long frames,
+	float& decay, const float decayFactor, const float gain, uint32_t& phase, const uint32_t inc) {
+
+	unsigned long k = 0;
+	if (frames >= 4) {
+		const float f2 = decayFactor * decayFactor;
+		const __m128 maxD = _mm_set1_ps(MAX_DECAY_STATE);
+		const __m128 threshold = _mm_set1_ps(MIN_DECAY_STATE * decayFactor);
+		const __m128 factorStep = _mm_set1_ps(f2 * f2);
+		const __m128 g = _mm_set1_ps(gain);
+		__m128 d = _mm_min_ps(_mm_mul_ps(_mm_set1_ps(decay), _mm_setr_ps(decayFactor, f2, f2 * decayFactor, f2 * f2)), maxD);
+		__m128 lastD = d;
+
+		__m128i p = _mm_setr_epi32(static_cast<int>(phase), static_cast<int>(phase + inc), static_cast<int>(phase + 2 * inc), static_cast<int>(phase + 3 * inc));
+		const __m128i phaseStep = _mm_set1_epi32(static_cast<int>(4 * inc));
+		const __m128i fractionMask = _mm_set1_epi32(WAVETABLE_FRACTION_MASK);
+		const __m128 fractionScale = _mm_set1_ps(FRACTION_SCALE);
+
+		// SSE2 has no gather
+		uint32_t idx[4];
+
+		for (; k + 4 <= frames; k += 4) {
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(idx), _mm_srli_epi32(p, WAVETABLE_FRACTION_BITS));
+			const __m128 s0 = _mm_setr_ps(wave[idx[0]], wave[idx[1]], wave[idx[2]], wave[idx[3]]);
+			const __m128 s1 = _mm_setr_ps(wave[idx[0] + 1], wave[idx[1] + 1], wave[idx[2] + 1], wave[idx[3] + 1]);
+			const __m128 frac = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(p, fractionMask)), fractionScale);
+			const __m128 s = _mm_add_ps(s0, _mm_mul_ps(frac, _mm_sub_ps(s1, s0)));
+			const __m128 on = _mm_cmpgt_ps(d, threshold);
+			const __m128 v = _mm_and_ps(on, _mm_mul_ps(_mm_mul_ps(d, g), s));
+			_mm_storeu_ps(mix + k, _mm_add_ps(_mm_loadu_ps(mix + k), v));
+
+			lastD = d;
+			d = _mm_min_ps(_mm_mul_ps(d, factorStep), maxD);
+			p = _mm_add_epi32(p, phaseStep);
+		}
+
+		// hand the last frame's envelope and the next frame's phase to the tail
+		decay = _mm_cvtss_f32(_mm_shuffle_ps(lastD, lastD, _MM_SHUFFLE(3, 3, 3, 3)));
+		phase = static_cast<uint32_t>(_mm_cvtsi128_si32(p));
+	}
+	mixVoiceTail(wave, mix, k, frames, decay, decayFactor, gain, phase, inc);
+}
+
+TARGET_ISA("avx2")
+static void mixVoiceAVX2(const float* const wave, float* const mix, const unsigned long frames,
+	float& decay, const float decayFactor, const float gain, uint32_t& phase, const uint32_t inc) {
+
+	unsigned long k = 0;
+	if (frames >= 8) {
+		float powers[8];
+		uint32_t phases[8];
+		float f = decayFactor;
+		for (int i = 0; i < 8; ++i) {
+			powers[i] = f;
+			f *= decayFactor;
+			phases[i] = phase + static_cast<uint32_t>(i) * inc;
+		}
+
+		const __m256 maxD = _mm256_set1_ps(MAX_DECAY_STATE);
+		const __m256 threshold = _mm256_set1_ps(MIN_DECAY_STATE * decayFactor);
+		const __m256 factorStep = _mm256_set1_ps(powers[7]);
+		const __m256 g = _mm256_set1_ps(gain);
+		__m256 d = _mm256_min_ps(_mm256_mul_ps(_mm256_set1_ps(decay), _mm256_loadu_ps(powers)), maxD);
+		__m256 lastD = d;
+
+		__m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(phases));
+		const __m256i phaseStep = _mm256_set1_epi32(static_cast<int>(8 * inc));
+		const __m256i fractionMask = _mm256_set1_epi32(WAVETABLE_FRACTION_MASK);
+		const __m256 fractionScale = _mm256_set1_ps(FRACTION_SCALE);
+
+		for (; k + 8 <= frames; k += 8) {
+			const __m256i i = _mm256_srli_epi32(p, WAVETABLE_FRACTION_BITS);
+			const __m256 s0 = _mm256_i32gather_ps(wave, i, 4);
+			const __m256 s1 = _mm256_i32gather_ps(wave + 1, i, 4);
+			const __m256 frac = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(p, fractionMask)), fractionScale);
+			const __m256 s = _mm256_add_ps(s0, _mm256_mul_ps(frac, _mm256_sub_ps(s1, s0)));
+			const __m256 on = _mm256_cmp_ps(d, threshold, _CMP_GT_OQ);
+			const __m256 v = _mm256_and_ps(on, _mm256_mul_ps(_mm256_mul_ps(d, g), s));
+			_mm256_storeu_ps(mix + k, _mm256_add_ps(_mm256_loadu_ps(mix + k), v));
+
+			lastD = d;
+			d = _mm256_min_ps(_mm256_mul_ps(d, factorStep), maxD);
+			p = _mm256_add_epi32(p, phaseStep);
+		}
+
+		_mm256_storeu_ps(powers, lastD);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(phases), p);
+		decay = powers[7];
+		phase = phases[0];
+	}
+	mixVoiceTail(wave, mix, k, frames, decay, decayFactor, gain, phase, inc);
+}
+#endif
+
+#ifdef MIXER_ARM_NEON
+static void mixVoiceNEON(const float* const wave, float* const mix, const unsigned long frames,
+	float& decay, const float decayFactor, const float gain, uint32_t& phase, const uint32_t inc) {
+
+	unsigned long k = 0;
+	if (frames >= 4) {
+		const float f2 = decayFactor * decayFactor;
+		const float powers[4] = { decayFactor, f2, f2 * decayFactor, f2 * f2 };
+		const float32x4_t maxD = vdupq_n_f32(MAX_DECAY_STATE);
+		const float32x4_t threshold = vdupq_n_f32(MIN_DECAY_STATE * decayFactor);
+		const float32x4_t factorStep = vdupq_n_f32(f2 * f2);
+		const float32x4_t g = vdupq_n_f32(gain);
+		float32x4_t d = vminq_f32(vmulq_n_f32(vld1q_f32(powers), decay), maxD);
+		float32x4_t lastD = d;
+
+		uint32_t idx[4] = { phase, phase + inc, phase + 2 * inc, phase + 3 * inc };
+		uint32x4_t p = vld1q_u32(idx);
+		const uint32x4_t phaseStep = vdupq_n_u32(4 * inc);
+		const uint32x4_t fractionMask = vdupq_n_u32(WAVETABLE_FRACTION_MASK);
+
+		for (; k + 4 <= frames; k += 4) {
+			vst1q_u32(idx, vshrq_n_u32(p, WAVETABLE_FRACTION_BITS));
+			const float lanes0[4] = { wave[idx[0]], wave[idx[1]], wave[idx[2]], wave[idx[3]] };
+			const float lanes1[4] = { wave[idx[0] + 1], wave[idx[1] + 1], wave[idx[2] + 1], wave[idx[3] + 1] };
+			const float32x4_t s0 = vld1q_f32(lanes0);
+			const float32x4_t frac = vmulq_n_f32(vcvtq_f32_u32(vandq_u32(p, fractionMask)), FRACTION_SCALE);
+			const float32x4_t s = vmlaq_f32(s0, frac, vsubq_f32(vld1q_f32(lanes1), s0));
+			const uint32x4_t on = vcgtq_f32(d, threshold);
+			const float32x4_t v = vreinterpretq_f32_u32(vandq_u32(on, vreinterpretq_u32_f32(vmulq_f32(vmulq_f32(d, g), s))));
+			vst1q_f32(mix + k, vaddq_f32(vld1q_f32(mix + k), v));
+
+			lastD = d;
+			d = vminq_f32(vmulq_f32(d, factorStep), maxD);
+			p = vaddq_u32(p, phaseStep);
+		}
+
+		decay = vgetq_lane_f32(lastD, 3);
+		phase = vgetq_lane_u32(p, 0);
+	}
+	mixVoiceTail(wave, mix, k, frames, decay, decayFactor, gain, phase, inc);
+}
+#endif
+
+static VoiceKernel mixVoice = mixVoiceScalar;
+
+static MixerISA detectISA() {
+#if defined(MIXER_X86)
+#if defined(_MSC_VER) && !defined(__clang__)
+	int info[4];
+	__cpuid(info, 0);
+	const int maxLeaf = info[0];
+
+	__cpuid(info, 1);
+	const bool sse2 = (info[3] & (1 << 26)) != 0;
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+
+	bool avx2 = false;
+	if (maxLeaf >= 7 && osxsave && (_xgetbv(0) & 6) == 6) {
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+#else
+	__builtin_cpu_init();
+	const bool sse2 = __builtin_cpu_supports("sse2") != 0;
+	const bool avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+	if (avx2) return MIXER_AVX2;
+	if (sse2) return MIXER_SSE2;
+	return MIXER_SCALAR;
+#elif defined(MIXER_ARM_NEON)
+	// NEON is mandatory wherever it was enabled at build time
+	return MIXER_NEON;
+#else
+	return MIXER_SCALAR;
+#endif
+}
+
+MixerISA initMixer() {
+	MixerISA isa = detectISA();
+	switch (isa) {
+#ifdef MIXER_X86
+	case MIXER_AVX2:
+		mixVoice = mixVoiceAVX2;
+		break;
+	case MIXER_SSE2:
+		mixVoice = mixVoiceSSE2;
+		break;
+#endif
+#ifdef MIXER_ARM_NEON
+	case MIXER_NEON:
+		mixVoice = mixVoiceNEON;
+		break;
+#endif
+	default:
+		isa = MIXER_SCALAR;
+		mixVoice = mixVoiceScalar;
+	}
+	return isa;
+}
+
+const char* mixerISAName(const MixerISA isa) {
+	switch (isa) {
+	case MIXER_SSE2:
+		return "SSE2";
+	case MIXER_AVX2:
+		return "AVX2";
+	case MIXER_NEON:
+		return "NEON";
+	default:
+		return "scalar";
+	}
+}
+
+void mixBlock(paData* const data, float* out, unsigned long framesPerBuffer) {
+
+	// compact the sounding voices once per block
+	// instead of testing all MAX_SIMUL of them every frame
+	uint16_t numActive = 0;
+	for (uint16_t j = 0; j < MAX_SIMUL; ++j) {
+		if (data->currentDecayState[j] > MIN_DECAY_STATE)
+			data->activeVoices[numActive++] = j;
+	}
+	data->numActiveVoices = numActive;
+
+	while (framesPerBuffer > 0) {
+		const unsigned long frames = std::min(framesPerBuffer, static_cast<unsigned long>(MIX_BLOCK_FRAMES));
+
+		memset(data->mix, 0, frames * sizeof(float));
+		for (uint16_t i = 0; i < numActive; ++i) {
+			const uint16_t j = data->activeVoices[i];
+			mixVoice(data->wave[j], data->mix, frames, data->currentDecayState[j], data->decayFactor[j],
+				data->normalizedVel[j], data->phase[j], data->phaseIncrement[j]);
+		}
+
+		// one for each channel (ear) - interleaved output
+		for (unsigned long k = 0; k < frames; ++k) {
+			*out++ = data->mix[k];
+			*out++ = data->mix[k];
+		}
+
+		framesPerBuffer -= frames;
+	}
+}
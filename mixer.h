@@ -0,0 +1,79 @@
+/*******************************************************************
+*   mixer.h
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module mixes all sounding oscillator voices into the output
+// buffer. Rather than visiting every one of MAX_SIMUL voices for every
+// frame, it compacts the voices that are actually sounding into a list
+// once per block and then runs each voice across the whole block at
+// once, with the envelope, gain, phase increment and interpolated
+// wavetable lookup (see wavetable.h) done in SIMD (SSE2 or AVX2 on
+// x86, NEON on ARM) and clamped branchlessly.
+// The widest instruction set the CPU supports is picked at runtime.
+
+#ifndef MIXER_H
+#define MIXER_H
+
+// growth and decay constants
+// are to allow fade-in and -out
+// of sine waves to prevent pops
+#define GROWTH_FACTOR					(1.005f)
+#define SHRINK_FACTOR					(0.998f)
+#define INITIAL_DECAY_STATE				(0.00011f)
+
+#define MAX_DECAY_STATE					(1.0f)
+#define MIN_DECAY_STATE					(0.0001f)
+
+#define MAX_SIMUL						(200)
+
+// longest run mixed per voice at once.
+// longer host buffers are simply mixed in several passes
+#define MIX_BLOCK_FRAMES				(256)
+
+#include <cstdint>
+
+#include "wavetable.h"
+
+// data passed to audio callback
+struct paData {
+
+	// each voice's wavetable level, for its current increment
+	const float* wave[MAX_SIMUL];
+
+	float currentDecayState[MAX_SIMUL];
+	float decayFactor[MAX_SIMUL];
+	uint32_t phase[MAX_SIMUL];
+
+	float normalizedVel[MAX_SIMUL];
+	uint32_t phaseIncrement[MAX_SIMUL];
+
+	// voices sounding in the current block, compacted
+	uint16_t activeVoices[MAX_SIMUL];
+	uint16_t numActiveVoices;
+
+	// mono mix of the current block, before interleaving
+	float mix[MIX_BLOCK_FRAMES];
+};
+
+enum MixerISA {
+	MIXER_SCALAR,
+	MIXER_SSE2,
+	MIXER_AVX2,
+	MIXER_NEON
+};
+
+// detect and select the widest supported instruction set.
+// call once before the first mixBlock()
+MixerISA initMixer();
+const char* mixerISAName(const MixerISA isa);
+
+// mix all active voices into framesPerBuffer frames of
+// interleaved stereo output, advancing every voice's state
+void mixBlock(paData* const data, float* out, unsigned long framesPerBuffer);
+
+#endif
@@ -0,0 +1,213 @@
+/*******************************************************************
+*   mockSerial.cpp
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module emulates a floppy controller on the other end of a
+// serial link, so the whole floppy path (batching, encoding, the
+// writer thread, READY negotiation) can be run and load-tested
+// without an Arduino. Use it by naming a port in SERIAL_PORTS
+//   "mock[:<baud>[:<protocol>]]"
+// e.g. "mock", or "mock:115200:1" for a v1 sketch at 115200 baud.
+// The mock "calibrates" for MOCK_SERIAL_READY_DELAY_MS, then sends
+// the sketch's READY (and for v2, takes the host's version select).
+// Written bytes are clocked out at the simulated baud rate (10 bits
+// per byte, as 8N1) through a MOCK_SERIAL_BUFFER_BYTES TX buffer:
+// once that fills, writes stall just as a saturated real port's do,
+// which backs up Serial's queue and shows the queueing delay.
+// Every message received is timestamped at the moment its last byte
+// would have arrived. At teardown the mock prints its throughput
+// and link delay (handed to the port until fully received) and, if
+// MOCK_SERIAL_LOG_PREFIX is defined, writes every message with its
+// arrival time to a log file.
+
+#include "mockSerial.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+#include "serial.h"
+
+// bytes freed before a stalled write tries again
+// (a real tty wakes writers well before it is empty)
+#define MOCK_SERIAL_WAKE_BYTES			(256)
+
+// SerialPortName is wide on Windows; mock options are plain ASCII
+static std::string narrowPortName(SerialPortName port) {
+	std::string s;
+	for (; *port; ++port)
+		s += static_cast<char>(*port);
+	return s;
+}
+
+bool isMockSerialPort(SerialPortName port) {
+	return narrowPortName(port).compare(0, strlen(MOCK_SERIAL_PREFIX), MOCK_SERIAL_PREFIX) == 0;
+}
+
+MockTransport::MockTransport(SerialPortName port) : name(narrowPortName(port)), baud(MOCK_SERIAL_BAUD),
+	offeredVersion(MOCK_SERIAL_PROTOCOL), version(FLOPPY_PROTOCOL_V1), readySent(0), wireFreeNs(0), partialLength(0),
+	partialHandedNs(0), bytesReceived(0), controlMessages(0), stalls(0), firstHandedNs(0), linkDelay("Mock link delay") {
+
+	static std::atomic<size_t> numMocks(0);
+	index = numMocks.fetch_add(1, std::memory_order_relaxed);
+
+	// "mock[:<baud>[:<protocol>]]"
+	const char* opts = name.c_str() + strlen(MOCK_SERIAL_PREFIX);
+	if (*opts == ':') {
+		char* end;
+		const unsigned long b = strtoul(opts + 1, &end, 10);
+		if (b)
+			baud = static_cast<uint32_t>(b);
+		if (*end == ':') {
+			const unsigned long v = strtoul(end + 1, nullptr, 10);
+			if (v >= FLOPPY_PROTOCOL_V1 && v <= 255)
+				offeredVersion = static_cast<uint8_t>(v);
+		}
+	}
+
+	// 8N1: 10 bits on the wire per byte
+	byteNs = (10 * 1000000000LL + baud / 2) / baud;
+
+	if (offeredVersion >= FLOPPY_PROTOCOL_V2) {
+		const uint8_t announcement[FLOPPY_READY_BYTES] = { 'S', 'F', 'P', offeredVersion };
+		ready.assign(announcement, announcement + FLOPPY_READY_BYTES);
+	}
+	else {
+		// a v1 sketch sends any single byte
+		ready.push_back('R');
+	}
+
+	openedNs = latencyClockNs();
+	readyAtNs = openedNs + MOCK_SERIAL_READY_DELAY_MS * 1000000LL;
+	packets.reserve(65536);
+
+	std::cout << "Mock controller " << index << " on \"" << name << "\": " << baud << " baud, offering protocol v" << static_cast<unsigned>(offeredVersion) << "." << std::endl;
+}
+
+MockTransport::~MockTransport() {
+	std::cout << "Mock controller " << index << " (v" << static_cast<unsigned>(version) << "): " << packets.size() << " messages, " << bytesReceived << " bytes";
+	if (bytesReceived && wireFreeNs > firstHandedNs) {
+		const int64_t spanNs = wireFreeNs - firstHandedNs;
+		std::cout << " over " << static_cast<double>(spanNs) / 1e9 << " s ("
+			<< 100.0 * static_cast<double>(bytesReceived) * static_cast<double>(byteNs) / static_cast<double>(spanNs) << "% of link)";
+	}
+	std::cout << ", " << stalls << " stalls." << std::endl;
+	linkDelay.print();
+
+	writeLog();
+}
+
+void MockTransport::writeLog() const {
+#ifdef MOCK_SERIAL_LOG_PREFIX
+	const std::string path = MOCK_SERIAL_LOG_PREFIX + std::to_string(index) + ".txt";
+	std::ofstream log(path);
+	if (!log) {
+		std::cout << "ERROR: could not write mock serial log " << path << std::endl;
+		return;
+	}
+
+	// times from READY, so runs line up
+	log << "# " << name << ", protocol v" << static_cast<unsigned>(version) << ", " << baud << " baud" << std::endl;
+	log << "# arrival (us after READY), bytes" << std::endl;
+	log << std::setfill('0');
+	for (auto it = packets.begin(), end = packets.end(); it != end; ++it) {
+		const int64_t us = (it->arrivalNs - readyAtNs) / 1000;
+		log << us;
+		for (uint8_t i = 0; i < it->length; ++i)
+			log << ' ' << std::hex << std::setw(2) << static_cast<unsigned>(it->bytes[i]) << std::dec;
+		log << '\n';
+	}
+#endif
+}
+
+// main thread only (READY handshake)
+long long MockTransport::read(void* const buffer, const unsigned long numBytes) {
+	if (readySent == ready.size() || latencyClockNs() < readyAtNs)
+		return -1;
+
+	size_t n = ready.size() - readySent;
+	if (n > numBytes)
+		n = numBytes;
+	memcpy(buffer, &ready[readySent], n);
+	readySent += n;
+	return static_cast<long long>(n);
+}
+
+void MockTransport::receive(const uint8_t byte, const int64_t handedNs, const int64_t arrivalNs) {
+	++bytesReceived;
+	if (partialLength == 0)
+		partialHandedNs = handedNs;
+	partial[partialLength++] = byte;
+
+	// control messages (i.e. the version select) are always v2-framed,
+	// even before one has switched a v2 sketch out of v1
+	const bool control = offeredVersion >= FLOPPY_PROTOCOL_V2 && partial[0] == (FLOPPY_V2_OP_EXTENDED | FLOPPY_V2_CONTROL_DRIVE);
+	const size_t length = floppyMessageLength(control ? FLOPPY_PROTOCOL_V2 : version, partial, partialLength);
+	if (length == 0 || partialLength < length)
+		return;
+
+	if (control) {
+		++controlMessages;
+		if (partial[1] == FLOPPY_V2_SUB_SELECT_VERSION && partial[2] >= FLOPPY_PROTOCOL_V1 && partial[2] <= offeredVersion)
+			version = partial[2];
+	}
+	else {
+		MockPacket p;
+		p.arrivalNs = arrivalNs;
+		p.length = static_cast<uint8_t>(length);
+		memcpy(p.bytes, partial, length);
+		packets.push_back(p);
+		linkDelay.record(arrivalNs - partialHandedNs);
+	}
+	partialLength = 0;
+}
+
+// writer thread only
+SerialWriteResult MockTransport::write(const uint8_t* buffer, size_t numBytes, const std::function<bool()>& giveUp) {
+	SerialWriteResult r = { 0, 0, 0, false };
+
+	while (numBytes) {
+		++r.writes;
+		const int64_t now = latencyClockNs();
+		if (firstHandedNs == 0)
+			firstHandedNs = now;
+
+		// an idle link starts clocking out right away
+		if (wireFreeNs < now)
+			wireFreeNs = now;
+
+		const int64_t buffered = (wireFreeNs - now + byteNs - 1) / byteNs;
+		if (buffered >= MOCK_SERIAL_BUFFER_BYTES) {
+			// saturated: wait for some room, as poll() would
+			++r.stalls;
+			++stalls;
+			if (giveUp())
+				return r;
+
+			int64_t waitNs = (buffered - MOCK_SERIAL_BUFFER_BYTES + MOCK_SERIAL_WAKE_BYTES) * byteNs;
+			if (waitNs > SERIAL_POLL_TIMEOUT_MS * 1000000LL)
+				waitNs = SERIAL_POLL_TIMEOUT_MS * 1000000LL;
+			std::this_thread::sleep_for(std::chrono::nanoseconds(waitNs));
+			continue;
+		}
+
+		size_t n = static_cast<size_t>(MOCK_SERIAL_BUFFER_BYTES - buffered);
+		if (n > numBytes)
+			n = numBytes;
+		for (size_t i = 0; i < n; ++i) {
+			wireFreeNs += byteNs;
+			receive(buffer[i], now, wireFreeNs);
+		}
+		buffer += n;
+		numBytes -= n;
+		r.bytesWritten += n;
+	}
+
+	r.ok = true;
+	return r;
+}
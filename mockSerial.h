@@ -0,0 +1,118 @@
+/*******************************************************************
+*   mockSerial.h
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module emulates a floppy controller on the other end of a
+// serial link, so the whole floppy path (batching, encoding, the
+// writer thread, READY negotiation) can be run and load-tested
+// without an Arduino. Use it by naming a port in SERIAL_PORTS
+//   "mock[:<baud>[:<protocol>]]"
+// e.g. "mock", or "mock:115200:1" for a v1 sketch at 115200 baud.
+// The mock "calibrates" for MOCK_SERIAL_READY_DELAY_MS, then sends
+// the sketch's READY (and for v2, takes the host's version select).
+// Written bytes are clocked out at the simulated baud rate (10 bits
+// per byte, as 8N1) through a MOCK_SERIAL_BUFFER_BYTES TX buffer:
+// once that fills, writes stall just as a saturated real port's do,
+// which backs up Serial's queue and shows the queueing delay.
+// Every message received is timestamped at the moment its last byte
+// would have arrived. At teardown the mock prints its throughput
+// and link delay (handed to the port until fully received) and, if
+// MOCK_SERIAL_LOG_PREFIX is defined, writes every message with its
+// arrival time to a log file.
+
+#ifndef MOCKSERIAL_H
+#define MOCKSERIAL_H
+
+// port names starting with this open a mock controller
+#define MOCK_SERIAL_PREFIX				"mock"
+
+// defaults for a bare "mock" port
+#define MOCK_SERIAL_BAUD				(250000)
+#define MOCK_SERIAL_PROTOCOL			(FLOPPY_PROTOCOL_MAX_VERSION)
+
+// emulated drive calibration before READY
+#define MOCK_SERIAL_READY_DELAY_MS		(250)
+
+// bytes the link takes before writes stall
+#define MOCK_SERIAL_BUFFER_BYTES		(4096)
+
+// log each mock controller's received messages to
+// <prefix><controller>.txt (comment out to disable)
+#define MOCK_SERIAL_LOG_PREFIX			"mock_serial_"
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "floppyProtocol.h"
+#include "latencyHistogram.h"
+#include "serialTransport.h"
+
+struct MockPacket {
+	// latencyClockNs() of the last byte's arrival
+	int64_t arrivalNs;
+	uint8_t length;
+	uint8_t bytes[FLOPPY_MAX_MESSAGE_BYTES];
+};
+
+class MockTransport : public SerialTransport {
+private:
+	std::string name;
+	size_t index;
+
+	uint32_t baud;
+	int64_t byteNs;
+
+	// offered in READY; negotiated is v1 until a select arrives
+	uint8_t offeredVersion;
+	uint8_t version;
+
+	int64_t openedNs;
+	int64_t readyAtNs;
+	std::vector<uint8_t> ready;
+	size_t readySent;
+
+	// when the last byte accepted so far will have arrived
+	int64_t wireFreeNs;
+
+	// message being received, and when its first byte was handed over
+	uint8_t partial[FLOPPY_MAX_MESSAGE_BYTES];
+	size_t partialLength;
+	int64_t partialHandedNs;
+
+	std::vector<MockPacket> packets;
+	uint64_t bytesReceived, controlMessages, stalls;
+	int64_t firstHandedNs;
+
+	LatencyHistogram linkDelay;
+
+	void receive(const uint8_t byte, const int64_t handedNs, const int64_t arrivalNs);
+
+	void writeLog() const;
+
+public:
+	explicit MockTransport(SerialPortName port);
+	~MockTransport();
+
+	MockTransport(const MockTransport&) = delete;
+	MockTransport& operator=(const MockTransport&) = delete;
+
+	bool isOpen() const { return true; }
+	long long read(void* const buffer, const unsigned long numBytes);
+	SerialWriteResult write(const uint8_t* buffer, size_t numBytes, const std::function<bool()>& giveUp);
+};
+
+bool isMockSerialPort(SerialPortName port);
+
+#endif
@@ -20,98 +20,178 @@ static int patestCallback(const void *inputBuffer, void *outputBuffer,
 	PaStreamCallbackFlags statusFlags,
 	void *userData)
 {
-	paData *data = reinterpret_cast<paData*>(userData);
-	float *out = reinterpret_cast<float*>(outputBuffer);
-	float cumulativeOut;
-
-	// for each frame to construct
-	for (unsigned long i = 0; i < framesPerBuffer; ++i) {
-		cumulativeOut = 0.0f;
-		// for each possibly playing stream
-		for (unsigned long j = 0; j < MAX_SIMUL; ++j) {
-			// if the stream is active
-			if (data->currentDecayState[j] > MIN_DECAY_STATE) {
-				// update its decay state
-				data->currentDecayState[j] *= data->decayFactor[j];
-				// cap the decay state at MAX if it's larger than that
-				if (data->currentDecayState[j] > MAX_DECAY_STATE) data->currentDecayState[j] = MAX_DECAY_STATE;
-
-				// add this stream's current amplitude to the total current wave position
-				cumulativeOut += data->currentDecayState[j] * data->normalizedVel[j] * data->sine[data->phase[j]];
-
-				// increment this stream's phase
-				data->phase[j] += data->phaseIncrement[j];
-
-				// wrap the table (single period of sine wave)
-				if (data->phase[j] >= TABLE_SIZE) data->phase[j] -= TABLE_SIZE;
+	const int64_t startNs = latencyClockNs();
+	reinterpret_cast<Stream*>(userData)->render(reinterpret_cast<float*>(outputBuffer), framesPerBuffer);
+	audioCallbackDuration.record(latencyClockNs() - startNs);
+	return paContinue;
+}
+
+static int64_t nowNs() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// producers never touch paData directly, so a
+// change can't tear across a block being mixed
+void Stream::pushCommand(const VoiceCommandType type, const uint16_t idx, const uint32_t phaseIncrement, const float gain) {
+	VoiceCommand cmd;
+	cmd.timeNs = nowNs();
+	cmd.idx = idx;
+	cmd.type = type;
+	if (type == VOICE_SET_GAIN)
+		cmd.gain = gain;
+	else
+		cmd.phaseIncrement = phaseIncrement;
+
+	// offline, everything up to now has already been rendered,
+	// so the change is due immediately
+	if (offline) {
+		applyCommand(cmd);
+		return;
+	}
+
+	// only full if the callback has stalled for thousands of
+	// events; wait (on this non-real-time thread) rather than
+	// lose a note-off
+	while (!commands.push(cmd))
+		std::this_thread::yield();
+}
+
+void Stream::applyCommand(const VoiceCommand& cmd) {
+	switch (cmd.type) {
+	case VOICE_START:
+		if (data.currentDecayState[cmd.idx] < MIN_DECAY_STATE) {
+			data.phase[cmd.idx] = 0;
+			data.currentDecayState[cmd.idx] = INITIAL_DECAY_STATE;
+		}
+		data.decayFactor[cmd.idx] = GROWTH_FACTOR;
+		break;
+
+	// don't actually stop audio (would pop)
+	// instead let the stream start shrinking in
+	// amplitude naturally
+	case VOICE_STOP:
+		data.decayFactor[cmd.idx] = SHRINK_FACTOR;
+		break;
+
+	case VOICE_SET_INCREMENT:
+		data.phaseIncrement[cmd.idx] = cmd.phaseIncrement;
+		data.wave[cmd.idx] = wavetableFor(cmd.phaseIncrement);
+		break;
+
+	case VOICE_SET_GAIN:
+		data.normalizedVel[cmd.idx] = cmd.gain;
+	}
+}
+
+// output runs a constant one block behind real time, so a
+// command requested at time t lands at t + one block exactly,
+// at its own sample rather than at the start of whichever
+// block happens to be next
+void Stream::render(float* out, const unsigned long framesPerBuffer) {
+	const int64_t blockTimeNs = nowNs();
+	unsigned long done = 0;
+
+	while (done < framesPerBuffer) {
+		unsigned long until = framesPerBuffer;
+
+		for (;;) {
+			if (!hasPendingCommand && !(hasPendingCommand = commands.pop(pendingCommand)))
+				break;
+
+			const double offset = static_cast<double>(pendingCommand.timeNs - blockTimeNs) * SAMPLE_RATE / NANOSECONDS_PER_SECOND + static_cast<double>(framesPerBuffer);
+			if (offset <= static_cast<double>(done)) {
+				applyCommand(pendingCommand);
+				hasPendingCommand = false;
+			}
+			else {
+				// due later in this block, or in a later block
+				if (offset < static_cast<double>(framesPerBuffer))
+					until = static_cast<unsigned long>(offset);
+				break;
 			}
 		}
 
-		// one for each channel (ear) - interleaved output
-		*out++ = cumulativeOut;
-		*out++ = cumulativeOut;
+		// always make progress
+		if (until <= done)
+			until = done + 1;
 
+		mixBlock(&data, out + 2 * done, until - done);
+		done = until;
 	}
-	return paContinue;
 }
 
 Stream::~Stream() {
+	if (offline)
+		return;
+
 	Pa_StopStream(stream);
 	Pa_CloseStream(stream);
 	Pa_Terminate();
 }
 
 void Stream::startAudio(const uint16_t idx) {
-	if (data.currentDecayState[idx] < MIN_DECAY_STATE) {
-		data.phase[idx] = 0;
-		data.currentDecayState[idx] = INITIAL_DECAY_STATE;
-	}
-	data.decayFactor[idx] = GROWTH_FACTOR;
+	pushCommand(VOICE_START, idx, 0, 0.0f);
 }
 
-// don't actually stop audio (would pop)
-// instead let the stream start shrinking in
-// amplitude naturally
 void Stream::stopAudio(const uint16_t idx) {
-	data.decayFactor[idx] = SHRINK_FACTOR;
+	pushCommand(VOICE_STOP, idx, 0, 0.0f);
+}
+
+// phase units (one period = WAVETABLE_PHASE_SPAN) per sample
+static uint32_t phaseIncrementFor(const double freq) {
+	return static_cast<uint32_t>((freq * WAVETABLE_PHASE_SPAN / SAMPLE_RATE) + 0.5);
 }
 
 void Stream::setPitchBend(const uint16_t idx, const double pitchBend) {
 	this->pitchBend[idx] = pitchBend;
-	data.phaseIncrement[idx] = static_cast<unsigned long>((noteFreq[idx] * pitchBend * fTABLE_SIZE / SAMPLE_RATE) + 0.5);
+	pushCommand(VOICE_SET_INCREMENT, idx, phaseIncrementFor(noteFreq[idx] * pitchBend), 0.0f);
 }
 
 void Stream::setFreqs(const uint16_t idx, const double freq, const double pitchBend) {
 	this->noteFreq[idx]			= freq;
 	this->pitchBend[idx]		= pitchBend;
-	data.phaseIncrement[idx]	= static_cast<unsigned long>((freq * pitchBend * fTABLE_SIZE / SAMPLE_RATE) + 0.5);
+	pushCommand(VOICE_SET_INCREMENT, idx, phaseIncrementFor(freq * pitchBend), 0.0f);
 }
 
 void Stream::setChannelExpression(const uint16_t idx, const uint8_t channelExpression) {
 	this->channelExpression[idx] = channelExpression;
-	data.normalizedVel[idx] = static_cast<float>(noteVel[idx]) / OVERHEAD_MAX * static_cast<float>(channelVel[idx]) / MAX_VEL * static_cast<float>(channelExpression) / MAX_VEL;
+	pushCommand(VOICE_SET_GAIN, idx, 0, static_cast<float>(noteVel[idx]) / OVERHEAD_MAX * static_cast<float>(channelVel[idx]) / MAX_VEL * static_cast<float>(channelExpression) / MAX_VEL);
 }
 
 void Stream::setChannelVel(const uint16_t idx, const uint8_t channelVel) {
 	this->channelVel[idx]	= channelVel;
-	data.normalizedVel[idx] = static_cast<float>(noteVel[idx]) / OVERHEAD_MAX * static_cast<float>(channelVel) / MAX_VEL * static_cast<float>(channelExpression[idx]) / MAX_VEL;
+	pushCommand(VOICE_SET_GAIN, idx, 0, static_cast<float>(noteVel[idx]) / OVERHEAD_MAX * static_cast<float>(channelVel) / MAX_VEL * static_cast<float>(channelExpression[idx]) / MAX_VEL);
 }
 
 void Stream::setVels(const uint16_t idx, const uint8_t channelExpression, const uint8_t channelVel, const uint8_t noteVel) {
 	this->channelExpression[idx]	= channelExpression;
 	this->channelVel[idx]			= channelVel;
 	this->noteVel[idx]				= noteVel;
-	data.normalizedVel[idx]			= static_cast<float>(noteVel) / OVERHEAD_MAX * static_cast<float>(channelVel) / MAX_VEL * static_cast<float>(channelExpression) / MAX_VEL;
+	pushCommand(VOICE_SET_GAIN, idx, 0, static_cast<float>(noteVel) / OVERHEAD_MAX * static_cast<float>(channelVel) / MAX_VEL * static_cast<float>(channelExpression) / MAX_VEL);
 }
 
-// high-resolution table of single, complete sine period
-void Stream::initSineTable() {
-	for (size_t i = 0; i < TABLE_SIZE; ++i) {
-		data.sine[i] = static_cast<float>(sin(static_cast<double>(i) / fTABLE_SIZE * M_PI * 2.0));
+Stream::Stream(const bool offline) : offline(offline) {
+	std::cout << "Mixing " << waveformName() << " voices with " << mixerISAName(initMixer()) << "." << std::endl;
+
+	// voice state must be settled before the callback can run
+	hasPendingCommand = false;
+	for (size_t i = 0; i < MAX_SIMUL; ++i) {
+		data.phase[i] = 0;
+		data.phaseIncrement[i] = 0;
+		data.wave[i] = wavetableFor(0);
+		data.currentDecayState[i] = 0.0f;
+		data.decayFactor[i] = SHRINK_FACTOR;
+		data.normalizedVel[i] = 0.0f;
+		noteVel[i] = channelVel[i] = channelExpression[i] = 0;
+		noteFreq[i] = 0.0;
+		pitchBend[i] = 1.0;
+	}
+
+	if (offline) {
+		streamInitialized = true;
+		return;
 	}
-}
 
-Stream::Stream() {
 	err = Pa_Initialize();
 	if (err != paNoError)
 		goto error;
@@ -138,7 +218,7 @@ Stream::Stream() {
 		AUTO_FRAMES_PER_BUFFER,
 		paNoFlag,
 		patestCallback,
-		&data);
+		this);
 	if (err != paNoError) goto error;
 
 	// decrease pops on linux
@@ -154,11 +234,6 @@ Stream::Stream() {
 	// sleep to let asio/alsa initialize
 	std::this_thread::sleep_for(std::chrono::milliseconds(MS_TO_WAIT_AFTER_STREAM_LAUNCH));
 
-	for (size_t i = 0; i < MAX_SIMUL; ++i) {
-		data.phase[i] = 0;
-		data.currentDecayState[i] = INITIAL_DECAY_STATE;
-	}
-
 	return;
 
 error:
@@ -17,57 +17,65 @@
 
 #define _USE_MATH_DEFINES
 
-#define TABLE_SIZE						(100000)
-#define fTABLE_SIZE						(100000.0)
 #define SAMPLE_RATE						(44100.0)
 #define AUTO_FRAMES_PER_BUFFER			(0)
 
-// growth and decay constants
-// are to allow fade-in and -out
-// of sine waves to prevent pops
-#define GROWTH_FACTOR					(1.005f)
-#define SHRINK_FACTOR					(0.998f)
-#define INITIAL_DECAY_STATE				(0.00011f)
-
-#define MAX_DECAY_STATE					(1.0f)
-#define MIN_DECAY_STATE					(0.0001f)
-
-#define MAX_SIMUL						(200)
 #define ENABLE_REALTIME_SCHEDULING		(1)
 #define MS_TO_WAIT_AFTER_STREAM_LAUNCH	(500)
 
+// voice changes in flight between the MIDI scheduler
+// and the audio callback. must be a power of 2
+#define VOICE_COMMAND_QUEUE_SIZE		(4096)
+
 #define MAX_VEL (127.0f)
 // can/should be set higher than actual max (127.0)
 // to produce quieter output
 // and prevent pops/clipping
 #define OVERHEAD_MAX (1500.0f)
 
+#define NANOSECONDS_PER_SECOND (1000000000.0)
+
+#include <chrono>
 #include <cstdint>
 #include <iostream>
 #include <math.h>
 #include <thread>
 #include <vector>
 
+#include "latencyHistogram.h"
+#include "lockFreeQueue.h"
+#include "mixer.h"
 #include "portaudio.h"
 
 #ifdef __linux__
 #include "pa_linux_alsa.h"
 #endif
 
-// data passed to audio callback
-struct paData {
-
-	float sine[TABLE_SIZE];
+enum VoiceCommandType : uint8_t {
+	VOICE_START,
+	VOICE_STOP,
+	VOICE_SET_INCREMENT,
+	VOICE_SET_GAIN
+};
 
-	float currentDecayState[MAX_SIMUL];
-	float decayFactor[MAX_SIMUL];
-	unsigned long phase[MAX_SIMUL];
+// a timestamped change to a single voice, queued by the
+// MIDI side and applied by the audio callback at the
+// sample matching its timestamp
+struct VoiceCommand {
+	// steady_clock time the change was requested
+	int64_t timeNs;
 
-	float normalizedVel[MAX_SIMUL];
-	unsigned long phaseIncrement[MAX_SIMUL];
+	union {
+		uint32_t phaseIncrement;
+		float gain;
+	};
 
+	uint16_t idx;
+	VoiceCommandType type;
 };
 
+// the audio callback is the only thing that ever touches
+// paData. everyone else goes through the command queue
 class Stream {
 private:
 	PaStreamParameters outputParameters;
@@ -75,6 +83,10 @@ private:
 	PaError err;
 	paData data;
 
+	// no device: render() is pulled by an offline renderer
+	// on the same thread that issues commands
+	bool offline;
+
 	uint8_t noteVel[MAX_SIMUL];
 	uint8_t channelVel[MAX_SIMUL];
 	uint8_t channelExpression[MAX_SIMUL];
@@ -82,15 +94,22 @@ private:
 	double noteFreq[MAX_SIMUL];
 	double pitchBend[MAX_SIMUL];
 
+	LockFreeQueue<VoiceCommand, VOICE_COMMAND_QUEUE_SIZE> commands;
+
+	// popped but not yet due (audio callback only)
+	VoiceCommand pendingCommand;
+	bool hasPendingCommand;
+
+	void pushCommand(const VoiceCommandType type, const uint16_t idx, const uint32_t phaseIncrement, const float gain);
+	void applyCommand(const VoiceCommand& cmd);
+
 public:
 
 	bool streamInitialized;
 
-	Stream();
+	Stream(const bool offline = false);
 	~Stream();
 
-
-	void initSineTable();
 	const PaStream* getStream() const;
 	void setFreqs(const uint16_t idx, const double freq, const double pitchBend);
 	void setChannelVel(const uint16_t idx, const uint8_t channelVel);
@@ -100,6 +119,9 @@ public:
 	void startAudio(const uint16_t idx);
 	void stopAudio(const uint16_t idx);
 
+	// audio callback (or offline renderer) only: apply due commands and mix
+	void render(float* out, const unsigned long framesPerBuffer);
+
 };
 
 #endif
@@ -0,0 +1,87 @@
+/*******************************************************************
+*   packetBatch.h
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module collects the floppy updates generated during one
+// scheduler tick so they can go out in a single serial write instead
+// of one syscall (and USB frame) each. A drive only ever needs its
+// latest state, so a second update for the same drive within a tick
+// (i.e. repeated pitch bend refreshes, or off-then-on) replaces the
+// first in place rather than being sent as well.
+
+#ifndef PACKETBATCH_H
+#define PACKETBATCH_H
+
+// drive ids are a byte, so a tick
+// can never hold more than this many
+#define MAX_BATCH_PACKETS				(256)
+#define NO_BATCH_SLOT					(0xFFFF)
+
+#include <cstddef>
+#include <cstdint>
+
+#include "floppyProtocol.h"
+
+class PacketBatch {
+private:
+	FloppyMessage packets[MAX_BATCH_PACKETS];
+	uint16_t numPackets;
+
+	// where each drive's packet sits in packets, if anywhere
+	uint16_t slotOfDrive[MAX_BATCH_PACKETS];
+
+	// stats since construction or resetStats()
+	uint64_t numAdded, numCollapsed, numFlushes;
+
+public:
+	PacketBatch() : numPackets(0), numAdded(0), numCollapsed(0), numFlushes(0) {
+		for (size_t i = 0; i < MAX_BATCH_PACKETS; ++i)
+			slotOfDrive[i] = NO_BATCH_SLOT;
+	}
+
+	void add(const FloppyMessage& packet) {
+		const uint8_t drive = packet.drive;
+		++numAdded;
+
+		if (slotOfDrive[drive] != NO_BATCH_SLOT) {
+			FloppyMessage& slot = packets[slotOfDrive[drive]];
+
+			// a refresh after a new note in the same tick
+			// is still a new note
+			const bool wasNoteOn = slot.type == FLOPPY_NOTE_ON;
+			slot = packet;
+			if (wasNoteOn && slot.type == FLOPPY_UPDATE)
+				slot.type = FLOPPY_NOTE_ON;
+			++numCollapsed;
+		}
+		else {
+			slotOfDrive[drive] = numPackets;
+			packets[numPackets++] = packet;
+		}
+	}
+
+	// call once the batch has been written
+	void clear() {
+		for (uint16_t i = 0; i < numPackets; ++i)
+			slotOfDrive[packets[i].drive] = NO_BATCH_SLOT;
+		numPackets = 0;
+		++numFlushes;
+	}
+
+	bool empty() const { return numPackets == 0; }
+	size_t size() const { return numPackets; }
+	const FloppyMessage* data() const { return packets; }
+
+	uint64_t added() const { return numAdded; }
+	uint64_t collapsed() const { return numCollapsed; }
+	uint64_t flushes() const { return numFlushes; }
+
+	void resetStats() { numAdded = numCollapsed = numFlushes = 0; }
+};
+
+#endif
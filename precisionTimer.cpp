@@ -0,0 +1,157 @@
+/*******************************************************************
+*   precisionTimer.cpp
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module provides the scheduler's high-precision wait.
+// sleep_until alone overshoots by 1-15 ms depending on the OS timer
+// (slack on Linux, timeBeginPeriod on Windows), which is audible on
+// fast passages. Instead, the timer sleeps coarsely until a spin
+// window before the deadline, then spins on the monotonic clock
+// (steady_clock, i.e. vDSO clock_gettime / QPC) for the rest.
+// Every sleep's overshoot is recorded, and the spin window is
+// recalibrated to cover nearly all of them, so it stays as small as
+// this machine allows. Lateness of every wait is kept for the stats.
+
+#include "precisionTimer.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#define CPU_RELAX() _mm_pause()
+#else
+#define CPU_RELAX()
+#endif
+
+#define NS_PER_US						(1000)
+
+PrecisionTimer::PrecisionTimer() : spinNs(TIMER_INITIAL_SPIN_US * NS_PER_US), numOvershoots(0), numWaits(0),
+	numLate(0), numSpins(0), numRecalibrations(0), maxLatenessNs(0), totalLatenessNs(0.0) {
+#ifdef _WIN32
+	// 1 ms scheduler tick instead of the default ~15.6 ms
+	periodSet = timeBeginPeriod(1) == TIMERR_NOERROR;
+#endif
+}
+
+PrecisionTimer::~PrecisionTimer() {
+#ifdef _WIN32
+	if (periodSet)
+		timeEndPeriod(1);
+#endif
+}
+
+void PrecisionTimer::configureThread() {
+#ifdef TIMER_PIN_TO_CORE
+#ifdef _WIN32
+	if (SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << TIMER_PIN_TO_CORE) == 0)
+		std::cout << "Could not pin scheduler to core " << TIMER_PIN_TO_CORE << " (error " << GetLastError() << ")." << std::endl;
+#else
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(TIMER_PIN_TO_CORE, &cpus);
+	const int err = pthread_setaffinity_np(pthread_self(), sizeof cpus, &cpus);
+	if (err)
+		std::cout << "Could not pin scheduler to core " << TIMER_PIN_TO_CORE << " (error " << err << ")." << std::endl;
+#endif
+	else
+		std::cout << "Scheduler pinned to core " << TIMER_PIN_TO_CORE << "." << std::endl;
+#endif
+
+#ifdef TIMER_REALTIME_PRIORITY
+#ifdef _WIN32
+	if (!SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL))
+		std::cout << "Could not raise scheduler priority (error " << GetLastError() << ")." << std::endl;
+#else
+	sched_param param = {};
+	param.sched_priority = TIMER_REALTIME_PRIORITY;
+	const int prioErr = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (prioErr)
+		std::cout << "Could not make scheduler SCHED_FIFO (error " << prioErr << "; needs CAP_SYS_NICE or an rtprio limit)." << std::endl;
+#endif
+	else
+		std::cout << "Scheduler running at real-time priority." << std::endl;
+#endif
+}
+
+int64_t PrecisionTimer::waitUntil(const Clock::time_point deadline) {
+	Clock::time_point now = Clock::now();
+
+	// coarse sleep, up to the spin window...
+	const Clock::time_point wake = deadline - std::chrono::nanoseconds(spinNs);
+	if (now < wake) {
+		std::this_thread::sleep_until(wake);
+		now = Clock::now();
+		recordOvershoot(std::chrono::duration_cast<std::chrono::nanoseconds>(now - wake).count());
+	}
+
+	// ...then spin for the rest
+	if (now < deadline) {
+		++numSpins;
+		do {
+			CPU_RELAX();
+			now = Clock::now();
+		} while (now < deadline);
+	}
+
+	const int64_t latenessNs = std::chrono::duration_cast<std::chrono::nanoseconds>(now - deadline).count();
+	++numWaits;
+	totalLatenessNs += static_cast<double>(latenessNs);
+	if (latenessNs > maxLatenessNs)
+		maxLatenessNs = latenessNs;
+	if (latenessNs > TIMER_LATE_THRESHOLD_US * NS_PER_US)
+		++numLate;
+
+	return latenessNs;
+}
+
+void PrecisionTimer::recordOvershoot(const int64_t ns) {
+	overshootNs[numOvershoots % TIMER_CALIBRATION_WINDOW] = ns;
+	++numOvershoots;
+
+	// a sleep that ran past the whole window made this
+	// wait late: widen right away instead of waiting
+	if (ns + TIMER_SPIN_GUARD_US * NS_PER_US > spinNs) {
+		spinNs = std::min<int64_t>(ns + TIMER_SPIN_GUARD_US * NS_PER_US, TIMER_MAX_SPIN_US * NS_PER_US);
+		++numRecalibrations;
+	}
+	// otherwise, shrink to fit every so often
+	else if (numOvershoots % (TIMER_CALIBRATION_WINDOW / 4) == 0 && numOvershoots >= TIMER_CALIBRATION_WINDOW) {
+		recalibrate();
+	}
+}
+
+void PrecisionTimer::recalibrate() {
+	int64_t sorted[TIMER_CALIBRATION_WINDOW];
+	std::copy(overshootNs, overshootNs + TIMER_CALIBRATION_WINDOW, sorted);
+
+	const size_t k = static_cast<size_t>(TIMER_CALIBRATION_PERCENTILE * (TIMER_CALIBRATION_WINDOW - 1));
+	std::nth_element(sorted, sorted + k, sorted + TIMER_CALIBRATION_WINDOW);
+
+	int64_t window = sorted[k] + TIMER_SPIN_GUARD_US * NS_PER_US;
+	window = std::max<int64_t>(window, TIMER_MIN_SPIN_US * NS_PER_US);
+	window = std::min<int64_t>(window, TIMER_MAX_SPIN_US * NS_PER_US);
+
+	if (window != spinNs) {
+		spinNs = window;
+		++numRecalibrations;
+	}
+}
+
+void PrecisionTimer::printStats(const char* name) const {
+	const double meanUs = numWaits ? totalLatenessNs / static_cast<double>(numWaits) / NS_PER_US : 0.0;
+	std::cout << name << " timing: " << numWaits << " waits (" << numSpins << " spun), mean lateness "
+		<< meanUs << " us, max " << static_cast<double>(maxLatenessNs) / NS_PER_US << " us, "
+		<< numLate << " over " << TIMER_LATE_THRESHOLD_US << " us; spin window "
+		<< static_cast<double>(spinNs) / NS_PER_US << " us after " << numRecalibrations << " recalibrations." << std::endl;
+}
+
+void PrecisionTimer::resetStats() {
+	numWaits = numLate = numSpins = numRecalibrations = 0;
+	maxLatenessNs = 0;
+	totalLatenessNs = 0.0;
+}
@@ -0,0 +1,110 @@
+/*******************************************************************
+*   precisionTimer.h
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module provides the scheduler's high-precision wait.
+// sleep_until alone overshoots by 1-15 ms depending on the OS timer
+// (slack on Linux, timeBeginPeriod on Windows), which is audible on
+// fast passages. Instead, the timer sleeps coarsely until a spin
+// window before the deadline, then spins on the monotonic clock
+// (steady_clock, i.e. vDSO clock_gettime / QPC) for the rest.
+// Every sleep's overshoot is recorded, and the spin window is
+// recalibrated to cover nearly all of them, so it stays as small as
+// this machine allows. Lateness of every wait is kept for the stats.
+
+#ifndef PRECISIONTIMER_H
+#define PRECISIONTIMER_H
+
+// spin window before any calibration
+#define TIMER_INITIAL_SPIN_US			(2000)
+
+// calibration never goes outside these
+#define TIMER_MIN_SPIN_US				(100)
+#define TIMER_MAX_SPIN_US				(20000)
+
+// recalibrate from this many recent sleep overshoots...
+#define TIMER_CALIBRATION_WINDOW		(256)
+
+// ...so the window covers this fraction of them...
+#define TIMER_CALIBRATION_PERCENTILE	(0.99)
+
+// ...plus this much
+#define TIMER_SPIN_GUARD_US				(100)
+
+// waits ending later than this count as late
+#define TIMER_LATE_THRESHOLD_US			(500)
+
+// uncomment to pin the scheduler thread to this core
+// (ideally one isolated from the rest of the system)
+//#define TIMER_PIN_TO_CORE				(3)
+
+// uncomment to run the scheduler thread as SCHED_FIFO at this
+// priority (Linux, needs CAP_SYS_NICE or an rtprio limit) or
+// as THREAD_PRIORITY_TIME_CRITICAL (Windows)
+//#define TIMER_REALTIME_PRIORITY		(80)
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+class PrecisionTimer {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+private:
+	int64_t spinNs;
+
+	// ring of recent sleep overshoots
+	int64_t overshootNs[TIMER_CALIBRATION_WINDOW];
+	size_t numOvershoots;
+
+	uint64_t numWaits, numLate, numSpins, numRecalibrations;
+	int64_t maxLatenessNs;
+	double totalLatenessNs;
+
+#ifdef _WIN32
+	bool periodSet;
+#endif
+
+	void recordOvershoot(const int64_t ns);
+	void recalibrate();
+
+public:
+	PrecisionTimer();
+	~PrecisionTimer();
+
+	PrecisionTimer(const PrecisionTimer&) = delete;
+	PrecisionTimer& operator=(const PrecisionTimer&) = delete;
+
+	// apply TIMER_PIN_TO_CORE and TIMER_REALTIME_PRIORITY, if set,
+	// to the calling thread. failures are reported, not fatal
+	void configureThread();
+
+	// returns once deadline has passed, as soon after as possible.
+	// returns the lateness in ns
+	int64_t waitUntil(const Clock::time_point deadline);
+
+	int64_t spinWindowNs() const { return spinNs; }
+
+	void printStats(const char* name) const;
+
+	// zero the counters printStats reports (i.e. between songs),
+	// keeping the calibrated spin window
+	void resetStats();
+};
+
+#endif
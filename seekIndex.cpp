@@ -0,0 +1,141 @@
+/*******************************************************************
+*   seekIndex.cpp
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module lets playback start anywhere in a song (and loop a
+// section of it) without playing everything before. One pass over
+// the merged timeline snapshots, every SEEK_CHECKPOINT_MS of song
+// time, each channel's program, volume, expression and pitch bend,
+// and which notes are held, at what velocity. The state at any time
+// is then a binary search for the checkpoint before it plus a
+// replay, of state only, of the events in between.
+// Tempo needs no snapshot: timeline times are already absolute.
+
+#include "seekIndex.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "MIDI.h"
+
+// what playMidiEvent would leave each channel with
+struct SeekMirror {
+	SeekChannelState channels[NUM_CHANNELS];
+
+	// 0 if not held
+	uint8_t velocity[NUM_CHANNELS][MAX_NOTES];
+
+	void apply(const MTrkEvent& evt) {
+		if (evt.type != MIDI_EVENT)
+			return;
+
+		const uint8_t status = evt.status;
+		const size_t chan = status & 0x0F;
+		if (status >= 0x80 && status <= 0x8F) {
+			velocity[chan][evt.byte1 & 0x7F] = 0;
+		}
+		// as noteOn, a velocity of 0 or 1 is a note off
+		else if (status >= 0x90 && status <= 0x9F) {
+			velocity[chan][evt.byte1 & 0x7F] = (evt.byte2 > 1) ? evt.byte2 : 0;
+		}
+		else if (status >= 0xB0 && status <= 0xBF) {
+			if (evt.byte1 == 0x07) channels[chan].volume = evt.byte2;
+			if (evt.byte1 == 0x0B) channels[chan].expression = evt.byte2;
+		}
+		else if (status >= 0xC0 && status <= 0xCF) {
+			channels[chan].prog = evt.byte1;
+		}
+		else if (status >= 0xE0 && status <= 0xEF) {
+			channels[chan].pitchBend = static_cast<uint16_t>(evt.byte2 << 7) + static_cast<uint16_t>(evt.byte1);
+		}
+	}
+
+	void appendHeld(std::vector<SeekHeldNote>& out) const {
+		for (size_t c = 0; c < NUM_CHANNELS; ++c) {
+			for (size_t n = 0; n < MAX_NOTES; ++n) {
+				if (velocity[c][n])
+					out.push_back({ static_cast<uint8_t>(c + 1), static_cast<uint8_t>(n), velocity[c][n] });
+			}
+		}
+	}
+};
+
+SeekIndex::SeekIndex() : timeline(nullptr) {}
+
+void SeekIndex::build(const std::vector<TimelineEvent>& events, const Channel* startChannels) {
+	clear();
+	timeline = &events;
+
+	SeekMirror mirror;
+	memset(mirror.velocity, 0, sizeof mirror.velocity);
+	for (size_t i = 0; i < NUM_CHANNELS; ++i) {
+		mirror.channels[i].prog = startChannels[i].prog;
+		mirror.channels[i].volume = startChannels[i].volume;
+		mirror.channels[i].expression = startChannels[i].expression;
+
+		// playback starts every channel unbent
+		mirror.channels[i].pitchBend = 8192;
+	}
+
+	const uint64_t interval = static_cast<uint64_t>(SEEK_CHECKPOINT_MS) * 1000;
+	uint64_t nextUsec = 0;
+	for (size_t i = 0; i <= events.size(); ++i) {
+		// the first event at or past each interval gets one
+		// (and the end of the song, for seeks past it)
+		if (i == events.size() || events[i].usec >= nextUsec) {
+			SeekCheckpoint cp;
+			cp.usec = (i == events.size()) ? (events.empty() ? 0 : events.back().usec + 1) : events[i].usec;
+			cp.eventIndex = i;
+			memcpy(cp.channels, mirror.channels, sizeof cp.channels);
+			cp.firstHeld = held.size();
+			mirror.appendHeld(held);
+			cp.numHeld = held.size() - cp.firstHeld;
+			checkpoints.push_back(cp);
+
+			nextUsec = cp.usec + interval;
+		}
+
+		if (i < events.size())
+			mirror.apply(events[i].evt);
+	}
+}
+
+void SeekIndex::clear() {
+	timeline = nullptr;
+	checkpoints.clear();
+	held.clear();
+}
+
+void SeekIndex::seek(const uint64_t usec, SeekState& out) const {
+	out.eventIndex = 0;
+	out.held.clear();
+	if (checkpoints.empty())
+		return;
+
+	// last checkpoint at or before usec (the first is at or
+	// before any event, so there always is one)
+	auto it = std::upper_bound(checkpoints.begin(), checkpoints.end(), usec,
+		[](const uint64_t t, const SeekCheckpoint& cp) { return t < cp.usec; });
+	const SeekCheckpoint& cp = (it == checkpoints.begin()) ? *it : *(it - 1);
+
+	SeekMirror mirror;
+	memcpy(mirror.channels, cp.channels, sizeof mirror.channels);
+	memset(mirror.velocity, 0, sizeof mirror.velocity);
+	for (size_t i = cp.firstHeld; i < cp.firstHeld + cp.numHeld; ++i)
+		mirror.velocity[held[i].channel - 1][held[i].note] = held[i].velocity;
+
+	// then everything from there up to usec
+	const std::vector<TimelineEvent>& events = *timeline;
+	size_t i = cp.eventIndex;
+	for (; i < events.size() && events[i].usec < usec; ++i)
+		mirror.apply(events[i].evt);
+
+	out.eventIndex = i;
+	memcpy(out.channels, mirror.channels, sizeof out.channels);
+	mirror.appendHeld(out.held);
+}
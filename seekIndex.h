@@ -0,0 +1,88 @@
+/*******************************************************************
+*   seekIndex.h
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module lets playback start anywhere in a song (and loop a
+// section of it) without playing everything before. One pass over
+// the merged timeline snapshots, every SEEK_CHECKPOINT_MS of song
+// time, each channel's program, volume, expression and pitch bend,
+// and which notes are held, at what velocity. The state at any time
+// is then a binary search for the checkpoint before it plus a
+// replay, of state only, of the events in between.
+// Tempo needs no snapshot: timeline times are already absolute.
+
+#ifndef SEEKINDEX_H
+#define SEEKINDEX_H
+
+// song time between checkpoints (and so the most replayed per seek)
+#define SEEK_CHECKPOINT_MS				(1000)
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct Channel;
+struct TimelineEvent;
+
+struct SeekChannelState {
+	uint8_t prog, volume, expression;
+
+	// as sent: 0 - 16383, 8192 is none
+	uint16_t pitchBend;
+};
+
+struct SeekHeldNote {
+	// 1-based
+	uint8_t channel;
+	uint8_t note;
+	uint8_t velocity;
+};
+
+// every channel as playback would have it at some time
+struct SeekState {
+	// first event at or after that time
+	size_t eventIndex;
+
+	SeekChannelState channels[16];
+	std::vector<SeekHeldNote> held;
+};
+
+struct SeekCheckpoint {
+	// state just before the first event at this time
+	uint64_t usec;
+	size_t eventIndex;
+
+	SeekChannelState channels[16];
+
+	// run of SeekIndex::held
+	size_t firstHeld;
+	size_t numHeld;
+};
+
+class SeekIndex {
+private:
+	const std::vector<TimelineEvent>* timeline;
+	std::vector<SeekCheckpoint> checkpoints;
+	std::vector<SeekHeldNote> held;
+
+public:
+	SeekIndex();
+
+	// index the timeline, starting from each channel's state as
+	// playback starts it. the timeline must not change afterwards
+	void build(const std::vector<TimelineEvent>& timeline, const Channel* startChannels);
+	void clear();
+
+	bool empty() const { return checkpoints.empty(); }
+	size_t size() const { return checkpoints.size(); }
+
+	// state just before the first event at or after usec
+	void seek(const uint64_t usec, SeekState& out) const;
+};
+
+#endif
@@ -11,176 +11,199 @@
 // serial class. It creates a single, very efficient serial connection,
 // though it could easily be scaled to allow multiple simultaneous
 // connections.
+// Writes never touch the wire on the caller's thread: they are copied
+// into a lock-free queue and a dedicated writer thread, the only owner
+// of the port, sends them with non-blocking (Linux) or overlapped
+// (Windows) I/O. A full queue is reported to the caller instead of
+// stalling it.
+// The wire itself is a SerialTransport (see serialTransport.h): the
+// real port, or an emulated controller for a "mock" port name.
 
 #include "serial.h"
 
-#ifndef _WIN32
-int Serial::set_interface_attribs(const speed_t speed) {
+Serial::Serial(SerialPortName port) : stopping(false), writerIdle(false), bytesQueued(0), bytesWritten(0), writes(0),
+	rejectedSends(0), wireStalls(0), writeErrors(0), maxQueueDepth(0) {
 
-memset(&tty, 0, sizeof tty);
+	transport = openSerialTransport(port);
+	connected = transport->isOpen();
 
-if ( tcgetattr ( hSerial, &tty ) != 0 ) {
-   std::cout << "Error " << errno << " from tcgetattr: " << strerror(errno) << std::endl;
+	if (connected)
+		writer = std::thread(&Serial::writerLoop, this);
 }
 
-// set baud
-cfsetospeed(&tty, speed);
-cfsetispeed(&tty, speed);
+Serial::~Serial() {
+	if (connected) {
+		// writer drains whatever is still queued (i.e. the
+		// final drive stops) before exiting
+		drainDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(SERIAL_DRAIN_TIMEOUT_MS);
+		stopping.store(true, std::memory_order_release);
+		{
+			std::lock_guard<std::mutex> lk(idleMutex);
+			idleCV.notify_one();
+		}
+		writer.join();
 
-// configure 8n1
-tty.c_cflag     &=  ~PARENB;
-tty.c_cflag     &=  ~CSTOPB;
-tty.c_cflag     &=  ~CSIZE;
-tty.c_cflag     |=  CS8;
+		connected = false;
+	}
 
-tty.c_cflag     &=  ~CRTSCTS;
-tty.c_cc[VMIN]   =  1;
-tty.c_cc[VTIME]  =  5;
-tty.c_cflag     |=  CREAD | HUPCL | CLOCAL;
+	delete transport;
+}
 
-// HUPCL requests hang-up (Arduino RST)
+long long Serial::readData(void* const buffer, const unsigned long numBytes) {
+	return transport->read(buffer, numBytes);
+}
 
-cfmakeraw(&tty);
+bool Serial::queueChunk(const uint8_t* buffer, const size_t numBytes, const int64_t originNs) {
+	SerialChunk chunk;
+	chunk.queuedNs = latencyClockNs();
+	chunk.originNs = originNs;
+	chunk.length = static_cast<uint16_t>(numBytes);
+	memcpy(chunk.bytes, buffer, numBytes);
 
-tcflush( hSerial, TCIOFLUSH );
-if ( tcsetattr ( hSerial, TCSANOW, &tty ) != 0) {
-	std::cout << "Error " << errno << " from tcsetattr: " << strerror(errno) << std::endl;
-}
+	if (!txQueue.push(chunk))
+		return false;
 
-	return 0;
+	bytesQueued.fetch_add(numBytes, std::memory_order_relaxed);
+
+	const size_t depth = txQueue.size();
+	size_t seen = maxQueueDepth.load(std::memory_order_relaxed);
+	while (depth > seen && !maxQueueDepth.compare_exchange_weak(seen, depth, std::memory_order_relaxed));
+
+	// pairs with the fence in writerLoop: either the writer sees
+	// this chunk before sleeping, or we see it asleep and wake it
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (writerIdle.load(std::memory_order_relaxed)) {
+		std::lock_guard<std::mutex> lk(idleMutex);
+		idleCV.notify_one();
+	}
+	return true;
 }
 
-#endif
-
-Serial::Serial() {
-
-	connected = false;
-
-#ifdef _WIN32
-	// connect to port
-	hSerial = CreateFile(PORT,
-		GENERIC_READ | GENERIC_WRITE,		// access(read + write) mode
-		0,									// share mode
-		NULL,								// address of security descriptor
-		OPEN_EXISTING,						// creation mode
-		FILE_ATTRIBUTE_NORMAL,				// file attribs
-		NULL);								// handle of file with attributes to copy (N/A)
-
-	// if connection unsuccessful...
-	if (hSerial == INVALID_HANDLE_VALUE) {
-		// ...store and display an error
-		DWORD error;
-		// file not found (device unplugged) is by far most common error
-		if ((error = GetLastError()) == ERROR_FILE_NOT_FOUND) {
-			std::cout << "ERROR: Serial device not accessible." << std::endl
-				<< "Is the Arduino plugged in and powered on? Is the port correct?" << std::endl;
-		}
-		else {
-			std::cout << "ERROR: Unrecognized error. Code: " << error << std::endl;
-		}
+bool Serial::sendAsync(const void* const buffer, const unsigned long numBytes, const int64_t originNs) {
+	if (!connected || numBytes > SERIAL_CHUNK_BYTES)
+		return false;
+
+	if (!queueChunk(reinterpret_cast<const uint8_t*>(buffer), numBytes, originNs)) {
+		rejectedSends.fetch_add(1, std::memory_order_relaxed);
+		return false;
 	}
-	else {
-		// perpare DCB struct for connection state
-		DCB dcbSerialParams = { 0 };
+	return true;
+}
 
-		// get current state
-		if (!GetCommState(hSerial, &dcbSerialParams)) {
-			std::cout << "Unable to retrieve current serial parameters." << std::endl;
-		}
-		else {
-			// set params as desired
-			dcbSerialParams.BaudRate = BAUD_RATE;
-			dcbSerialParams.ByteSize = 8;
-			dcbSerialParams.StopBits = ONESTOPBIT;
-			dcbSerialParams.Parity = NOPARITY;
-
-			// DTR is shorted to RST pin on Arduino
-			// This is DESIRED behavior for this software.
-			// we want to recalibrate floppy drives on
-			// program launch
-			dcbSerialParams.fDtrControl = DTR_CONTROL_ENABLE;
-
-			// write back params
-			if (!SetCommState(hSerial, &dcbSerialParams)) {
-				std::cout << "ERROR: Could not set Serial Port parameters" << std::endl;
-			}
-			else {
-				connected = true;
+bool Serial::writeData(void* const buffer, const unsigned long numBytes, const int64_t originNs) {
+	if (!connected)
+		return false;
 
-				// flush I and O
-				PurgeComm(hSerial, PURGE_RXCLEAR | PURGE_TXCLEAR);
-			}
+	const uint8_t* p = reinterpret_cast<const uint8_t*>(buffer);
+	size_t remaining = numBytes;
+	while (remaining) {
+		const size_t n = (remaining < SERIAL_CHUNK_BYTES) ? remaining : SERIAL_CHUNK_BYTES;
+		while (!queueChunk(p, n, originNs)) {
+			rejectedSends.fetch_add(1, std::memory_order_relaxed);
+			std::this_thread::yield();
 		}
+		p += n;
+		remaining -= n;
 	}
-#else
-	if((hSerial = open(PORT, O_RDWR | O_NOCTTY)) < 0) {
-		std::cout << "ERROR: Serial device not accessible." << std::endl
-			<< "Is the Arduino plugged in and powered on? Is the port correct?" << std::endl;
-	}
-	else {
-		set_interface_attribs(BAUD_RATE);
+	return true;
+}
 
-		connected = true;
-	}
+bool Serial::drainExpired() const {
+	return stopping.load(std::memory_order_acquire) && std::chrono::steady_clock::now() > drainDeadline;
+}
 
-#endif
+// writer thread only
+bool Serial::writeToWire(const uint8_t* buffer, size_t numBytes) {
+	// give up only if shutdown has run out of patience
+	const SerialWriteResult r = transport->write(buffer, numBytes, [this] { return drainExpired(); });
+
+	writes.fetch_add(r.writes, std::memory_order_relaxed);
+	wireStalls.fetch_add(r.stalls, std::memory_order_relaxed);
+	bytesWritten.fetch_add(r.bytesWritten, std::memory_order_relaxed);
+	if (!r.ok)
+		writeErrors.fetch_add(1, std::memory_order_relaxed);
+	return r.ok;
 }
 
-Serial::~Serial() {
-	if (connected) {
-		connected = false;
+void Serial::writerLoop() {
+	// gather what's already queued into one write, up to
+	// CHUNKS_PER_WRITE chunks or BYTES_PER_WRITE bytes
+	static const size_t CHUNKS_PER_WRITE = 64;
+	static const size_t BYTES_PER_WRITE = 8 * SERIAL_CHUNK_BYTES;
+	uint8_t buffer[BYTES_PER_WRITE];
+	int64_t queuedNs[CHUNKS_PER_WRITE], originNs[CHUNKS_PER_WRITE];
+	SerialChunk chunk;
+
+	// chunk was popped but didn't fit, so it starts the next write
+	bool carried = false;
+
+	for (;;) {
+		size_t n = 0, numChunks = 0;
+
+		while (numChunks < CHUNKS_PER_WRITE && (carried || txQueue.pop(chunk))) {
+			carried = n + chunk.length > BYTES_PER_WRITE;
+			if (carried)
+				break;
+
+			memcpy(buffer + n, chunk.bytes, chunk.length);
+			n += chunk.length;
+			queuedNs[numChunks] = chunk.queuedNs;
+			originNs[numChunks++] = chunk.originNs;
+		}
 
-#ifdef _WIN32
-		CloseHandle(hSerial);
-#else
-		close(hSerial);
-#endif
+		if (n) {
+			writeToWire(buffer, n);
+
+			const int64_t writtenNs = latencyClockNs();
+			for (size_t i = 0; i < numChunks; ++i) {
+				serialWriteLatency.record(writtenNs - queuedNs[i]);
+				if (originNs[i])
+					liveInputLatency.record(writtenNs - originNs[i]);
+			}
+		}
+		else if (stopping.load(std::memory_order_acquire)) {
+			break;
+		}
+		else {
+			writerIdle.store(true, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (txQueue.size() == 0) {
+				std::unique_lock<std::mutex> lk(idleMutex);
+				idleCV.wait_for(lk, std::chrono::milliseconds(SERIAL_IDLE_TIMEOUT_MS));
+			}
+			writerIdle.store(false, std::memory_order_relaxed);
+		}
 
+		// don't hang at exit on a device that's stopped reading
+		if (drainExpired())
+			break;
 	}
 }
 
-long long Serial::readData(void* const buffer, const unsigned long numBytes) {
-#ifdef _WIN32
-	unsigned long actuallyRead;
-
-	// get port status
-	ClearCommError(hSerial, &errors, &status);
-
-	// if available data, read as much as possible without getting more than numBytes
-	if (status.cbInQue > 0 && ReadFile(hSerial, buffer, status.cbInQue > numBytes ? numBytes : status.cbInQue, &actuallyRead, NULL) && actuallyRead != 0)
-		return static_cast<long long>(actuallyRead);
-
-	// if nothing read or some other error
-	return -1;
-#else
-	return read(hSerial, buffer, static_cast<size_t>(numBytes));
-#endif
+size_t Serial::queueDepth() const {
+	return txQueue.size();
+}
 
+SerialStats Serial::stats() const {
+	SerialStats s;
+	s.bytesQueued = bytesQueued.load(std::memory_order_relaxed);
+	s.bytesWritten = bytesWritten.load(std::memory_order_relaxed);
+	s.writes = writes.load(std::memory_order_relaxed);
+	s.rejectedSends = rejectedSends.load(std::memory_order_relaxed);
+	s.wireStalls = wireStalls.load(std::memory_order_relaxed);
+	s.writeErrors = writeErrors.load(std::memory_order_relaxed);
+	s.maxQueueDepth = maxQueueDepth.load(std::memory_order_relaxed);
+	return s;
 }
 
-bool Serial::writeData(void* const buffer, const unsigned long numBytes) {
-#ifdef _WIN32
-	unsigned long bytesActuallySent;
-	
-	serialMutex.lock();
-
-	// try to write to serial
-	if (!WriteFile(hSerial, buffer, numBytes, &bytesActuallySent, 0)) {
-		// if unsuccessful, eat error and return false
-		ClearCommError(hSerial, &errors, &status);
-		serialMutex.unlock();
-		return false;
-	}
-	else {
-		serialMutex.unlock();
-		return true;
-	}
-#else
-	serialMutex.lock();
-	write(hSerial, buffer, numBytes);
-	serialMutex.unlock();
-	return true;
-#endif
+void Serial::resetStats() {
+	const uint64_t written = bytesWritten.exchange(0, std::memory_order_relaxed);
+	bytesQueued.fetch_sub(written, std::memory_order_relaxed);
+	writes.store(0, std::memory_order_relaxed);
+	rejectedSends.store(0, std::memory_order_relaxed);
+	wireStalls.store(0, std::memory_order_relaxed);
+	writeErrors.store(0, std::memory_order_relaxed);
+	maxQueueDepth.store(0, std::memory_order_relaxed);
 }
 
 bool Serial::isConnected() const {
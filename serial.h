@@ -11,6 +11,13 @@
 // serial class. It creates a single, very efficient serial connection,
 // though it could easily be scaled to allow multiple simultaneous
 // connections.
+// Writes never touch the wire on the caller's thread: they are copied
+// into a lock-free queue and a dedicated writer thread, the only owner
+// of the port, sends them with non-blocking (Linux) or overlapped
+// (Windows) I/O. A full queue is reported to the caller instead of
+// stalling it.
+// The wire itself is a SerialTransport (see serialTransport.h): the
+// real port, or an emulated controller for a "mock" port name.
 
 #ifndef SERIAL_H
 #define SERIAL_H
@@ -19,11 +26,13 @@
 // macro below can adjust for Linux
 #define BAUD 250000
 
+// one entry per Arduino controller. "mock[:<baud>[:<protocol>]]"
+// emulates one instead (see mockSerial.h)
 #ifdef _WIN32
 // wchar_t string required for Windows
-#define PORT L"\\\\.\\COM6"
+#define SERIAL_PORTS { L"\\\\.\\COM6" }
 #else
-#define PORT "/dev/ttyACM0"
+#define SERIAL_PORTS { "/dev/ttyACM0" }
 #endif
 
 
@@ -37,6 +46,28 @@
 #define BAUD_RATE NAME(B)
 #endif
 
+// bytes per queued send. larger sends are split
+#define SERIAL_CHUNK_BYTES				(1024)
+
+// sends in flight to the writer thread. must be a power of 2
+#define SERIAL_QUEUE_SIZE				(256)
+
+// writer wakes at least this often even if never notified
+#define SERIAL_IDLE_TIMEOUT_MS			(1)
+
+// how long the writer waits on a full TX buffer before
+// rechecking for shutdown
+#define SERIAL_POLL_TIMEOUT_MS			(10)
+
+// at teardown, how long to keep draining queued
+// sends to a device that has stopped accepting them
+#define SERIAL_DRAIN_TIMEOUT_MS			(1000)
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <mutex>
 #include <thread>
@@ -44,53 +75,103 @@
 #ifdef _WIN32
 #include <windows.h>
 #else
-#include <cstring>
 #include <fcntl.h>
 #include <cerrno>
+#include <poll.h>
 #include <termios.h>
 #include <unistd.h>
 #endif
 
+#include "latencyHistogram.h"
+#include "lockFreeQueue.h"
+#include "serialTransport.h"
+
+struct SerialChunk {
+	// latencyClockNs() when queued
+	int64_t queuedNs;
+
+	// latencyClockNs() when the live input that caused it
+	// arrived, or 0 (see midiInput.h)
+	int64_t originNs;
+	uint16_t length;
+	uint8_t bytes[SERIAL_CHUNK_BYTES];
+};
+
+struct SerialStats {
+	uint64_t bytesQueued;
+	uint64_t bytesWritten;
+
+	// syscalls (or overlapped writes) issued by the writer
+	uint64_t writes;
+
+	// sends refused because the queue was full
+	uint64_t rejectedSends;
+
+	// times the device's TX buffer was full
+	uint64_t wireStalls;
+
+	uint64_t writeErrors;
+
+	// most sends ever waiting at once
+	size_t maxQueueDepth;
+};
+
 class Serial {
 private:
 	bool connected;
 
-#ifdef _WIN32
-	// handle to serial "file"
-	// type HANDLE (which is a typedef of void*) on Windows,
-	// int on Linux
-	HANDLE hSerial;
-
-	// connection info struct
-	// COMSTAT on Windows,
-	// termios on Linux
-	COMSTAT status;
-
-	// error struct (Windows only)
-	DWORD errors;
-#else
-	int hSerial;
-	termios tty;
-#endif
+	// owned. only the writer thread writes to it
+	SerialTransport* transport;
 
-public:
-	// only one thread at a time, please
-	std::mutex serialMutex;
+	LockFreeQueue<SerialChunk, SERIAL_QUEUE_SIZE> txQueue;
+
+	std::thread writer;
+	std::atomic<bool> stopping;
+
+	// set before stopping
+	std::chrono::steady_clock::time_point drainDeadline;
+
+	// lets an idle writer sleep rather than spin. producers
+	// only pay for a notify while it is actually asleep
+	std::mutex idleMutex;
+	std::condition_variable idleCV;
+	std::atomic<bool> writerIdle;
+
+	std::atomic<uint64_t> bytesQueued, bytesWritten, writes, rejectedSends, wireStalls, writeErrors;
+	std::atomic<size_t> maxQueueDepth;
+
+	void writerLoop();
+	bool drainExpired() const;
+	bool writeToWire(const uint8_t* buffer, size_t numBytes);
+	bool queueChunk(const uint8_t* buffer, const size_t numBytes, const int64_t originNs);
 
+public:
 	// handles connection setup
-	Serial();
+	Serial(SerialPortName port);
 
 	// handles connection teardown
 	~Serial();
 
-#ifndef _WIN32
-	int set_interface_attribs(const speed_t speed);
-#endif
-
 	long long readData(void* const buffer, const unsigned long numBytes);
-	bool writeData(void* const buffer, const unsigned long numBytes);
+
+	// queue up to SERIAL_CHUNK_BYTES for the writer thread and
+	// return immediately. false (nothing queued) if the queue is full.
+	// a nonzero originNs is timed to the write as live input latency
+	bool sendAsync(const void* const buffer, const unsigned long numBytes, const int64_t originNs = 0);
+
+	// any length. waits (yielding) for room instead of refusing
+	bool writeData(void* const buffer, const unsigned long numBytes, const int64_t originNs = 0);
+
 	bool isConnected() const;
 
+	// sends waiting for the writer (approximate)
+	size_t queueDepth() const;
+	SerialStats stats() const;
+
+	// start the stats over (i.e. between songs). bytes queued
+	// but not yet written carry over as queued
+	void resetStats();
+
 };
 
 #endif
@@ -0,0 +1,244 @@
+/*******************************************************************
+*   serialTransport.cpp
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module is what Serial actually talks to: a byte link to one
+// controller. Serial owns the queueing and the writer thread; the
+// transport only moves bytes. PortTransport is the real Windows or
+// Linux serial port. Any port name beginning with MOCK_SERIAL_PREFIX
+// instead opens a MockTransport (see mockSerial.h), an emulated
+// controller for exercising the floppy path without hardware.
+
+#include "serialTransport.h"
+
+#include "mockSerial.h"
+#include "serial.h"
+
+#ifndef _WIN32
+int PortTransport::set_interface_attribs(const speed_t speed) {
+
+memset(&tty, 0, sizeof tty);
+
+if ( tcgetattr ( hSerial, &tty ) != 0 ) {
+   std::cout << "Error " << errno << " from tcgetattr: " << strerror(errno) << std::endl;
+}
+
+// set baud
+cfsetospeed(&tty, speed);
+cfsetispeed(&tty, speed);
+
+// configure 8n1
+tty.c_cflag     &=  ~PARENB;
+tty.c_cflag     &=  ~CSTOPB;
+tty.c_cflag     &=  ~CSIZE;
+tty.c_cflag     |=  CS8;
+
+tty.c_cflag     &=  ~CRTSCTS;
+tty.c_cc[VMIN]   =  1;
+tty.c_cc[VTIME]  =  5;
+tty.c_cflag     |=  CREAD | HUPCL | CLOCAL;
+
+// HUPCL requests hang-up (Arduino RST)
+
+cfmakeraw(&tty);
+
+tcflush( hSerial, TCIOFLUSH );
+if ( tcsetattr ( hSerial, TCSANOW, &tty ) != 0) {
+	std::cout << "Error " << errno << " from tcsetattr: " << strerror(errno) << std::endl;
+}
+
+	return 0;
+}
+
+#endif
+
+PortTransport::PortTransport(SerialPortName port) : open(false) {
+#ifdef _WIN32
+	// connect to port
+	hSerial = CreateFileW(port,
+		GENERIC_READ | GENERIC_WRITE,		// access(read + write) mode
+		0,									// share mode
+		NULL,								// address of security descriptor
+		OPEN_EXISTING,						// creation mode
+		FILE_FLAG_OVERLAPPED,				// file attribs (async I/O)
+		NULL);								// handle of file with attributes to copy (N/A)
+
+	// if connection unsuccessful...
+	if (hSerial == INVALID_HANDLE_VALUE) {
+		// ...store and display an error
+		DWORD error;
+		// file not found (device unplugged) is by far most common error
+		if ((error = GetLastError()) == ERROR_FILE_NOT_FOUND) {
+			std::cout << "ERROR: Serial device not accessible." << std::endl
+				<< "Is the Arduino plugged in and powered on? Is the port correct?" << std::endl;
+		}
+		else {
+			std::cout << "ERROR: Unrecognized error. Code: " << error << std::endl;
+		}
+	}
+	else {
+		// perpare DCB struct for connection state
+		DCB dcbSerialParams = { 0 };
+
+		// get current state
+		if (!GetCommState(hSerial, &dcbSerialParams)) {
+			std::cout << "Unable to retrieve current serial parameters." << std::endl;
+		}
+		else {
+			// set params as desired
+			dcbSerialParams.BaudRate = BAUD_RATE;
+			dcbSerialParams.ByteSize = 8;
+			dcbSerialParams.StopBits = ONESTOPBIT;
+			dcbSerialParams.Parity = NOPARITY;
+
+			// DTR is shorted to RST pin on Arduino
+			// This is DESIRED behavior for this software.
+			// we want to recalibrate floppy drives on
+			// program launch
+			dcbSerialParams.fDtrControl = DTR_CONTROL_ENABLE;
+
+			// write back params
+			if (!SetCommState(hSerial, &dcbSerialParams)) {
+				std::cout << "ERROR: Could not set Serial Port parameters" << std::endl;
+			}
+			else {
+				writeEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+				readEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+				open = true;
+
+				// flush I and O
+				PurgeComm(hSerial, PURGE_RXCLEAR | PURGE_TXCLEAR);
+			}
+		}
+	}
+#else
+	if((hSerial = ::open(port, O_RDWR | O_NOCTTY | O_NONBLOCK)) < 0) {
+		std::cout << "ERROR: Serial device not accessible." << std::endl
+			<< "Is the Arduino plugged in and powered on? Is the port correct?" << std::endl;
+	}
+	else {
+		set_interface_attribs(BAUD_RATE);
+
+		open = true;
+	}
+
+#endif
+}
+
+PortTransport::~PortTransport() {
+	if (open) {
+		open = false;
+
+#ifdef _WIN32
+		CloseHandle(writeEvent);
+		CloseHandle(readEvent);
+		CloseHandle(hSerial);
+#else
+		close(hSerial);
+#endif
+
+	}
+}
+
+long long PortTransport::read(void* const buffer, const unsigned long numBytes) {
+#ifdef _WIN32
+	unsigned long actuallyRead;
+
+	// get port status
+	ClearCommError(hSerial, &errors, &status);
+
+	// if available data, read as much as possible without getting more than numBytes
+	// (it's already there, so the overlapped read completes right away)
+	if (status.cbInQue > 0) {
+		OVERLAPPED ov = { 0 };
+		ov.hEvent = readEvent;
+		ResetEvent(readEvent);
+		const DWORD toRead = status.cbInQue > numBytes ? numBytes : status.cbInQue;
+		if ((ReadFile(hSerial, buffer, toRead, &actuallyRead, &ov) || (GetLastError() == ERROR_IO_PENDING && GetOverlappedResult(hSerial, &ov, &actuallyRead, TRUE))) && actuallyRead != 0)
+			return static_cast<long long>(actuallyRead);
+	}
+
+	// if nothing read or some other error
+	return -1;
+#else
+	return ::read(hSerial, buffer, static_cast<size_t>(numBytes));
+#endif
+
+}
+
+SerialWriteResult PortTransport::write(const uint8_t* buffer, size_t numBytes, const std::function<bool()>& giveUp) {
+	SerialWriteResult r = { 0, 0, 0, false };
+
+#ifdef _WIN32
+	OVERLAPPED ov = { 0 };
+	ov.hEvent = writeEvent;
+	ResetEvent(writeEvent);
+
+	DWORD sent = 0;
+	++r.writes;
+	if (!WriteFile(hSerial, buffer, static_cast<DWORD>(numBytes), &sent, &ov)) {
+		if (GetLastError() != ERROR_IO_PENDING) {
+			// eat error and drop the data
+			ClearCommError(hSerial, &errors, &status);
+			return r;
+		}
+
+		// still going out. wait for it, giving up only
+		// if the caller has run out of patience
+		++r.stalls;
+		while (WaitForSingleObject(writeEvent, SERIAL_POLL_TIMEOUT_MS) == WAIT_TIMEOUT) {
+			if (giveUp()) {
+				CancelIo(hSerial);
+				GetOverlappedResult(hSerial, &ov, &sent, TRUE);
+				r.bytesWritten = sent;
+				return r;
+			}
+		}
+		if (!GetOverlappedResult(hSerial, &ov, &sent, FALSE)) {
+			ClearCommError(hSerial, &errors, &status);
+			return r;
+		}
+	}
+	r.bytesWritten = sent;
+	r.ok = (sent == numBytes);
+	return r;
+#else
+	while (numBytes) {
+		++r.writes;
+		const ssize_t sent = ::write(hSerial, buffer, numBytes);
+		if (sent > 0) {
+			buffer += sent;
+			numBytes -= static_cast<size_t>(sent);
+			r.bytesWritten += static_cast<uint64_t>(sent);
+		}
+		else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			// TX buffer full. wait for room, giving up only
+			// if the caller has run out of patience
+			++r.stalls;
+			if (giveUp())
+				return r;
+			pollfd pfd = { hSerial, POLLOUT, 0 };
+			poll(&pfd, 1, SERIAL_POLL_TIMEOUT_MS);
+		}
+		else if (sent < 0 && errno == EINTR) {
+			continue;
+		}
+		else {
+			return r;
+		}
+	}
+	r.ok = true;
+	return r;
+#endif
+}
+
+SerialTransport* openSerialTransport(SerialPortName port) {
+	if (isMockSerialPort(port))
+		return new MockTransport(port);
+	return new PortTransport(port);
+}
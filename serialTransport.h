@@ -0,0 +1,105 @@
+/*******************************************************************
+*   serialTransport.h
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module is what Serial actually talks to: a byte link to one
+// controller. Serial owns the queueing and the writer thread; the
+// transport only moves bytes. PortTransport is the real Windows or
+// Linux serial port. Any port name beginning with MOCK_SERIAL_PREFIX
+// instead opens a MockTransport (see mockSerial.h), an emulated
+// controller for exercising the floppy path without hardware.
+
+#ifndef SERIALTRANSPORT_H
+#define SERIALTRANSPORT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <termios.h>
+#endif
+
+#ifdef _WIN32
+typedef const wchar_t* SerialPortName;
+#else
+typedef const char* SerialPortName;
+#endif
+
+// what one write() did, for Serial's stats
+struct SerialWriteResult {
+	uint64_t bytesWritten;
+
+	// syscalls (or overlapped writes) issued
+	uint64_t writes;
+
+	// times the link was full
+	uint64_t stalls;
+
+	bool ok;
+};
+
+class SerialTransport {
+public:
+	virtual ~SerialTransport() {}
+
+	virtual bool isOpen() const = 0;
+
+	// non-blocking. bytes read, or <= 0 if none
+	virtual long long read(void* const buffer, const unsigned long numBytes) = 0;
+
+	// writer thread only. sends all of buffer, waiting (at most
+	// SERIAL_POLL_TIMEOUT_MS at a time) while the link is full,
+	// and gives up as soon as giveUp() returns true
+	virtual SerialWriteResult write(const uint8_t* buffer, size_t numBytes, const std::function<bool()>& giveUp) = 0;
+};
+
+class PortTransport : public SerialTransport {
+private:
+	bool open;
+
+#ifdef _WIN32
+	// handle to serial "file"
+	// type HANDLE (which is a typedef of void*) on Windows,
+	// int on Linux
+	// (opened for overlapped I/O)
+	HANDLE hSerial;
+	HANDLE writeEvent, readEvent;
+
+	// connection info struct
+	// COMSTAT on Windows,
+	// termios on Linux
+	COMSTAT status;
+
+	// error struct (Windows only)
+	DWORD errors;
+#else
+	int hSerial;
+	termios tty;
+
+	int set_interface_attribs(const speed_t speed);
+#endif
+
+public:
+	explicit PortTransport(SerialPortName port);
+	~PortTransport();
+
+	PortTransport(const PortTransport&) = delete;
+	PortTransport& operator=(const PortTransport&) = delete;
+
+	bool isOpen() const { return open; }
+	long long read(void* const buffer, const unsigned long numBytes);
+	SerialWriteResult write(const uint8_t* buffer, size_t numBytes, const std::function<bool()>& giveUp);
+};
+
+// PortTransport, or MockTransport for a mock port name. never null
+SerialTransport* openSerialTransport(SerialPortName port);
+
+#endif
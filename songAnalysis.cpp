@@ -0,0 +1,207 @@
+/*******************************************************************
+*   songAnalysis.cpp
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module sizes a song up before it plays, so that what it
+// needs is known (and warned about) up front rather than discovered
+// from noteOn failing mid-song. One linear pass over the merged
+// timeline, mirroring what playback does with each event, finds the
+// most notes sounding at once (per channel and in total), the
+// busiest stretches of events, and how many bytes per second the
+// floppy link has to carry. Packets are estimated as v1 sends them
+// (v2 is never larger, and usually smaller), collapsed per drive
+// within a tick as the scheduler's batching does.
+// The same pass notices pitch bends and volume/expression changes
+// that set what the channel already has: each still re-sends every
+// sounding drive's note, so when the link can't keep up they are
+// the first thing to drop.
+
+#include "songAnalysis.h"
+
+#include <chrono>
+
+#include "MIDI.h"
+
+// the pitch bend, volume and expression each channel has,
+// as playback tracks them
+struct ChannelControls {
+	uint16_t bend[NUM_CHANNELS];
+	uint8_t volume[NUM_CHANNELS];
+	uint8_t expression[NUM_CHANNELS];
+
+	void reset(const Channel* startChannels) {
+		for (size_t i = 0; i < NUM_CHANNELS; ++i) {
+			// playback starts every channel unbent
+			bend[i] = 8192;
+			volume[i] = startChannels[i].volume;
+			expression[i] = startChannels[i].expression;
+		}
+	}
+
+	// false if evt sets what its channel already has
+	bool update(const MTrkEvent& evt) {
+		const size_t chan = evt.status & 0x0F;
+		if (evt.status >= 0xE0) {
+			const uint16_t bytes = static_cast<uint16_t>(evt.byte2 << 7) + static_cast<uint16_t>(evt.byte1);
+			if (bend[chan] == bytes)
+				return false;
+			bend[chan] = bytes;
+			return true;
+		}
+
+		uint8_t* const value = (evt.byte1 == 0x07) ? &volume[chan] : &expression[chan];
+		if (*value == evt.byte2)
+			return false;
+		*value = evt.byte2;
+		return true;
+	}
+};
+
+// events that make updatePlayingNotes re-send a channel's notes
+static bool isChannelControl(const MTrkEvent& evt) {
+	if (evt.type != MIDI_EVENT)
+		return false;
+	if (evt.status >= 0xE0 && evt.status <= 0xEF)
+		return true;
+	return evt.status >= 0xB0 && evt.status <= 0xBF && (evt.byte1 == 0x07 || evt.byte1 == 0x0B);
+}
+
+void analyzeSong(const std::vector<TimelineEvent>& timeline, const Channel* startChannels, SongAnalysis& out) {
+	const std::chrono::high_resolution_clock::time_point analysisStart = std::chrono::high_resolution_clock::now();
+
+	out = SongAnalysis();
+	out.events = timeline.size();
+	if (!timeline.empty())
+		out.durationUsec = timeline.back().usec;
+
+	// sounding drives a bend or controller change re-sends
+#ifdef POLYPHONIC_FLOPPY_CHANNELS
+	const unsigned drivesPerChannel = MAX_DRIVES;
+#else
+	const unsigned drivesPerChannel = 1;
+#endif
+
+	uint8_t prog[NUM_CHANNELS];
+	for (size_t i = 0; i < NUM_CHANNELS; ++i)
+		prog[i] = startChannels[i].prog;
+
+	ChannelControls controls;
+	controls.reset(startChannels);
+
+	bool sounding[NUM_CHANNELS][MAX_NOTES] = {};
+	unsigned numSounding[NUM_CHANNELS] = {};
+	unsigned numTotal = 0;
+
+	const uint64_t windowUsec = static_cast<uint64_t>(ANALYSIS_WINDOW_MS) * 1000;
+	uint64_t windowStart = 0, windowEvents = 0, windowBytes = 0, windowNeededBytes = 0;
+	uint64_t peakWindowEvents = 0, peakWindowBytes = 0, peakWindowNeededBytes = 0;
+
+	// the tick being gathered: its events, its note packets, and
+	// the channels whose sounding drives all get an update at its end
+	// (with and without the redundant events)
+	uint64_t tickUsec = 0, tickEvents = 0, tickNotePackets = 0;
+	uint16_t tickDirty = 0, tickNeededDirty = 0;
+
+	auto endTick = [&]() {
+		uint64_t packets = tickNotePackets, neededPackets = tickNotePackets;
+		for (size_t i = 0; i < NUM_CHANNELS; ++i) {
+			const uint64_t updates = (numSounding[i] < drivesPerChannel) ? numSounding[i] : drivesPerChannel;
+			if (tickDirty & (1 << i))
+				packets += updates;
+			if (tickNeededDirty & (1 << i))
+				neededPackets += updates;
+		}
+
+		// batching keeps one update per drive per tick
+		if (packets > MAX_DRIVES)
+			packets = MAX_DRIVES;
+		if (neededPackets > MAX_DRIVES)
+			neededPackets = MAX_DRIVES;
+
+		if (tickUsec >= windowStart + windowUsec) {
+			peakWindowEvents = std::max(peakWindowEvents, windowEvents);
+			peakWindowBytes = std::max(peakWindowBytes, windowBytes);
+			peakWindowNeededBytes = std::max(peakWindowNeededBytes, windowNeededBytes);
+			windowEvents = windowBytes = windowNeededBytes = 0;
+			windowStart = tickUsec - tickUsec % windowUsec;
+		}
+
+		const uint64_t bytes = packets * PACKET_SIZE_BYTES;
+		windowEvents += tickEvents;
+		windowBytes += bytes;
+		windowNeededBytes += neededPackets * PACKET_SIZE_BYTES;
+		out.floppyPackets += packets;
+		if (bytes > out.worstTickBytes) {
+			out.worstTickBytes = bytes;
+			out.worstTickUsec = tickUsec;
+		}
+
+		tickEvents = tickNotePackets = 0;
+		tickDirty = tickNeededDirty = 0;
+	};
+
+	for (const TimelineEvent& te : timeline) {
+		if (te.usec != tickUsec) {
+			endTick();
+			tickUsec = te.usec;
+		}
+		++tickEvents;
+
+		const MTrkEvent& evt = te.evt;
+		if (evt.type != MIDI_EVENT)
+			continue;
+
+		const size_t chan = evt.status & 0x0F;
+
+		// as playMidiEvent, and as noteOn treats velocity 0 or 1
+		// and unplayable programs as note off. channel 10's note
+		// ons are ignored, so its notes never sound
+		if (evt.status >= 0x80 && evt.status <= 0x9F && evt.status != 0x99) {
+			const uint8_t note = evt.byte1 & 0x7F;
+			bool& s = sounding[chan][note];
+			if (evt.status >= 0x90 && evt.byte2 > 1 && !invalidProg(prog[chan])) {
+				if (!s) {
+					s = true;
+					out.peakNotes[chan] = std::max(out.peakNotes[chan], ++numSounding[chan]);
+					out.peakTotalNotes = std::max(out.peakTotalNotes, ++numTotal);
+				}
+				if (note < MIN_FLOPPY_NOTE + NOTE_DOWN_SHIFT_SEMITONES || note > MAX_FLOPPY_NOTE + NOTE_DOWN_SHIFT_SEMITONES)
+					++out.foldedNotes;
+				++tickNotePackets;
+			}
+			else if (s) {
+				s = false;
+				--numSounding[chan];
+				--numTotal;
+				++tickNotePackets;
+			}
+		}
+		else if (evt.status >= 0xC0 && evt.status <= 0xCF) {
+			prog[chan] = evt.byte1;
+		}
+		else if (isChannelControl(evt)) {
+			tickDirty |= static_cast<uint16_t>(1 << chan);
+			if (controls.update(evt))
+				tickNeededDirty |= static_cast<uint16_t>(1 << chan);
+			else
+				++out.redundantEvents;
+		}
+	}
+
+	// the last tick, and the window it ends
+	endTick();
+	tickUsec = UINT64_MAX;
+	endTick();
+
+	const double windowsPerSec = MICROSECONDS_PER_SECOND / static_cast<double>(windowUsec) * PLAYBACK_SPEED;
+	out.peakEventsPerSec = static_cast<double>(peakWindowEvents) * windowsPerSec;
+	out.peakFloppyBytesPerSec = static_cast<double>(peakWindowBytes) * windowsPerSec;
+	out.peakNeededFloppyBytesPerSec = static_cast<double>(peakWindowNeededBytes) * windowsPerSec;
+
+	out.elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - analysisStart).count();
+}
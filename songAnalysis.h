@@ -0,0 +1,72 @@
+/*******************************************************************
+*   songAnalysis.h
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module sizes a song up before it plays, so that what it
+// needs is known (and warned about) up front rather than discovered
+// from noteOn failing mid-song. One linear pass over the merged
+// timeline, mirroring what playback does with each event, finds the
+// most notes sounding at once (per channel and in total), the
+// busiest stretches of events, and how many bytes per second the
+// floppy link has to carry. Packets are estimated as v1 sends them
+// (v2 is never larger, and usually smaller), collapsed per drive
+// within a tick as the scheduler's batching does.
+// The same pass notices pitch bends and volume/expression changes
+// that set what the channel already has: each still re-sends every
+// sounding drive's note, so when the link can't keep up they are
+// the first thing to drop.
+
+#ifndef SONGANALYSIS_H
+#define SONGANALYSIS_H
+
+// rates are the busiest window of this much song time
+#define ANALYSIS_WINDOW_MS				(100)
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct Channel;
+struct TimelineEvent;
+
+struct SongAnalysis {
+	uint64_t events;
+	uint64_t durationUsec;
+
+	// most notes sounding at once, on each channel and in total
+	// (only notes playback would play: not channel 10, and not
+	// percussion or sound effect programs)
+	unsigned peakNotes[16];
+	unsigned peakTotalNotes;
+
+	// notes that had to be shifted octaves into floppy range
+	uint64_t foldedNotes;
+
+	// busiest window, at PLAYBACK_SPEED
+	double peakEventsPerSec;
+
+	uint64_t floppyPackets;
+	double peakFloppyBytesPerSec;
+
+	// the most bytes due at a single instant, and when
+	uint64_t worstTickBytes;
+	uint64_t worstTickUsec;
+
+	// bends and controller changes that change nothing, and the
+	// busiest window's bytes if they were dropped
+	uint64_t redundantEvents;
+	double peakNeededFloppyBytesPerSec;
+
+	double elapsedMs;
+};
+
+// sweep the timeline, starting from each channel's state as
+// playback starts it
+void analyzeSong(const std::vector<TimelineEvent>& timeline, const Channel* startChannels, SongAnalysis& out);
+
+#endif
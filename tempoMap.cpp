@@ -0,0 +1,97 @@
+/*******************************************************************
+*   tempoMap.cpp
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module converts absolute delta-time ticks to microseconds
+// from the start of the song. It is built once, after parsing, from
+// every 0x51 "Set Tempo" event in every track, and is read-only from
+// then on, so any number of playback threads can query it without
+// shared mutable tempo state.
+// All arithmetic is exact 64-bit integer: each segment's start is
+// kept in units of 1/divisor microseconds, so nothing accumulates
+// rounding error and every track lands on the same microsecond for
+// the same tick, however long the song. Queries are a binary search
+// over the (few) tempo segments.
+
+#include "tempoMap.h"
+
+TempoMap::TempoMap() {
+	reset(0);
+}
+
+void TempoMap::reset(const uint16_t division) {
+	segments.clear();
+
+	// if bit 15 is 0, remaining bits give delta-time ticks per quarter note.
+	// if bit 15 is 1, bits 14->8 give SMPTE fps (negated) and bits 7->0 give delta-time ticks/frame
+	smpte = division >= 0x8000;
+
+	uint64_t scaledUsecPerTick;
+	if (smpte) {
+		const uint8_t fps = static_cast<uint8_t>(-static_cast<int8_t>(division >> 8));
+		const uint64_t ticksPerFrame = division & 0xFF;
+
+		// one tick is 1e6 / (ticksPerFrame * fps) usec, where
+		// "29" means 29.97 fps, i.e. 1e8 / (ticksPerFrame * 2997)
+		if (fps == 29) {
+			divisor = ticksPerFrame * 2997;
+			scaledUsecPerTick = 100000000;
+		}
+		else {
+			divisor = ticksPerFrame * fps;
+			scaledUsecPerTick = 1000000;
+		}
+	}
+	else {
+		divisor = division;
+		scaledUsecPerTick = TEMPO_MAP_DEFAULT_USEC_PER_QTR_NOTE;
+	}
+
+	// a malformed header shouldn't divide by zero
+	if (divisor == 0)
+		divisor = 1;
+
+	segments.push_back({ 0, 0, scaledUsecPerTick });
+}
+
+void TempoMap::setTempo(const uint64_t tick, const uint32_t usecPerQtrNote) {
+	if (smpte)
+		return;
+
+	TempoSegment& last = segments.back();
+
+	// several changes at one tick: the last one wins
+	if (tick <= last.tick) {
+		last.scaledUsecPerTick = usecPerQtrNote;
+		return;
+	}
+
+	const uint64_t scaledUsec = last.scaledUsec + (tick - last.tick) * last.scaledUsecPerTick;
+	segments.push_back({ tick, scaledUsec, usecPerQtrNote });
+}
+
+uint64_t TempoMap::tickToUsec(const uint64_t tick) const {
+	// last segment starting at or before tick
+	auto it = std::upper_bound(segments.begin(), segments.end(), tick,
+		[](const uint64_t t, const TempoSegment& seg) { return t < seg.tick; });
+	const TempoSegment& seg = *(it - 1);
+
+	const uint64_t scaledUsec = seg.scaledUsec + (tick - seg.tick) * seg.scaledUsecPerTick;
+	return (scaledUsec + divisor / 2) / divisor;
+}
+
+uint32_t TempoMap::usecPerQtrNoteAt(const uint64_t usec) const {
+	if (smpte)
+		return 0;
+
+	// last segment starting at or before usec
+	const uint64_t scaledUsec = usec * divisor;
+	auto it = std::upper_bound(segments.begin(), segments.end(), scaledUsec,
+		[](const uint64_t t, const TempoSegment& seg) { return t < seg.scaledUsec; });
+	return static_cast<uint32_t>((it - 1)->scaledUsecPerTick);
+}
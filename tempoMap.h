@@ -0,0 +1,69 @@
+/*******************************************************************
+*   tempoMap.h
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module converts absolute delta-time ticks to microseconds
+// from the start of the song. It is built once, after parsing, from
+// every 0x51 "Set Tempo" event in every track, and is read-only from
+// then on, so any number of playback threads can query it without
+// shared mutable tempo state.
+// All arithmetic is exact 64-bit integer: each segment's start is
+// kept in units of 1/divisor microseconds, so nothing accumulates
+// rounding error and every track lands on the same microsecond for
+// the same tick, however long the song. Queries are a binary search
+// over the (few) tempo segments.
+
+#ifndef TEMPOMAP_H
+#define TEMPOMAP_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// MIDI default until the first "Set Tempo" event
+#define TEMPO_MAP_DEFAULT_USEC_PER_QTR_NOTE	(500000)
+
+struct TempoSegment {
+	uint64_t tick;
+
+	// start of the segment, in microseconds * divisor
+	uint64_t scaledUsec;
+
+	// length of one tick, in microseconds * divisor
+	uint64_t scaledUsecPerTick;
+};
+
+class TempoMap {
+private:
+	std::vector<TempoSegment> segments;
+
+	// SMPTE divisions have a fixed tick length that tempo events
+	// don't change; otherwise a tick is usecPerQtrNote / divisor
+	bool smpte;
+	uint64_t divisor;
+
+public:
+	TempoMap();
+
+	// start over with the header's division and the default tempo
+	void reset(const uint16_t division);
+
+	// from tick on, a quarter note lasts usecPerQtrNote.
+	// ticks must not decrease between calls
+	void setTempo(const uint64_t tick, const uint32_t usecPerQtrNote);
+
+	uint64_t tickToUsec(const uint64_t tick) const;
+
+	// tempo in effect at usec (0 for SMPTE divisions, which have none)
+	uint32_t usecPerQtrNoteAt(const uint64_t usec) const;
+
+	size_t size() const { return segments.size(); }
+};
+
+#endif
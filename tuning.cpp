@@ -0,0 +1,162 @@
+/*******************************************************************
+*   tuning.cpp
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module turns MIDI note numbers and pitch bends into what the
+// voices and drives play, by table lookup instead of pow() and
+// log2() per event. The tables are generated by constexpr functions,
+// so the compiler builds them rather than startup does: each note's
+// frequency, each of the 16384 pitch bend values' frequency factor
+// and cents (for MAX_PITCH_BEND_SEMITONES), and the note each MIDI
+// note folds to on a floppy (NOTE_DOWN_SHIFT_SEMITONES, then octaves
+// into MIN_FLOPPY_NOTE - MAX_FLOPPY_NOTE).
+// Notes are tuned per TUNING_SYSTEM. Another tuning is just another
+// constexpr ratio function: the tables, and so playback, don't
+// change. Floppy notes carry their cents from equal temperament,
+// since protocol v2 sends note numbers.
+
+#include "tuning.h"
+
+#include "MIDI.h"
+
+static constexpr double LN2 = 0.693147180559945309417;
+
+// <cmath> isn't constexpr. 2^x is 2^k * e^(f ln 2) with |f| <= 1/2,
+// where the Taylor series is good to double precision
+static constexpr double constexprExp2(const double x) {
+	long long k = static_cast<long long>(x + ((x < 0.0) ? -0.5 : 0.5));
+	const double f = (x - static_cast<double>(k)) * LN2;
+
+	double term = 1.0, sum = 1.0;
+	for (int n = 1; n < 20; ++n) {
+		term *= f / n;
+		sum += term;
+	}
+
+	for (; k > 0; --k)
+		sum *= 2.0;
+	for (; k < 0; ++k)
+		sum *= 0.5;
+	return sum;
+}
+
+// x > 0. as 2^k * m with m in [1, 2), where
+// ln m = 2 atanh((m - 1) / (m + 1)) converges fast
+static constexpr double constexprLog2(double x) {
+	double k = 0.0;
+	while (x >= 2.0) {
+		x *= 0.5;
+		++k;
+	}
+	while (x < 1.0) {
+		x *= 2.0;
+		--k;
+	}
+
+	const double y = (x - 1.0) / (x + 1.0);
+	double term = y, sum = 0.0;
+	for (int n = 0; n < 24; ++n) {
+		sum += term / (2 * n + 1);
+		term *= y * y;
+	}
+	return k + 2.0 * sum / LN2;
+}
+
+// half away from zero, as lround
+static constexpr int16_t constexprRound(const double x) {
+	return static_cast<int16_t>((x < 0.0) ? x - 0.5 : x + 0.5);
+}
+
+// frequency ratio of each note of the scale to its root
+static constexpr double scaleRatio(const int system, const int degree) {
+	const double just[NUM_SEMITONES_IN_OCTAVE] = {
+		1.0, 16.0 / 15.0, 9.0 / 8.0, 6.0 / 5.0, 5.0 / 4.0, 4.0 / 3.0, 45.0 / 32.0, 3.0 / 2.0, 8.0 / 5.0, 5.0 / 3.0, 9.0 / 5.0, 15.0 / 8.0 };
+	const double pythagorean[NUM_SEMITONES_IN_OCTAVE] = {
+		1.0, 256.0 / 243.0, 9.0 / 8.0, 32.0 / 27.0, 81.0 / 64.0, 4.0 / 3.0, 729.0 / 512.0, 3.0 / 2.0, 128.0 / 81.0, 27.0 / 16.0, 16.0 / 9.0, 243.0 / 128.0 };
+
+	switch (system) {
+	case TUNING_JUST_INTONATION:
+		return just[degree];
+	case TUNING_PYTHAGOREAN:
+		return pythagorean[degree];
+	default:
+		return constexprExp2(degree / fNUM_SEMITONES_IN_OCTAVE);
+	}
+}
+
+// the note's distance from the root, in octaves and scale degrees
+static constexpr int octaveFromRoot(const int note) {
+	const int fromRoot = note - TUNING_ROOT_NOTE;
+	return (fromRoot >= 0) ? fromRoot / NUM_SEMITONES_IN_OCTAVE : -((NUM_SEMITONES_IN_OCTAVE - 1 - fromRoot) / NUM_SEMITONES_IN_OCTAVE);
+}
+
+static constexpr int degreeFromRoot(const int note) {
+	return note - TUNING_ROOT_NOTE - NUM_SEMITONES_IN_OCTAVE * octaveFromRoot(note);
+}
+
+static constexpr double tunedFreq(const int note) {
+	// equal temperament needs no root: 2^(1/12) per semitone from A4
+	if (TUNING_SYSTEM == TUNING_EQUAL_TEMPERAMENT)
+		return constexprExp2(static_cast<double>(note - 69) / fNUM_SEMITONES_IN_OCTAVE) * TUNING_REFERENCE_HZ;
+
+	const double rootFreq = constexprExp2(static_cast<double>(TUNING_ROOT_NOTE - 69) / fNUM_SEMITONES_IN_OCTAVE) * TUNING_REFERENCE_HZ;
+	return rootFreq * constexprExp2(octaveFromRoot(note)) * scaleRatio(TUNING_SYSTEM, degreeFromRoot(note));
+}
+
+static constexpr int16_t tunedCents(const int note) {
+	if (TUNING_SYSTEM == TUNING_EQUAL_TEMPERAMENT)
+		return 0;
+
+	const int degree = degreeFromRoot(note);
+	return constexprRound(1200.0 * constexprLog2(scaleRatio(TUNING_SYSTEM, degree)) - 100.0 * degree);
+}
+
+static constexpr uint8_t foldToFloppy(const uint8_t note) {
+	// shift all notes down to sound better on floppies...
+	uint8_t floppyNote = static_cast<uint8_t>(note - NOTE_DOWN_SHIFT_SEMITONES);
+
+	// ... and if note is still too high for floppy drives,
+	// drop octaves until it's in range...
+	while (floppyNote > MAX_FLOPPY_NOTE)
+		floppyNote -= NUM_SEMITONES_IN_OCTAVE;
+
+	// ...or if note is too low for floppy drives,
+	// climb octaves until it's in range.
+	while (floppyNote < MIN_FLOPPY_NOTE)
+		floppyNote += NUM_SEMITONES_IN_OCTAVE;
+
+	return floppyNote;
+}
+
+constexpr TuningTables::TuningTables() : noteFreq(), noteCents(), bendFactor(), bendCents(), floppyNote() {
+	for (int n = 0; n < TUNING_NOTES; ++n) {
+		noteFreq[n] = tunedFreq(n);
+		noteCents[n] = tunedCents(n);
+		floppyNote[n] = foldToFloppy(static_cast<uint8_t>(n));
+	}
+
+	for (int b = 0; b < TUNING_BEND_VALUES; ++b) {
+		const double semitones = MAX_PITCH_BEND_SEMITONES * (static_cast<double>(b) - 8192.0) / 8192.0;
+		bendFactor[b] = constexprExp2(semitones / fNUM_SEMITONES_IN_OCTAVE);
+		bendCents[b] = constexprRound(1200.0 * constexprLog2(bendFactor[b]));
+	}
+}
+
+// constexpr, so it can only ever be built by the compiler
+constexpr TuningTables tuning;
+
+const char* tuningName() {
+	switch (TUNING_SYSTEM) {
+	case TUNING_JUST_INTONATION:
+		return "just intonation";
+	case TUNING_PYTHAGOREAN:
+		return "Pythagorean";
+	default:
+		return "equal temperament";
+	}
+}
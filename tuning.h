@@ -0,0 +1,81 @@
+/*******************************************************************
+*   tuning.h
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module turns MIDI note numbers and pitch bends into what the
+// voices and drives play, by table lookup instead of pow() and
+// log2() per event. The tables are generated by constexpr functions,
+// so the compiler builds them rather than startup does: each note's
+// frequency, each of the 16384 pitch bend values' frequency factor
+// and cents (for MAX_PITCH_BEND_SEMITONES), and the note each MIDI
+// note folds to on a floppy (NOTE_DOWN_SHIFT_SEMITONES, then octaves
+// into MIN_FLOPPY_NOTE - MAX_FLOPPY_NOTE).
+// Notes are tuned per TUNING_SYSTEM. Another tuning is just another
+// constexpr ratio function: the tables, and so playback, don't
+// change. Floppy notes carry their cents from equal temperament,
+// since protocol v2 sends note numbers.
+
+#ifndef TUNING_H
+#define TUNING_H
+
+#define TUNING_EQUAL_TEMPERAMENT		(0)
+#define TUNING_JUST_INTONATION			(1)
+#define TUNING_PYTHAGOREAN				(2)
+
+// how the 12 notes of each octave are tuned. just intonation
+// (5-limit) and Pythagorean are built up from TUNING_ROOT_NOTE,
+// which keeps its equal-tempered pitch
+#define TUNING_SYSTEM					(TUNING_EQUAL_TEMPERAMENT)
+#define TUNING_ROOT_NOTE				(60)
+
+// A4 (MIDI note 69)
+#define TUNING_REFERENCE_HZ				(440.0)
+
+#define TUNING_NOTES					(128)
+#define TUNING_BEND_VALUES				(16384)
+
+#include <cstdint>
+
+struct TuningTables {
+	double noteFreq[TUNING_NOTES];
+
+	// cents from equal temperament (0 unless retuned)
+	int16_t noteCents[TUNING_NOTES];
+
+	double bendFactor[TUNING_BEND_VALUES];
+	int16_t bendCents[TUNING_BEND_VALUES];
+
+	uint8_t floppyNote[TUNING_NOTES];
+
+	constexpr TuningTables();
+};
+
+// constant-initialized into read-only data
+extern const TuningTables tuning;
+
+inline double noteToFreq(const uint8_t note) {
+	return tuning.noteFreq[note & 0x7F];
+}
+
+// bend as sent: 0 - 16383, 8192 is none
+inline double pitchBendBytesToFactor(const uint16_t bend) {
+	return tuning.bendFactor[bend & 0x3FFF];
+}
+
+inline int16_t pitchBendBytesToCents(const uint16_t bend) {
+	return tuning.bendCents[bend & 0x3FFF];
+}
+
+// MIDI note to the note a floppy plays it as
+inline uint8_t toFloppyNote(const uint8_t note) {
+	return tuning.floppyNote[note & 0x7F];
+}
+
+const char* tuningName();
+
+#endif
@@ -0,0 +1,167 @@
+/*******************************************************************
+*   voiceAllocator.cpp
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module hands out the MAX_SIMUL sine voices to sounding notes.
+// Free voices live on a lock-free (tagged, ABA-safe) stack, and each
+// voice records which channel/note owns it in an atomic, so any
+// number of playback threads can allocate and release concurrently
+// without a mutex. When every voice is busy, a configurable policy
+// decides which sounding voice to steal (or whether to drop the note),
+// and counters keep track of how often that happened.
+
+#include "voiceAllocator.h"
+
+#define HEAD_INDEX_MASK					(0xFFFFULL)
+#define HEAD_TAG_SHIFT					(16)
+
+static inline uint64_t makeHead(const uint64_t oldHead, const uint16_t idx) {
+	return (((oldHead >> HEAD_TAG_SHIFT) + 1) << HEAD_TAG_SHIFT) | idx;
+}
+
+VoiceAllocator::VoiceAllocator() {
+	reset(STEAL_NONE);
+}
+
+void VoiceAllocator::reset(const VoiceStealPolicy stealPolicy) {
+	policy = stealPolicy;
+
+	// lowest voices on top
+	for (uint16_t i = 0; i < MAX_SIMUL; ++i) {
+		nextFree[i].store((i + 1 < MAX_SIMUL) ? i + 1 : NO_VOICE, std::memory_order_relaxed);
+		owner[i].store(VOICE_FREE, std::memory_order_relaxed);
+		note[i].store(0, std::memory_order_relaxed);
+		startedAt[i].store(0, std::memory_order_relaxed);
+		loudness[i].store(0.0f, std::memory_order_relaxed);
+	}
+
+	sequence.store(0, std::memory_order_relaxed);
+	numAllocations.store(0, std::memory_order_relaxed);
+	numSteals.store(0, std::memory_order_relaxed);
+	numDrops.store(0, std::memory_order_relaxed);
+	freeHead.store(0, std::memory_order_release);
+}
+
+uint16_t VoiceAllocator::popFree() {
+	uint64_t head = freeHead.load(std::memory_order_acquire);
+	for (;;) {
+		const uint16_t idx = static_cast<uint16_t>(head & HEAD_INDEX_MASK);
+		if (idx == NO_VOICE)
+			return NO_VOICE;
+
+		// the tag makes this CAS fail if idx was popped and
+		// pushed back (with a different next) in the meantime
+		const uint64_t newHead = makeHead(head, nextFree[idx].load(std::memory_order_relaxed));
+		if (freeHead.compare_exchange_weak(head, newHead, std::memory_order_acq_rel, std::memory_order_acquire))
+			return idx;
+	}
+}
+
+void VoiceAllocator::pushFree(const uint16_t idx) {
+	uint64_t head = freeHead.load(std::memory_order_relaxed);
+	uint64_t newHead;
+	do {
+		nextFree[idx].store(static_cast<uint16_t>(head & HEAD_INDEX_MASK), std::memory_order_relaxed);
+		newHead = makeHead(head, idx);
+	} while (!freeHead.compare_exchange_weak(head, newHead, std::memory_order_release, std::memory_order_relaxed));
+}
+
+// linear scan, but only ever runs when all MAX_SIMUL voices are busy
+uint16_t VoiceAllocator::chooseVictim(const uint8_t newNote) const {
+	uint16_t best = NO_VOICE;
+	uint64_t oldest = UINT64_MAX;
+	float quietest = 0.0f;
+
+	for (uint16_t i = 0; i < MAX_SIMUL; ++i) {
+		if (owner[i].load(std::memory_order_relaxed) == VOICE_FREE)
+			continue;
+
+		// a voice on the same note, else the oldest
+		if (policy == STEAL_SAME_NOTE && note[i].load(std::memory_order_relaxed) == newNote)
+			return i;
+
+		switch (policy) {
+		case STEAL_SAME_NOTE:
+		case STEAL_OLDEST: {
+			const uint64_t t = startedAt[i].load(std::memory_order_relaxed);
+			if (t < oldest) {
+				oldest = t;
+				best = i;
+			}
+			break;
+		}
+		case STEAL_QUIETEST: {
+			const float l = loudness[i].load(std::memory_order_relaxed);
+			if (best == NO_VOICE || l < quietest) {
+				quietest = l;
+				best = i;
+			}
+			break;
+		}
+		default:
+			return NO_VOICE;
+		}
+	}
+	return best;
+}
+
+void VoiceAllocator::claim(const uint16_t idx, const uint8_t newNote, const float newLoudness) {
+	note[idx].store(newNote, std::memory_order_relaxed);
+	loudness[idx].store(newLoudness, std::memory_order_relaxed);
+	startedAt[idx].store(sequence.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+	numAllocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint16_t VoiceAllocator::allocate(const uint32_t newOwner, const uint8_t newNote, const float newLoudness, uint32_t& stolenFrom) {
+	stolenFrom = VOICE_FREE;
+
+	uint16_t idx = popFree();
+	if (idx != NO_VOICE) {
+		owner[idx].store(newOwner, std::memory_order_release);
+		claim(idx, newNote, newLoudness);
+		return idx;
+	}
+
+	// pool exhausted. a victim may be released or stolen by someone
+	// else between choosing and claiming it, so retry a few times
+	for (int attempt = 0; policy != STEAL_NONE && attempt < 4; ++attempt) {
+		idx = chooseVictim(newNote);
+		if (idx == NO_VOICE)
+			break;
+
+		uint32_t victim = owner[idx].load(std::memory_order_acquire);
+		if (victim != VOICE_FREE && owner[idx].compare_exchange_strong(victim, newOwner, std::memory_order_acq_rel)) {
+			stolenFrom = victim;
+			claim(idx, newNote, newLoudness);
+			numSteals.fetch_add(1, std::memory_order_relaxed);
+			return idx;
+		}
+
+		// something may have been freed meanwhile
+		if ((idx = popFree()) != NO_VOICE) {
+			owner[idx].store(newOwner, std::memory_order_release);
+			claim(idx, newNote, newLoudness);
+			return idx;
+		}
+	}
+
+	numDrops.fetch_add(1, std::memory_order_relaxed);
+	return NO_VOICE;
+}
+
+bool VoiceAllocator::release(const uint16_t idx, const uint32_t currentOwner) {
+	if (idx >= MAX_SIMUL)
+		return false;
+
+	uint32_t expected = currentOwner;
+	if (!owner[idx].compare_exchange_strong(expected, VOICE_FREE, std::memory_order_acq_rel))
+		return false;
+
+	pushFree(idx);
+	return true;
+}
@@ -0,0 +1,96 @@
+/*******************************************************************
+*   voiceAllocator.h
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module hands out the MAX_SIMUL sine voices to sounding notes.
+// Free voices live on a lock-free (tagged, ABA-safe) stack, and each
+// voice records which channel/note owns it in an atomic, so any
+// number of playback threads can allocate and release concurrently
+// without a mutex. When every voice is busy, a configurable policy
+// decides which sounding voice to steal (or whether to drop the note),
+// and counters keep track of how often that happened.
+
+#ifndef VOICEALLOCATOR_H
+#define VOICEALLOCATOR_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "mixer.h"
+
+#define NO_VOICE						(0xFFFF)
+#define VOICE_FREE						(0)
+
+enum VoiceStealPolicy {
+	// never steal. new notes are dropped while the pool is exhausted
+	STEAL_NONE,
+
+	// steal the voice that started longest ago
+	STEAL_OLDEST,
+
+	// steal the voice that started quietest
+	STEAL_QUIETEST,
+
+	// steal a voice already sounding the same note number
+	// (on any channel), else fall back to oldest
+	STEAL_SAME_NOTE
+};
+
+// owner tag for a note on a channel (channels are 1-based).
+// never equal to VOICE_FREE
+inline uint32_t voiceOwner(const size_t chan, const uint8_t note) {
+	return (static_cast<uint32_t>(chan) << 8) + note + 1;
+}
+
+class VoiceAllocator {
+private:
+	// top 48 bits: ABA tag, bottom 16 bits: voice at top of free stack
+	std::atomic<uint64_t> freeHead;
+	std::atomic<uint16_t> nextFree[MAX_SIMUL];
+
+	std::atomic<uint32_t> owner[MAX_SIMUL];
+	std::atomic<uint8_t> note[MAX_SIMUL];
+	std::atomic<uint64_t> startedAt[MAX_SIMUL];
+	std::atomic<float> loudness[MAX_SIMUL];
+
+	std::atomic<uint64_t> sequence;
+	std::atomic<uint64_t> numAllocations, numSteals, numDrops;
+
+	VoiceStealPolicy policy;
+
+	uint16_t popFree();
+	void pushFree(const uint16_t idx);
+	uint16_t chooseVictim(const uint8_t newNote) const;
+	void claim(const uint16_t idx, const uint8_t newNote, const float newLoudness);
+
+public:
+	VoiceAllocator();
+
+	// mark every voice free. not safe while others are allocating
+	void reset(const VoiceStealPolicy stealPolicy);
+
+	// voice for newOwner, or NO_VOICE if the note was dropped.
+	// if a sounding voice had to be stolen, stolenFrom gets its
+	// previous owner, else VOICE_FREE
+	uint16_t allocate(const uint32_t newOwner, const uint8_t newNote, const float newLoudness, uint32_t& stolenFrom);
+
+	// false if the voice no longer belongs to currentOwner
+	// (it was stolen in the meantime)
+	bool release(const uint16_t idx, const uint32_t currentOwner);
+
+	bool owns(const uint16_t idx, const uint32_t currentOwner) const {
+		return idx < MAX_SIMUL && owner[idx].load(std::memory_order_acquire) == currentOwner;
+	}
+
+	uint64_t allocations() const { return numAllocations.load(std::memory_order_relaxed); }
+	uint64_t steals() const { return numSteals.load(std::memory_order_relaxed); }
+	uint64_t drops() const { return numDrops.load(std::memory_order_relaxed); }
+};
+
+#endif
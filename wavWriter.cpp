@@ -0,0 +1,123 @@
+/*******************************************************************
+*   wavWriter.cpp
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module writes interleaved float audio to a 16-bit PCM
+// WAV file, converting and buffering a block at a time.
+// The RIFF sizes aren't known until the end, so they are
+// patched in when the file is closed.
+
+#include "wavWriter.h"
+
+#define WAV_HEADER_SIZE					(44)
+#define WAV_BITS_PER_SAMPLE				(16)
+#define WAV_FORMAT_PCM					(1)
+
+// largest data chunk a 32-bit RIFF size can describe
+#define WAV_MAX_DATA_BYTES				(0xFFFFFFFFULL - WAV_HEADER_SIZE)
+
+static void putU16(std::ofstream& out, const uint16_t v) {
+	const char b[2] = { static_cast<char>(v & 0xFF), static_cast<char>(v >> 8) };
+	out.write(b, 2);
+}
+
+static void putU32(std::ofstream& out, const uint32_t v) {
+	const char b[4] = { static_cast<char>(v & 0xFF), static_cast<char>((v >> 8) & 0xFF), static_cast<char>((v >> 16) & 0xFF), static_cast<char>(v >> 24) };
+	out.write(b, 4);
+}
+
+WavWriter::WavWriter() : numChannels(0), sampleRate(0), framesWritten(0) {}
+
+WavWriter::~WavWriter() {
+	close();
+}
+
+// RIFF is little-endian regardless of host
+void WavWriter::writeHeader() {
+	uint64_t dataBytes = framesWritten * numChannels * (WAV_BITS_PER_SAMPLE / 8);
+	if (dataBytes > WAV_MAX_DATA_BYTES)
+		dataBytes = WAV_MAX_DATA_BYTES;
+
+	file.write("RIFF", 4);
+	putU32(file, static_cast<uint32_t>(dataBytes + WAV_HEADER_SIZE - 8));
+	file.write("WAVE", 4);
+
+	file.write("fmt ", 4);
+	putU32(file, 16);
+	putU16(file, WAV_FORMAT_PCM);
+	putU16(file, numChannels);
+	putU32(file, sampleRate);
+	putU32(file, sampleRate * numChannels * (WAV_BITS_PER_SAMPLE / 8));
+	putU16(file, static_cast<uint16_t>(numChannels * (WAV_BITS_PER_SAMPLE / 8)));
+	putU16(file, WAV_BITS_PER_SAMPLE);
+
+	file.write("data", 4);
+	putU32(file, static_cast<uint32_t>(dataBytes));
+}
+
+bool WavWriter::open(const std::string& name, const uint32_t sampleRate, const uint16_t numChannels) {
+	close();
+
+	if (numChannels < 1 || numChannels > 2) {
+		std::cout << "WAV output must be mono or stereo." << std::endl;
+		return false;
+	}
+
+	this->sampleRate = sampleRate;
+	this->numChannels = numChannels;
+	framesWritten = 0;
+
+	file.open(name, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file) {
+		std::cout << "Could not create " << name << "." << std::endl;
+		return false;
+	}
+
+	// placeholder sizes until close()
+	writeHeader();
+	return file.good();
+}
+
+void WavWriter::write(const float* samples, size_t frames) {
+	if (!file.is_open())
+		return;
+
+	while (frames) {
+		const size_t n = (frames < WAV_WRITE_BUFFER_FRAMES) ? frames : WAV_WRITE_BUFFER_FRAMES;
+		const size_t count = n * numChannels;
+
+		// samples are stored little-endian
+		for (size_t i = 0; i < count; ++i) {
+			float s = samples[i];
+			s = (s > 1.0f) ? 1.0f : ((s < -1.0f) ? -1.0f : s);
+			const uint16_t v = static_cast<uint16_t>(static_cast<int16_t>(s * 32767.0f));
+			buffer[2 * i] = static_cast<char>(v & 0xFF);
+			buffer[2 * i + 1] = static_cast<char>(v >> 8);
+		}
+		file.write(buffer, 2 * count);
+
+		samples += count;
+		frames -= n;
+		framesWritten += n;
+	}
+}
+
+bool WavWriter::close() {
+	if (!file.is_open())
+		return true;
+
+	file.seekp(0);
+	writeHeader();
+	const bool ok = file.good();
+	file.close();
+
+	if (!ok)
+		std::cout << "Error writing WAV file." << std::endl;
+
+	return ok;
+}
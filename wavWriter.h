@@ -0,0 +1,53 @@
+/*******************************************************************
+*   wavWriter.h
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module writes interleaved float audio to a 16-bit PCM
+// WAV file, converting and buffering a block at a time.
+// The RIFF sizes aren't known until the end, so they are
+// patched in when the file is closed.
+
+#ifndef WAVWRITER_H
+#define WAVWRITER_H
+
+// frames converted per write to the file
+#define WAV_WRITE_BUFFER_FRAMES			(4096)
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+class WavWriter {
+private:
+	std::ofstream file;
+	uint16_t numChannels;
+	uint32_t sampleRate;
+	uint64_t framesWritten;
+
+	// converted 16-bit little-endian samples (up to stereo)
+	char buffer[WAV_WRITE_BUFFER_FRAMES * 2 * 2];
+
+	void writeHeader();
+
+public:
+	WavWriter();
+	~WavWriter();
+
+	// mono or stereo only
+	bool open(const std::string& name, const uint32_t sampleRate, const uint16_t numChannels);
+
+	// frames of interleaved samples in [-1, 1] (clamped)
+	void write(const float* samples, size_t frames);
+
+	bool close();
+
+	uint64_t frames() const { return framesWritten; }
+};
+
+#endif
@@ -0,0 +1,110 @@
+/*******************************************************************
+*   wavetable.cpp
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module provides the single-period tables the mixer's
+// oscillators read from. Each table is WAVETABLE_SIZE samples (8 KB)
+// so a voice's table stays in L1, plus one guard sample repeating the
+// first so interpolation never has to wrap. A voice's phase is 32 bits
+// spanning one full period: the top WAVETABLE_BITS index the table,
+// the rest are the fraction interpolated across, and wrapping is just
+// unsigned overflow.
+// Square and saw are built band-limited, one table per octave with
+// the harmonic count halving each level (Lanczos-smoothed against
+// ringing), and a voice reads the richest level with no harmonic at
+// or above Nyquist. Every table is generated by constexpr functions,
+// so it is built by the compiler rather than at startup.
+
+#include "wavetable.h"
+
+#define WAVETABLE_MAX_HARMONICS			(1 << (WAVETABLE_LEVELS - 1))
+
+static constexpr double PI = 3.14159265358979323846;
+
+// <cmath> isn't constexpr. reduce to [-pi/2, pi/2],
+// where the Taylor series is good to double precision
+static constexpr double constexprSin(double x) {
+	const long long periods = static_cast<long long>(x / (2.0 * PI) + ((x < 0.0) ? -0.5 : 0.5));
+	x -= static_cast<double>(periods) * 2.0 * PI;
+	if (x > PI / 2.0)
+		x = PI - x;
+	else if (x < -PI / 2.0)
+		x = -PI - x;
+
+	double term = x, sum = x;
+	for (int n = 1; n < 12; ++n) {
+		term *= -x * x / ((2.0 * n) * (2.0 * n + 1.0));
+		sum += term;
+	}
+	return sum;
+}
+
+template <int waveform>
+struct WavetableBank {
+	// a sine has only the one harmonic
+	static constexpr int levels = (waveform == WAVE_SINE) ? 1 : WAVETABLE_LEVELS;
+
+	float samples[levels][WAVETABLE_SIZE + 1];
+
+	constexpr WavetableBank() : samples() {
+		double sine[WAVETABLE_SIZE] = {};
+		for (int i = 0; i < WAVETABLE_SIZE; ++i)
+			sine[i] = constexprSin(2.0 * PI * i / WAVETABLE_SIZE);
+
+		for (int level = 0; level < levels; ++level) {
+			const int harmonics = (waveform == WAVE_SINE) ? 1 : (WAVETABLE_MAX_HARMONICS >> level);
+
+			// harmonic h is just the sine table read h times as fast
+			double wave[WAVETABLE_SIZE] = {};
+			for (int h = 1; h <= harmonics; ++h) {
+				// square: odd harmonics at 1/h. saw: all of them, alternating
+				if (waveform == WAVE_SQUARE && (h & 1) == 0)
+					continue;
+				const double sigma = PI * h / (harmonics + 1);
+				const double amplitude = ((waveform == WAVE_SAW && (h & 1) == 0) ? -1.0 : 1.0) / h
+					* ((waveform == WAVE_SINE) ? 1.0 : constexprSin(sigma) / sigma);
+				for (int i = 0; i < WAVETABLE_SIZE; ++i)
+					wave[i] += amplitude * sine[(h * i) & (WAVETABLE_SIZE - 1)];
+			}
+
+			// every level peaks at 1, like the sine did
+			double peak = 0.0;
+			for (int i = 0; i < WAVETABLE_SIZE; ++i) {
+				const double m = (wave[i] < 0.0) ? -wave[i] : wave[i];
+				if (m > peak)
+					peak = m;
+			}
+			for (int i = 0; i < WAVETABLE_SIZE; ++i)
+				samples[level][i] = static_cast<float>(wave[i] / peak);
+			samples[level][WAVETABLE_SIZE] = samples[level][0];
+		}
+	}
+};
+
+// constexpr constructor: constant-initialized into read-only data
+static const WavetableBank<OSCILLATOR_WAVEFORM> bank;
+
+// harmonic H of level L stays below Nyquist while H * inc < 2^31,
+// i.e. while inc < 2^(31 - (WAVETABLE_LEVELS - 1) + L)
+const float* wavetableFor(const uint32_t phaseIncrement) {
+	int level = 0;
+	while (level + 1 < WavetableBank<OSCILLATOR_WAVEFORM>::levels && (phaseIncrement >> (32 - WAVETABLE_LEVELS + level)) != 0)
+		++level;
+	return bank.samples[level];
+}
+
+const char* waveformName() {
+	switch (OSCILLATOR_WAVEFORM) {
+	case WAVE_SQUARE:
+		return "band-limited square";
+	case WAVE_SAW:
+		return "band-limited saw";
+	default:
+		return "sine";
+	}
+}
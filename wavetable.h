@@ -0,0 +1,55 @@
+/*******************************************************************
+*   wavetable.h
+*   SongOfTheFloppies
+*	Kareem Omar
+*
+*	6/18/2015
+*   This program is entirely my own work.
+*******************************************************************/
+
+// This module provides the single-period tables the mixer's
+// oscillators read from. Each table is WAVETABLE_SIZE samples (8 KB)
+// so a voice's table stays in L1, plus one guard sample repeating the
+// first so interpolation never has to wrap. A voice's phase is 32 bits
+// spanning one full period: the top WAVETABLE_BITS index the table,
+// the rest are the fraction interpolated across, and wrapping is just
+// unsigned overflow.
+// Square and saw are built band-limited, one table per octave with
+// the harmonic count halving each level (Lanczos-smoothed against
+// ringing), and a voice reads the richest level with no harmonic at
+// or above Nyquist. Every table is generated by constexpr functions,
+// so it is built by the compiler rather than at startup.
+
+#ifndef WAVETABLE_H
+#define WAVETABLE_H
+
+#define WAVE_SINE						(0)
+#define WAVE_SQUARE						(1)
+#define WAVE_SAW						(2)
+
+// timbre of every sine-side voice
+#define OSCILLATOR_WAVEFORM				(WAVE_SINE)
+
+// table length is 1 << WAVETABLE_BITS
+#define WAVETABLE_BITS					(11)
+#define WAVETABLE_SIZE					(1 << WAVETABLE_BITS)
+
+// low phase bits interpolated between table entries
+#define WAVETABLE_FRACTION_BITS			(32 - WAVETABLE_BITS)
+#define WAVETABLE_FRACTION_MASK			((1u << WAVETABLE_FRACTION_BITS) - 1)
+
+// phase units per period
+#define WAVETABLE_PHASE_SPAN			(4294967296.0)
+
+// band-limited levels (octaves). level 0 has
+// 1 << (WAVETABLE_LEVELS - 1) harmonics
+#define WAVETABLE_LEVELS				(8)
+
+#include <cstdint>
+
+// the WAVETABLE_SIZE + 1 samples to play at this phase increment
+const float* wavetableFor(const uint32_t phaseIncrement);
+
+const char* waveformName();
+
+#endif